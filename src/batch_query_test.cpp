@@ -0,0 +1,232 @@
+//测试批量PIR(cuckoo hash分bucket)，并与move_query多查询(multi_query_test)比较
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "bfvparams.h"
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+#include "mbatchpir.hpp"
+
+void print_usage();
+std::vector<std::vector<unsigned char>> populate_db(size_t num_obj, size_t obj_size);
+size_t reply_bytes(const std::vector<PIRReply>& replys);
+bool throws_invalid(BatchPIRServer& server, const std::vector<PIRQuery>& querys);
+int main(int argc, char *argv[])
+{
+    size_t obj_size = 0;
+    size_t num_obj = 0;
+    int threads = 1;
+    bool baseline = false;              //同时测试move_query多查询
+    std::vector<size_t> batch_sizes = {4, 16, 64, 256};
+    int option;
+    const char *optstring = "n:s:k:t:m";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            num_obj = std::stoi(optarg);
+            break;
+        case 's':
+            obj_size = std::stoi(optarg);
+            break;
+        case 'k':
+        {
+            batch_sizes.clear();
+            std::stringstream ss(optarg);
+            std::string item;
+            while(std::getline(ss, item, ','))
+            {
+                batch_sizes.push_back(std::stoi(item));
+            }
+            break;
+        }
+        case 't':
+            threads = std::stoi(optarg);
+            break;
+        case 'm':
+            baseline = true;
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (!num_obj || !obj_size)
+    {
+        print_usage();
+        return 1;
+    }
+    if(obj_size%2 == 1) {
+        obj_size++;
+        std::cout<<"FastPIR expects even obj_size; padding obj_size to "<<obj_size<<" bytes"<<std::endl<<std::endl;
+    }
+
+    srand(time(NULL));
+    std::chrono::high_resolution_clock::time_point time_start, time_end;
+    std::vector<std::vector<unsigned char>> db = populate_db(num_obj, obj_size);
+
+    std::unique_ptr<Mserver> multiServer;
+    std::unique_ptr<Mclient> multiClient;
+    if(baseline)
+    {
+        FastPIRParams params(num_obj, obj_size, POLY_MODULUS_DEGREE, PLAIN_BIT);
+        multiServer.reset(new Mserver(params));
+        multiClient.reset(new Mclient(params));
+        multiServer->set_db(db);
+        multiServer->preprocess_db();
+        multiServer->set_client_galois_keys(0, multiClient->get_galois_keys());
+    }
+
+    //单个查询扫描一遍库的乘法次数，作为批量查询工作量的参照
+    FastPIRParams scanParams(num_obj, obj_size, POLY_MODULUS_DEGREE, PLAIN_BIT);
+    uint64_t scan_multiplies = (uint64_t)scanParams.get_num_query_ciphertext() * (scanParams.get_num_columns_per_obj() / 2);
+    std::cout << "single query scan: " << scan_multiplies << " multiply_plain" << std::endl;
+    std::cout << "k\tbuckets\tcapacity\tpadded slots\tsetup(us)\tquery(us)\tresponse(us)\tmultiplies\trotations\tscans\tdecode(us)\treply(bytes)\tcorrect\trejects short";
+    if(baseline)
+        std::cout << "\tmulti response(us)\tmulti multiplies\tmulti rotations\tmulti correct";
+    std::cout << std::endl;
+    for(size_t k : batch_sizes)
+    {
+        std::vector<uint32_t> indices(k);
+        for(auto& i : indices)
+        {
+            i = rand() % num_obj;
+        }
+
+        time_start = std::chrono::high_resolution_clock::now();
+        auto layout = std::make_shared<const BatchPIRLayout>(num_obj, k);
+        BatchPIRServer server(layout, obj_size, threads);
+        server.set_db(db);
+        time_end = std::chrono::high_resolution_clock::now();
+        auto setup_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        BatchPIRClient client(layout, obj_size);
+        server.set_client_galois_keys(0, client.get_galois_keys());
+
+        std::vector<PIRQuery> querys;
+        time_start = std::chrono::high_resolution_clock::now();
+        bool ok = client.gen_query(indices, querys);
+        time_end = std::chrono::high_resolution_clock::now();
+        auto query_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+        if(!ok)
+        {
+            std::cout << k << "\tcuckoo insertion failed" << std::endl;
+            continue;
+        }
+
+        RequestTrace trace;
+        time_start = std::chrono::high_resolution_clock::now();
+        std::vector<PIRReply> replys;
+        {
+            TraceScope scope(&trace);
+            replys = server.get_response(0, querys);
+        }
+        time_end = std::chrono::high_resolution_clock::now();
+        auto response_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        time_start = std::chrono::high_resolution_clock::now();
+        auto records = client.decode_response(replys);
+        time_end = std::chrono::high_resolution_clock::now();
+        auto decode_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        bool correct = true;
+        for(size_t i = 0; i < k; ++i)
+        {
+            correct = correct && records[i] == db[indices[i]];
+        }
+        //少一个bucket的查询和少一个密文的查询都应该抛出异常，而不是退出进程
+        bool rejects_short = throws_invalid(server, std::vector<PIRQuery>(querys.begin(), querys.end() - 1));
+        std::vector<PIRQuery> short_query = querys;
+        short_query[0].pop_back();
+        rejects_short = rejects_short && throws_invalid(server, short_query);
+
+        //scans: 相当于单个查询扫描全库的次数
+        std::cout << k << "\t" << layout->get_num_buckets() << "\t" << layout->get_bucket_capacity() << "\t" << layout->padded_slots() << "\t" << setup_time << "\t"
+                  << query_time << "\t" << response_time << "\t" << trace.multiply_plain << "\t" << trace.rotations << "\t"
+                  << (double)trace.multiply_plain / scan_multiplies << "\t" << decode_time << "\t" << reply_bytes(replys) << "\t" << (correct ? "yes" : "no")
+                  << "\t" << (rejects_short ? "yes" : "no");
+
+        if(baseline)
+        {
+            std::vector<int> desires(indices.begin(), indices.end());
+            std::vector<int> indexOffsets(k - 1);
+            std::vector<int> coeffOffsets(k - 1);
+            for(size_t i = 1; i < k; ++i)
+            {
+                indexOffsets[i - 1] = desires[i] / (POLY_MODULUS_DEGREE / 2) - desires[0] / (POLY_MODULUS_DEGREE / 2);
+                coeffOffsets[i - 1] = -(desires[i] % (POLY_MODULUS_DEGREE / 2) - desires[0] % (POLY_MODULUS_DEGREE / 2));
+            }
+            Query query = multiClient->gen_query(desires[0], indexOffsets, coeffOffsets);
+            RequestTrace multiTrace;
+            time_start = std::chrono::high_resolution_clock::now();
+            PIRReply response;
+            {
+                TraceScope scope(&multiTrace);
+                response = multiServer->get_multi_response(0, query);
+            }
+            time_end = std::chrono::high_resolution_clock::now();
+            auto multi_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+            std::cout << "\t" << multi_time << "\t" << multiTrace.multiply_plain << "\t" << multiTrace.rotations;
+            auto decoded = multiClient->decode_multi_response(response, indices);
+            bool multi_correct = true;
+            for(size_t i = 0; i < k; ++i)
+            {
+                multi_correct = multi_correct && decoded[i] == db[indices[i]];
+            }
+            std::cout << "\t" << (multi_correct ? "yes" : "no");
+        }
+        std::cout << std::endl;
+    }
+}
+
+size_t reply_bytes(const std::vector<PIRReply>& replys)
+{
+    size_t bytes = 0;
+    for(auto& r : replys)
+    {
+        for(auto& c : r)
+        {
+            bytes += c.size() * c.coeff_modulus_size() * POLY_MODULUS_DEGREE * 8;
+        }
+    }
+    return bytes;
+}
+
+bool throws_invalid(BatchPIRServer& server, const std::vector<PIRQuery>& querys)
+{
+    try
+    {
+        server.get_response(0, querys);
+    }
+    catch (const std::invalid_argument&)
+    {
+        return true;
+    }
+    return false;
+}
+
+void print_usage()
+{
+    std::cout << "usage: batch_query_test -n <number of objects> -s <object size in bytes> [-k <batch sizes, e.g. 4,16,64,256>] [-t <threads>] [-m]" << std::endl;
+}
+
+//Populate DB with random elements
+std::vector<std::vector<unsigned char>> populate_db(size_t num_obj, size_t obj_size) {
+    std::vector<std::vector<unsigned char>> db(num_obj);
+    for (int i = 0; i < num_obj; i++)
+    {
+        db[i] = std::vector<unsigned char>(obj_size);
+        for (int j = 0; j < obj_size; j++)
+        {
+            db[i][j] = rand() % 0xFF;
+        }
+    }
+    return db;
+}
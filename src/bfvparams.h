@@ -1,6 +1,8 @@
 #ifndef FASTPIR_BFV_PARAMS_H
 #define FASTPIR_BFV_PARAMS_H
 
+//FastPIRParams的默认参数，运行时可以选择FastPIRParams::param_sets()中的其它组合
+
 //Must be a power of 2, minimum value 4096
 #define POLY_MODULUS_DEGREE4096 4096
 #define POLY_MODULUS_DEGREE8192 8192
@@ -0,0 +1,196 @@
+//服务端基本运算的微基准和响应时间的代价模型报告: 先在每组参数下实测基本运算，再按库的形状统计
+//get_sum/move_queries/concat_response的运算次数并预测延迟；-v时实际跑一次与预测比较
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <sstream>
+
+#include "mfastpirparams.hpp"
+#include "mcostmodel.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+
+void print_usage();
+void print_counts(const std::string& name, const ResponseCostModel& model, const OperationCounts& c);
+int main(int argc, char *argv[])
+{
+    size_t num_obj = 0;
+    size_t obj_size = 0;
+    std::vector<std::pair<size_t, size_t>> param_sets;
+    size_t query_count = 1;
+    size_t range_offset = 0, range_length = 0;
+    int repeat = 10;
+    bool validate = false;
+    int option;
+    const char *optstring = "n:s:P:q:o:r:v";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            num_obj = std::stoi(optarg);
+            break;
+        case 's':
+            obj_size = std::stoi(optarg);
+            break;
+        case 'P':
+        {
+            std::stringstream ss(optarg);
+            std::string item;
+            while (std::getline(ss, item, ','))
+            {
+                size_t colon = item.find(':');
+                if (colon == std::string::npos)
+                {
+                    print_usage();
+                    return 1;
+                }
+                param_sets.emplace_back(std::stoul(item.substr(0, colon)), std::stoul(item.substr(colon + 1)));
+            }
+            break;
+        }
+        case 'q':
+            query_count = std::stoi(optarg);
+            break;
+        case 'o':
+        {
+            std::string range(optarg);
+            size_t comma = range.find(',');
+            if (comma == std::string::npos)
+            {
+                print_usage();
+                return 1;
+            }
+            range_offset = std::stoul(range.substr(0, comma));
+            range_length = std::stoul(range.substr(comma + 1));
+            break;
+        }
+        case 'r':
+            repeat = std::stoi(optarg);
+            break;
+        case 'v':
+            validate = true;
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (!num_obj || !obj_size || !query_count)
+    {
+        print_usage();
+        return 1;
+    }
+    obj_size += obj_size % 2;
+    if (range_length > 0 && range_offset + range_length > obj_size)
+    {
+        print_usage();
+        return 1;
+    }
+    if (param_sets.empty())
+    {
+        for (auto& set : FastPIRParams::param_sets())
+        {
+            param_sets.emplace_back(set.poly_degree, set.plain_bits);
+        }
+    }
+
+    bool incorrect_result = false;
+    for (auto& set : param_sets)
+    {
+        if (FastPIRParams::find_param_set(set.first, set.second) == nullptr)
+        {
+            std::cout << "unsupported BFV parameters: N = " << set.first << " plain bits = " << set.second << std::endl;
+            return 1;
+        }
+        FastPIRParams params(num_obj, obj_size, set.first, set.second);
+        PrimitiveTimings t = measure_primitives(params, repeat);
+        std::cout << "N = " << set.first << " plain bits = " << set.second << std::endl;
+        std::cout << "  multiply_plain " << t.multiply_plain << " us, inner product term " << t.inner_product_term << " us, add_inplace " << t.add << " us" << std::endl;
+        std::cout << "  transform_from_ntt " << t.intt << " us, rotate_rows " << t.rotate << " us, hoist " << t.hoist << " us, hoisted rotate " << t.hoisted_rotate << " us" << std::endl;
+        std::cout << "  encrypt " << t.encrypt << " us, decrypt " << t.decrypt << " us, save " << t.serialize << " us, load " << t.deserialize
+                  << " us, ciphertext " << t.ciphertext_bytes << " bytes" << std::endl;
+
+        ResponseCostModel model(params, t);
+        OperationCounts response = model.response_counts();
+        print_counts("get_response", model, response);
+        if (range_length > 0)
+            print_counts("range [" + std::to_string(range_offset) + ", " + std::to_string(range_offset + range_length) + ")", model, model.range_counts(range_offset, range_length));
+        if (query_count > 1)
+            print_counts("get_multi_response x" + std::to_string(query_count), model, model.multi_counts(query_count));
+
+        if (!validate)
+            continue;
+        //验证: 随机库上跑一次get_response(和多查询)，与预测比较
+        std::mt19937_64 rng(std::random_device{}());
+        std::vector<std::vector<unsigned char>> db(num_obj, std::vector<unsigned char>(obj_size));
+        for (auto& record : db)
+        {
+            for (auto& c : record)
+            {
+                c = rng() % 0xFF;
+            }
+        }
+        Mserver server(params);
+        Mclient client(params);
+        server.set_db(db);
+        server.preprocess_db();
+        server.set_client_galois_keys(0, client.get_galois_keys());
+        uint32_t row_size = set.first / 2;
+        std::vector<uint32_t> indices(query_count);
+        std::vector<int> indexOffsets, coeffOffsets;
+        for (size_t i = 0; i < query_count; i++)
+        {
+            indices[i] = rng() % num_obj;
+            if (i > 0)
+            {
+                indexOffsets.push_back(indices[i] / row_size - indices[0] / row_size);
+                coeffOffsets.push_back(-(int)(indices[i] % row_size) + (int)(indices[0] % row_size));
+            }
+        }
+        Query query = client.gen_query(indices[0], indexOffsets, coeffOffsets);
+        std::chrono::high_resolution_clock::time_point time_start, time_end;
+        time_start = std::chrono::high_resolution_clock::now();
+        PIRReply reply = server.get_response(0, query.query);
+        time_end = std::chrono::high_resolution_clock::now();
+        auto response_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+        //查询的反序列化和回复的序列化不在get_response里
+        OperationCounts compute = response;
+        compute.serialize = compute.deserialize = 0;
+        incorrect_result |= client.decode_response(reply, indices[0]) != db[indices[0]];
+        std::cout << "  measured get_response " << response_time << " us (predicted without serialization " << (long long)model.predict_us(compute) << " us)" << std::endl;
+        if (query_count > 1)
+        {
+            time_start = std::chrono::high_resolution_clock::now();
+            PIRReply multi = server.get_multi_response(0, query);
+            time_end = std::chrono::high_resolution_clock::now();
+            auto multi_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+            OperationCounts exact = model.multi_counts(coeffOffsets);
+            exact.serialize = exact.deserialize = 0;
+            std::vector<std::vector<unsigned char>> objs = client.decode_multi_response(multi, indices);
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                incorrect_result |= objs[i] != db[indices[i]];
+            }
+            std::cout << "  measured get_multi_response " << multi_time << " us (predicted for these offsets " << (long long)model.predict_us(exact) << " us)" << std::endl;
+        }
+    }
+    if (validate)
+        std::cout << (incorrect_result ? "PIR Result is incorrect!" : "PIR result correct!") << std::endl;
+    return incorrect_result;
+}
+
+void print_counts(const std::string& name, const ResponseCostModel& model, const OperationCounts& c)
+{
+    std::cout << "  " << name << ": inner product terms " << (long long)c.inner_product_terms << ", intt " << (long long)c.intt
+              << ", rotations " << (long long)c.rotate << " (+" << (long long)c.hoisted_rotate << " hoisted), adds " << (long long)c.add
+              << ", ciphertexts in/out " << (long long)c.deserialize << "/" << (long long)c.serialize
+              << " -> predicted " << (long long)model.predict_us(c) << " us" << std::endl;
+}
+
+void print_usage()
+{
+    std::cout << "usage: cost_model -n <number of objects> -s <object size> [-P <N:bits[,N:bits...]>] [-q <query count>]"
+              << " [-o <range offset,length>] [-r <repeats per primitive>] [-v]" << std::endl;
+}
@@ -0,0 +1,386 @@
+//统一的基准测试: 对(记录数, 记录大小, 参数组, 线程数, 查询数)的每种组合测量各阶段时间，
+//重复-r次给出均值/标准差/分位数，记录峰值RSS和传输字节数，结果写成JSON/CSV便于做回归比较。
+//库内容和查询的index由-S的种子决定；SEAL的密钥和加密随机数不受种子控制，不影响时间和字节数
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+#include "bfvparams.h"
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+
+struct BenchConfig
+{
+    size_t num_obj;
+    size_t obj_size;
+    size_t poly_degree;
+    size_t plain_bits;
+    int threads;                    //同时处理查询的线程数(共用一个Mserver)
+    size_t query_count;             //每个查询取回的记录数，>1时走get_multi_response
+};
+
+struct StageResult
+{
+    std::string stage;
+    std::vector<double> samples{};  //us
+
+    double mean() const
+    {
+        double sum = 0;
+        for (double s : samples)
+            sum += s;
+        return sum / samples.size();
+    }
+    double stddev() const
+    {
+        double m = mean(), sum = 0;
+        for (double s : samples)
+            sum += (s - m) * (s - m);
+        return samples.size() > 1 ? std::sqrt(sum / (samples.size() - 1)) : 0;
+    }
+    double percentile(double p) const
+    {
+        std::vector<double> sorted(samples);
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()))];
+    }
+};
+
+struct BenchResult
+{
+    BenchConfig config;
+    std::vector<StageResult> stages;
+    size_t galois_key_bytes = 0;
+    size_t query_bytes = 0;
+    size_t reply_bytes = 0;
+    double throughput = 0;          //get_response每秒处理的查询数
+    long peak_rss_kb = 0;
+    bool correct = true;
+};
+
+void print_usage();
+std::vector<size_t> parse_list(const std::string& arg);
+BenchResult run_config(const BenchConfig& config, int repeat, uint64_t seed);
+void write_json(const std::string& path, const std::vector<BenchResult>& results, uint64_t seed, int repeat);
+void write_csv(const std::string& path, const std::vector<BenchResult>& results);
+
+int main(int argc, char *argv[])
+{
+    std::vector<size_t> num_objs, obj_sizes;
+    std::vector<std::pair<size_t, size_t>> param_sets = {{POLY_MODULUS_DEGREE, PLAIN_BIT}};
+    std::vector<size_t> thread_counts = {1}, query_counts = {1};
+    int repeat = 5;
+    uint64_t seed = 1;
+    std::string json_path, csv_path;
+    int option;
+    const char *optstring = "n:s:P:t:q:r:S:j:c:";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            num_objs = parse_list(optarg);
+            break;
+        case 's':
+            obj_sizes = parse_list(optarg);
+            break;
+        case 'P':
+        {
+            //N:bits,N:bits,...
+            param_sets.clear();
+            std::stringstream ss(optarg);
+            std::string item;
+            while (std::getline(ss, item, ','))
+            {
+                size_t colon = item.find(':');
+                if (colon == std::string::npos)
+                {
+                    print_usage();
+                    return 1;
+                }
+                param_sets.emplace_back(std::stoul(item.substr(0, colon)), std::stoul(item.substr(colon + 1)));
+            }
+            break;
+        }
+        case 't':
+            thread_counts = parse_list(optarg);
+            break;
+        case 'q':
+            query_counts = parse_list(optarg);
+            break;
+        case 'r':
+            repeat = std::stoi(optarg);
+            break;
+        case 'S':
+            seed = std::stoull(optarg);
+            break;
+        case 'j':
+            json_path = optarg;
+            break;
+        case 'c':
+            csv_path = optarg;
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (num_objs.empty() || obj_sizes.empty() || param_sets.empty() || repeat <= 0)
+    {
+        print_usage();
+        return 1;
+    }
+    for (auto& set : param_sets)
+    {
+        if (FastPIRParams::find_param_set(set.first, set.second) == nullptr)
+        {
+            std::cout << "unsupported BFV parameters: N = " << set.first << " plain bits = " << set.second << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    bool incorrect_result = false;
+    for (size_t num_obj : num_objs)
+    for (size_t obj_size : obj_sizes)
+    for (auto& set : param_sets)
+    for (size_t threads : thread_counts)
+    for (size_t query_count : query_counts)
+    {
+        BenchConfig config{num_obj, obj_size + obj_size % 2, set.first, set.second, (int)std::max<size_t>(threads, 1), std::max<size_t>(query_count, 1)};
+        BenchResult result = run_config(config, repeat, seed);
+        incorrect_result |= !result.correct;
+        std::cout << "n = " << config.num_obj << " size = " << config.obj_size << " N = " << config.poly_degree << " bits = " << config.plain_bits
+                  << " threads = " << config.threads << " queries = " << config.query_count << (result.correct ? "" : "  PIR result incorrect!") << std::endl;
+        for (auto& s : result.stages)
+        {
+            std::cout << "  " << s.stage << " (us): mean " << (long long)s.mean() << " stddev " << (long long)s.stddev()
+                      << " p50 " << (long long)s.percentile(50) << " p99 " << (long long)s.percentile(99) << std::endl;
+        }
+        std::cout << "  query " << result.query_bytes << " B, reply " << result.reply_bytes << " B, galois keys " << result.galois_key_bytes
+                  << " B, throughput " << result.throughput << " q/s, peak RSS " << result.peak_rss_kb << " KB" << std::endl;
+        results.push_back(std::move(result));
+    }
+
+    if (!json_path.empty())
+        write_json(json_path, results, seed, repeat);
+    if (!csv_path.empty())
+        write_csv(csv_path, results);
+    return incorrect_result;
+}
+
+std::vector<size_t> parse_list(const std::string& arg)
+{
+    std::vector<size_t> values;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        values.push_back(std::stoul(item));
+    }
+    return values;
+}
+
+//峰值RSS(VmHWM)，每个配置开始前通过clear_refs清零，这样各配置的峰值互不影响
+long peak_rss_kb(bool reset)
+{
+    if (reset)
+    {
+        std::ofstream("/proc/self/clear_refs") << "5";
+        return 0;
+    }
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::stol(line.substr(6));
+    }
+    return 0;
+}
+
+//按tcp客户端/服务端的序列化方式计算字节数
+template <typename T>
+size_t serialized_size(const T& obj)
+{
+    std::stringstream ss;
+    obj.save(ss);
+    return ss.str().size();
+}
+
+template <typename F>
+double time_us(F f)
+{
+    auto time_start = std::chrono::high_resolution_clock::now();
+    f();
+    auto time_end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time_end - time_start).count() / 1000.0;
+}
+
+BenchResult run_config(const BenchConfig& config, int repeat, uint64_t seed)
+{
+    BenchResult result;
+    result.config = config;
+    peak_rss_kb(true);
+    std::mt19937_64 rng(seed);
+    FastPIRParams params(config.num_obj, config.obj_size, config.poly_degree, config.plain_bits);
+    uint32_t row_size = config.poly_degree / 2;
+
+    std::vector<std::vector<unsigned char>> db(config.num_obj, std::vector<unsigned char>(config.obj_size));
+    for (auto& record : db)
+    {
+        for (auto& c : record)
+        {
+            c = rng() % 0xFF;
+        }
+    }
+    StageResult set_db{"set_db"}, preprocess{"preprocess_db"}, gen_query{"gen_query"}, gen_online{"gen_query_precomputed"}, response{"get_response"}, decode{"decode_response"};
+    Mserver server(params);
+    Mclient client(params);
+    //建库只测一次
+    set_db.samples.push_back(time_us([&]() { server.set_db(db); }));
+    preprocess.samples.push_back(time_us([&]() { server.preprocess_db(); }));
+    seal::GaloisKeys gal_keys = client.get_galois_keys();
+    result.galois_key_bytes = serialized_size(gal_keys);
+    server.set_client_galois_keys(0, gal_keys);
+
+    for (int r = 0; r < repeat; r++)
+    {
+        std::vector<uint32_t> indices(config.query_count);
+        for (auto& index : indices)
+        {
+            index = rng() % config.num_obj;
+        }
+        std::vector<int> indexOffsets, coeffOffsets;
+        for (size_t i = 1; i < indices.size(); ++i)
+        {
+            indexOffsets.push_back(indices[i] / row_size - indices[0] / row_size);
+            coeffOffsets.push_back(-(int)(indices[i] % row_size) + (int)(indices[0] % row_size));
+        }
+        Query query;
+        gen_query.samples.push_back(time_us([&]() { query = client.gen_query(indices[0], indexOffsets, coeffOffsets); }));
+
+        //threads个线程同时处理同一个查询，每个线程的耗时都是一个样本
+        std::vector<PIRReply> replys(config.threads);
+        std::vector<double> latency(config.threads);
+        std::vector<std::thread> workers;
+        double wall = time_us([&]() {
+            for (int t = 0; t < config.threads; t++)
+            {
+                workers.emplace_back([&, t]() {
+                    latency[t] = time_us([&]() {
+                        replys[t] = config.query_count > 1 ? server.get_multi_response(0, query) : server.get_response(0, query.query);
+                    });
+                });
+            }
+            for (auto& w : workers)
+            {
+                w.join();
+            }
+        });
+        response.samples.insert(response.samples.end(), latency.begin(), latency.end());
+        result.throughput += config.threads / wall * 1e6 / repeat;
+
+        std::vector<std::vector<unsigned char>> objs;
+        decode.samples.push_back(time_us([&]() {
+            if (config.query_count > 1)
+                objs = client.decode_multi_response(replys[0], indices);
+            else
+                objs.push_back(client.decode_response(replys[0], indices[0]));
+        }));
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            result.correct &= objs[i] == db[indices[i]];
+        }
+        if (r == 0)
+        {
+            for (auto& ct : query.query)
+                result.query_bytes += serialized_size(ct);
+            for (auto& ct : replys[0])
+                result.reply_bytes += serialized_size(ct);
+        }
+    }
+    //在线部分: 0的密文池补满后再生成，只剩一次编码和add_plain
+    client.start_precompute(1);
+    for (int r = 0; r < repeat; r++)
+    {
+        while (client.precomputed_ciphertexts() < client.get_num_query_ciphertext())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        uint32_t index = rng() % config.num_obj;
+        gen_online.samples.push_back(time_us([&]() { client.gen_query(index); }));
+    }
+    client.stop_precompute();
+    result.stages = {set_db, preprocess, gen_query, gen_online, response, decode};
+    result.peak_rss_kb = peak_rss_kb(false);
+    return result;
+}
+
+void write_json(const std::string& path, const std::vector<BenchResult>& results, uint64_t seed, int repeat)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "cannot open " << path << std::endl;
+        exit(1);
+    }
+    file << "{\n  \"seed\": " << seed << ",\n  \"repeat\": " << repeat << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        file << "    {\"num_obj\": " << r.config.num_obj << ", \"obj_size\": " << r.config.obj_size
+             << ", \"poly_degree\": " << r.config.poly_degree << ", \"plain_bits\": " << r.config.plain_bits
+             << ", \"threads\": " << r.config.threads << ", \"query_count\": " << r.config.query_count
+             << ", \"correct\": " << (r.correct ? "true" : "false")
+             << ", \"query_bytes\": " << r.query_bytes << ", \"reply_bytes\": " << r.reply_bytes
+             << ", \"galois_key_bytes\": " << r.galois_key_bytes << ", \"throughput_qps\": " << r.throughput
+             << ", \"peak_rss_kb\": " << r.peak_rss_kb << ",\n     \"stages\": {";
+        for (size_t j = 0; j < r.stages.size(); j++)
+        {
+            const StageResult& s = r.stages[j];
+            file << (j ? ", " : "") << "\"" << s.stage << "\": {\"samples\": " << s.samples.size() << ", \"mean_us\": " << s.mean()
+                 << ", \"stddev_us\": " << s.stddev() << ", \"p50_us\": " << s.percentile(50) << ", \"p90_us\": " << s.percentile(90)
+                 << ", \"p99_us\": " << s.percentile(99) << ", \"min_us\": " << s.percentile(0) << ", \"max_us\": " << s.percentile(100) << "}";
+        }
+        file << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+
+//每个(配置, 阶段)一行
+void write_csv(const std::string& path, const std::vector<BenchResult>& results)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "cannot open " << path << std::endl;
+        exit(1);
+    }
+    file << "num_obj,obj_size,poly_degree,plain_bits,threads,query_count,stage,samples,mean_us,stddev_us,p50_us,p90_us,p99_us,min_us,max_us,"
+         << "query_bytes,reply_bytes,galois_key_bytes,throughput_qps,peak_rss_kb,correct\n";
+    for (auto& r : results)
+    {
+        for (auto& s : r.stages)
+        {
+            file << r.config.num_obj << "," << r.config.obj_size << "," << r.config.poly_degree << "," << r.config.plain_bits << ","
+                 << r.config.threads << "," << r.config.query_count << "," << s.stage << "," << s.samples.size() << ","
+                 << s.mean() << "," << s.stddev() << "," << s.percentile(50) << "," << s.percentile(90) << "," << s.percentile(99) << ","
+                 << s.percentile(0) << "," << s.percentile(100) << "," << r.query_bytes << "," << r.reply_bytes << ","
+                 << r.galois_key_bytes << "," << r.throughput << "," << r.peak_rss_kb << "," << r.correct << "\n";
+        }
+    }
+}
+
+void print_usage()
+{
+    std::cout << "usage: fastpir_bench -n <num obj[,num obj...]> -s <obj size[,obj size...]> [-P <N:bits[,N:bits...]>] [-t <threads[,...]>]"
+              << " [-q <query count[,...]>] [-r <repeat>] [-S <seed>] [-j <json file>] [-c <csv file>]" << std::endl;
+}
@@ -0,0 +1,119 @@
+//比较get_sum叶子内积的三种实现: SEAL的multiply_plain + add_inplace、通用内核(N和素数个数在运行时)、按参数特化的内核
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+
+#include "bfvparams.h"
+#include "mfastpirparams.hpp"
+#include "mkernels.hpp"
+
+void print_usage();
+int main(int argc, char *argv[])
+{
+    size_t poly = POLY_MODULUS_DEGREE;
+    size_t p = PLAIN_BIT;
+    size_t count = 64;              //每次内积的项数(查询密文个数)
+    int repeat = 20;
+    int option;
+    const char *optstring = "N:p:q:r:";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'N':
+            poly = std::stoi(optarg);
+            break;
+        case 'p':
+            p = std::stoi(optarg);
+            break;
+        case 'q':
+            count = std::stoi(optarg);
+            break;
+        case 'r':
+            repeat = std::stoi(optarg);
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (!count || repeat <= 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    FastPIRParams params(poly * count / 2, 2, poly, p);
+    seal::SEALContext context(params.get_seal_params());
+    seal::KeyGenerator keygen(context);
+    seal::Encryptor encryptor(context, keygen.secret_key());
+    seal::Evaluator evaluator(context);
+    seal::BatchEncoder batch_encoder(context);
+    const std::vector<seal::Modulus>& moduli = context.first_context_data()->parms().coeff_modulus();
+    uint64_t plain_modulus = params.get_seal_params().plain_modulus().value();
+
+    std::mt19937_64 rng(std::random_device{}());
+    std::vector<seal::Ciphertext> query(count);
+    std::vector<seal::Plaintext> plain(count);
+    std::vector<uint64_t> slots(poly);
+    for (size_t j = 0; j < count; j++)
+    {
+        for (auto& s : slots)
+        {
+            s = rng() % plain_modulus;
+        }
+        batch_encoder.encode(slots, plain[j]);
+        evaluator.transform_to_ntt_inplace(plain[j], context.first_parms_id());
+        encryptor.encrypt_symmetric(plain[j], query[j]);
+        evaluator.transform_to_ntt_inplace(query[j]);
+    }
+
+    std::chrono::high_resolution_clock::time_point time_start, time_end;
+    seal::Ciphertext expected, temp_ct;
+    time_start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repeat; r++)
+    {
+        evaluator.multiply_plain(query[0], plain[0], expected);
+        for (size_t j = 1; j < count; j++)
+        {
+            evaluator.multiply_plain(query[j], plain[j], temp_ct);
+            evaluator.add_inplace(expected, temp_ct);
+        }
+    }
+    time_end = std::chrono::high_resolution_clock::now();
+    auto seal_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count() / repeat;
+
+    kernels::InnerProductKernel kernel[2] = {kernels::inner_product_ntt<0, 0>, kernels::select_inner_product(poly, moduli.size())};
+    long long kernel_time[2];
+    bool incorrect_result = false;
+    for (int k = 0; k < 2; k++)
+    {
+        seal::Ciphertext result;
+        time_start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < repeat; r++)
+        {
+            kernel[k](query.data(), plain.data(), count, moduli, result);
+        }
+        time_end = std::chrono::high_resolution_clock::now();
+        kernel_time[k] = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count() / repeat;
+        size_t coeffs = 2 * moduli.size() * poly;
+        if (!std::equal(result.data(), result.data() + coeffs, expected.data()))
+        {
+            incorrect_result = true;
+            std::cout << (k ? "specialized" : "generic") << " kernel result differs from SEAL" << std::endl;
+        }
+    }
+
+    std::cout << "N = " << poly << " plain bits = " << p << " data primes = " << moduli.size() << " terms = " << count
+              << (kernel[1] == kernel[0] ? " (no specialized kernel for these parameters)" : "") << std::endl;
+    std::cout << "multiply_plain + add_inplace (us): " << seal_time << std::endl;
+    std::cout << "generic kernel (us): " << kernel_time[0] << " (" << (double)seal_time / kernel_time[0] << "x)" << std::endl;
+    std::cout << "specialized kernel (us): " << kernel_time[1] << " (" << (double)seal_time / kernel_time[1] << "x)" << std::endl;
+    return incorrect_result;
+}
+
+void print_usage()
+{
+    std::cout << "usage: kernel_bench [-N <poly degree>] [-p <plain bits>] [-q <terms>] [-r <repeats>]" << std::endl;
+}
@@ -0,0 +1,184 @@
+//测试关键字PIR: 从(key, value)文件或随机生成的记录构建cuckoo表，按key查询存在和不存在的记录
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <sstream>
+#include <random>
+
+#include "bfvparams.h"
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+#include "mkeywordpir.hpp"
+
+void print_usage();
+int main(int argc, char *argv[])
+{
+    size_t num_records = 0;
+    size_t max_value_size = 64;
+    std::vector<std::string> files;
+    std::string output;
+    int threads = 1;
+    size_t lookups = 8;
+    size_t missing = 2;
+    size_t poly_degree = POLY_MODULUS_DEGREE;
+    size_t plain_bits = PLAIN_BIT;
+    int option;
+    const char *optstring = "n:s:f:o:t:k:m:N:b:";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            num_records = std::stoi(optarg);
+            break;
+        case 's':
+            max_value_size = std::stoi(optarg);
+            break;
+        case 'f':
+        {
+            std::stringstream ss(optarg);
+            std::string item;
+            while(std::getline(ss, item, ','))
+            {
+                files.push_back(item);
+            }
+            break;
+        }
+        case 'o':
+            output = optarg;
+            break;
+        case 't':
+            threads = std::stoi(optarg);
+            break;
+        case 'k':
+            lookups = std::stoi(optarg);
+            break;
+        case 'm':
+            missing = std::stoi(optarg);
+            break;
+        case 'N':
+            poly_degree = std::stoi(optarg);
+            break;
+        case 'b':
+            plain_bits = std::stoi(optarg);
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (!num_records && files.empty())
+    {
+        print_usage();
+        return 1;
+    }
+    if (FastPIRParams::find_param_set(poly_degree, plain_bits) == nullptr)
+    {
+        std::cout << "unsupported BFV parameters: N = " << poly_degree << " plain bits = " << plain_bits << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 rng(std::random_device{}());
+    std::chrono::high_resolution_clock::time_point time_start, time_end;
+    std::vector<KeywordRecord> records;
+    if(!files.empty())
+    {
+        records = load_keyword_records(files);
+    }
+    else
+    {
+        records.resize(num_records);
+        for(auto& r : records)
+        {
+            r.key = rng();
+            r.value.resize(1 + rng() % max_value_size);
+            for(auto& c : r.value)
+            {
+                c = rng() % 0xFF;
+            }
+        }
+        if(!output.empty())
+        {
+            save_keyword_records(output, records);
+        }
+    }
+    std::cout << "records: " << records.size() << std::endl;
+
+    KeywordPIRParams params;
+    params.poly_degree = poly_degree;
+    params.plain_bits = plain_bits;
+    time_start = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<unsigned char>> db = build_keyword_table(records, params, threads);
+    time_end = std::chrono::high_resolution_clock::now();
+    auto build_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+    std::cout << "table: " << params.partitions << " partitions x " << params.slots_per_partition << " slots, slot size "
+              << params.get_slot_size() << " bytes" << std::endl;
+
+    Mserver server(params.get_fastpir_params());
+    KeywordPIRClient client(params);
+    time_start = std::chrono::high_resolution_clock::now();
+    server.set_db(db);
+    server.preprocess_db();
+    time_end = std::chrono::high_resolution_clock::now();
+    auto db_preprocess_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+    server.set_client_galois_keys(0, client.get_galois_keys());
+
+    //前lookups个key存在，后missing个key(大概率)不存在
+    std::vector<uint64_t> keys;
+    std::vector<const KeywordRecord*> expected;
+    for(size_t i = 0; i < lookups; ++i)
+    {
+        expected.push_back(&records[rng() % records.size()]);
+        keys.push_back(expected.back()->key);
+    }
+    for(size_t i = 0; i < missing; ++i)
+    {
+        keys.push_back(rng());
+        expected.push_back(nullptr);
+    }
+
+    time_start = std::chrono::high_resolution_clock::now();
+    std::vector<PIRQuery> querys = client.gen_query(keys);
+    time_end = std::chrono::high_resolution_clock::now();
+    auto query_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+    time_start = std::chrono::high_resolution_clock::now();
+    std::vector<PIRReply> replys;
+    for(auto& q : querys)
+    {
+        replys.push_back(server.get_response(0, q));
+    }
+    time_end = std::chrono::high_resolution_clock::now();
+    auto response_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+    time_start = std::chrono::high_resolution_clock::now();
+    auto results = client.decode_response(replys);
+    time_end = std::chrono::high_resolution_clock::now();
+    auto decode_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+    bool incorrect_result = false;
+    for(size_t i = 0; i < keys.size(); ++i)
+    {
+        bool ok = expected[i] ? (results[i].first && results[i].second == expected[i]->value) : !results[i].first;
+        if(!ok)
+        {
+            incorrect_result = true;
+            std::cout << "error key = " << keys[i] << (expected[i] ? " (present)" : " (missing)") << std::endl;
+        }
+    }
+    std::cout << (incorrect_result ? "PIR Result is incorrect!" : "PIR result correct!") << std::endl << std::endl;
+    std::cout << "Keys: " << keys.size() << " DB scans: " << querys.size() << std::endl;
+    std::cout << "Table build time (us): " << build_time << std::endl;
+    std::cout << "DB preprocessing time (us): " << db_preprocess_time << std::endl;
+    std::cout << "Query generation time (us): " << query_time << std::endl;
+    std::cout << "Response generation time (us): " << response_time << std::endl;
+    std::cout << "Response decode time (us): "<< decode_time << std::endl;
+    return incorrect_result;
+}
+
+void print_usage()
+{
+    std::cout << "usage: keyword_query_test (-n <number of records> [-s <max value size>] [-o <output file>] | -f <file1,file2,...>)"
+              << " [-t <threads>] [-k <lookups>] [-m <missing lookups>] [-N <poly degree>] [-b <plain bits>]" << std::endl;
+}
@@ -0,0 +1,209 @@
+#include "mbatchpir.hpp"
+#include "mparallel.hpp"
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <cassert>
+#include <stdexcept>
+
+namespace
+{
+const int kMaxEvictions = 500;
+}
+
+BatchPIRLayout::BatchPIRLayout(size_t num_obj, size_t batch_size, size_t poly_degree, size_t plain_bits, uint64_t seed)
+    : num_obj(num_obj), poly_degree(poly_degree), plain_bits(plain_bits), seed(seed)
+{
+    num_buckets = std::max<size_t>(std::ceil(1.5 * batch_size), kHashCount);
+    buckets.resize(num_buckets);
+    for (uint32_t i = 0; i < num_obj; i++)
+    {
+        for (auto b : candidate_buckets(i))
+        {
+            buckets[b].push_back(i);
+        }
+    }
+    capacity = 1;
+    for (auto& b : buckets)
+    {
+        capacity = std::max(capacity, b.size());
+    }
+}
+
+std::vector<uint32_t> BatchPIRLayout::candidate_buckets(uint32_t index) const
+{
+    std::vector<uint32_t> res;
+    //hash冲突时继续取下一个hash，保证kHashCount个bucket互不相同
+    for (uint64_t h = 0; res.size() < kHashCount; h++)
+    {
+        uint32_t b = mix64(mix64(seed + h) ^ index) % num_buckets;
+        if (std::find(res.begin(), res.end(), b) == res.end())
+        {
+            res.push_back(b);
+        }
+    }
+    return res;
+}
+
+uint32_t BatchPIRLayout::position(size_t b, uint32_t index) const
+{
+    auto it = std::lower_bound(buckets[b].begin(), buckets[b].end(), index);
+    assert(it != buckets[b].end() && *it == index);
+    return it - buckets[b].begin();
+}
+
+size_t BatchPIRLayout::padded_slots() const
+{
+    size_t row_size = poly_degree / 2;
+    return num_buckets * ((capacity + row_size - 1) / row_size) * row_size;
+}
+
+FastPIRParams BatchPIRLayout::bucket_params(size_t obj_size) const
+{
+    return FastPIRParams(capacity, obj_size, poly_degree, plain_bits);
+}
+
+BatchPIRServer::BatchPIRServer(std::shared_ptr<const BatchPIRLayout> layout, size_t obj_size, int threads)
+    : layout(layout), obj_size(obj_size), threads(std::max(threads, 1))
+{
+    FastPIRParams params = layout->bucket_params(obj_size);
+    buckets.resize(layout->get_num_buckets());
+    for (auto& b : buckets)
+    {
+        b.reset(new Mserver(params));
+    }
+}
+
+void BatchPIRServer::set_db(const std::vector<std::vector<unsigned char>>& db)
+{
+    assert(db.size() == layout->get_num_obj());
+    parallel_for(buckets.size(), threads, [&](size_t b) {
+        //不满的bucket用全0消息补齐
+        std::vector<std::vector<unsigned char>> bucket_db(layout->get_bucket_capacity(), std::vector<unsigned char>(obj_size, 0));
+        const auto& members = layout->bucket(b);
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            bucket_db[i] = db[members[i]];
+        }
+        buckets[b]->set_db(std::move(bucket_db));
+        buckets[b]->preprocess_db();
+    });
+}
+
+void BatchPIRServer::set_client_galois_keys(uint32_t client_id, seal::GaloisKeys gal_keys)
+{
+    auto keys = std::make_shared<const seal::GaloisKeys>(std::move(gal_keys));
+    std::lock_guard<std::mutex> lock(key_mutex);
+    client_galois_keys[client_id] = keys;
+}
+
+void BatchPIRServer::remove_client_galois_keys(uint32_t client_id)
+{
+    std::lock_guard<std::mutex> lock(key_mutex);
+    client_galois_keys.erase(client_id);
+}
+
+std::vector<PIRReply> BatchPIRServer::get_response(uint32_t client_id, const std::vector<PIRQuery>& querys)
+{
+    std::shared_ptr<const seal::GaloisKeys> gal_keys;
+    {
+        std::lock_guard<std::mutex> lock(key_mutex);
+        auto it = client_galois_keys.find(client_id);
+        if (it != client_galois_keys.end())
+            gal_keys = it->second;
+    }
+    if (gal_keys == nullptr)
+        throw std::invalid_argument("galois keys of client " + std::to_string(client_id) + " not set");
+    if (querys.size() != buckets.size())
+        throw std::invalid_argument("batch query size doesn't match");
+    std::vector<PIRReply> replys(buckets.size());
+    //调用者设置了RequestTrace时，各bucket在工作线程中分别计数，最后累加到调用者的trace
+    RequestTrace* caller = current_trace();
+    std::vector<RequestTrace> traces(caller ? buckets.size() : 0);
+    parallel_for(buckets.size(), threads, [&](size_t b) {
+        TraceScope scope(caller ? &traces[b] : nullptr);
+        replys[b] = buckets[b]->get_response(querys[b], *gal_keys);
+    });
+    for (auto& t : traces)
+    {
+        caller->multiply_plain += t.multiply_plain;
+        caller->rotations += t.rotations;
+        for (int s = 0; s < kStageCount; s++)
+        {
+            caller->stage_ns[s] += t.stage_ns[s];
+        }
+    }
+    return replys;
+}
+
+BatchPIRClient::BatchPIRClient(std::shared_ptr<const BatchPIRLayout> layout, size_t obj_size)
+    : layout(layout), client(new Mclient(layout->bucket_params(obj_size)))
+{
+
+}
+
+bool BatchPIRClient::gen_query(const std::vector<uint32_t>& indices, std::vector<PIRQuery>& querys)
+{
+    std::vector<uint32_t> unique_indices(indices);
+    std::sort(unique_indices.begin(), unique_indices.end());
+    unique_indices.erase(std::unique(unique_indices.begin(), unique_indices.end()), unique_indices.end());
+    if (unique_indices.size() > layout->get_num_buckets())
+        return false;
+
+    //cuckoo插入: 候选bucket都满时随机踢出一个，被踢出的index再放到它的其它候选bucket
+    std::mt19937_64 rng(std::random_device{}());
+    table.assign(layout->get_num_buckets(), -1);
+    for (auto index : unique_indices)
+    {
+        assert(index < layout->get_num_obj());
+        int64_t cur = index;
+        bool placed = false;
+        for (int step = 0; step < kMaxEvictions && !placed; step++)
+        {
+            auto candidates = layout->candidate_buckets(cur);
+            for (auto b : candidates)
+            {
+                if (table[b] == -1)
+                {
+                    table[b] = cur;
+                    placed = true;
+                    break;
+                }
+            }
+            if (!placed)
+            {
+                std::swap(cur, table[candidates[rng() % candidates.size()]]);
+            }
+        }
+        if (!placed)
+            return false;
+    }
+
+    querys.resize(layout->get_num_buckets());
+    for (size_t b = 0; b < table.size(); b++)
+    {
+        //空bucket也要查询，服务端看不出哪些bucket是有用的
+        uint32_t pos = table[b] == -1 ? 0 : layout->position(b, table[b]);
+        querys[b] = client->gen_query(pos).query;
+    }
+    last_indices = indices;
+    return true;
+}
+
+std::vector<std::vector<unsigned char>> BatchPIRClient::decode_response(const std::vector<PIRReply>& replys)
+{
+    assert(replys.size() == table.size());
+    std::map<uint32_t, std::vector<unsigned char>> records;
+    for (size_t b = 0; b < table.size(); b++)
+    {
+        if (table[b] == -1)
+            continue;
+        records[table[b]] = client->decode_response(replys[b], layout->position(b, table[b]));
+    }
+    std::vector<std::vector<unsigned char>> res;
+    for (auto index : last_indices)
+    {
+        res.push_back(records[index]);
+    }
+    return res;
+}
@@ -0,0 +1,102 @@
+#ifndef FASTPIR_BATCHPIR_H
+#define FASTPIR_BATCHPIR_H
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+
+//批量PIR(probabilistic batch code):
+//服务端把每条消息按3个hash函数复制到3个不同的bucket，每个bucket是一个小的FastPIR库(容量统一为最大bucket的大小)；
+//客户端把k个index用cuckoo hash放进B = 1.5k个bucket(每个bucket最多一个index)，对每个bucket都发一个查询(空bucket发假查询)。
+//服务端的工作量: 每个bucket的库补齐到整数个查询密文(N/2个slot)，扫描的slot数为B * ceil(capacity / (N/2)) * N/2(padded_slots)，
+//另外每个bucket各有一棵get_sum的旋转树(B倍于单个查询的旋转)。只有每个bucket都超过N/2条(3n >> 1.5k * N/2)时扫描量才约为3n；
+//k较大时每个bucket只有一个查询密文，扫描和旋转都随k线性增长
+class BatchPIRLayout
+{
+public:
+    static const int kHashCount = 3;
+
+    //num_obj、batch_size、BFV参数、seed都是公开的，客户端和服务端各自算出相同的布局
+    BatchPIRLayout(size_t num_obj, size_t batch_size, size_t poly_degree = POLY_MODULUS_DEGREE, size_t plain_bits = PLAIN_BIT, uint64_t seed = 0x5eed);
+
+    size_t get_num_obj() const {return num_obj;}
+    size_t get_num_buckets() const {return num_buckets;}
+    size_t get_bucket_capacity() const {return capacity;}
+    //所有bucket补齐后的slot总数，即服务端每次批量查询扫描的库大小(以记录计)
+    size_t padded_slots() const;
+
+    //index可以放的kHashCount个不同的bucket
+    std::vector<uint32_t> candidate_buckets(uint32_t index) const;
+
+    //bucket中的index，从小到大
+    const std::vector<uint32_t>& bucket(size_t b) const {return buckets[b];}
+
+    //index在bucket b中的位置，即bucket对应FastPIR库中的index
+    uint32_t position(size_t b, uint32_t index) const;
+
+    FastPIRParams bucket_params(size_t obj_size) const;
+
+private:
+    size_t num_obj;
+    size_t num_buckets;
+    size_t capacity;
+    size_t poly_degree;
+    size_t plain_bits;
+    uint64_t seed;
+    std::vector<std::vector<uint32_t>> buckets;
+};
+
+class BatchPIRServer
+{
+public:
+    BatchPIRServer(std::shared_ptr<const BatchPIRLayout> layout, size_t obj_size, int threads = 1);
+
+    //把消息复制到各个bucket并预处理
+    void set_db(const std::vector<std::vector<unsigned char>>& db);
+
+    //所有bucket的SEAL参数相同，共用一套密钥
+    void set_client_galois_keys(uint32_t client_id, seal::GaloisKeys gal_keys);
+    void remove_client_galois_keys(uint32_t client_id);
+
+    //querys[b]是bucket b的查询，返回值与之一一对应。没有key、查询个数或某个bucket的查询不对时抛出std::invalid_argument
+    std::vector<PIRReply> get_response(uint32_t client_id, const std::vector<PIRQuery>& querys);
+
+    size_t get_num_buckets() const {return buckets.size();}
+
+private:
+    std::shared_ptr<const BatchPIRLayout> layout;
+    std::vector<std::unique_ptr<Mserver>> buckets;
+    std::map<uint32_t, std::shared_ptr<const seal::GaloisKeys>> client_galois_keys;
+    std::mutex key_mutex;
+    size_t obj_size;
+    int threads;
+};
+
+class BatchPIRClient
+{
+public:
+    BatchPIRClient(std::shared_ptr<const BatchPIRLayout> layout, size_t obj_size);
+
+    seal::GaloisKeys get_galois_keys() {return client->get_galois_keys();}
+
+    //cuckoo插入失败时返回false(概率很小，可以减少index的个数重试)，成功时querys为每个bucket一个查询
+    bool gen_query(const std::vector<uint32_t>& indices, std::vector<PIRQuery>& querys);
+
+    //结果与上一次gen_query的indices一一对应
+    std::vector<std::vector<unsigned char>> decode_response(const std::vector<PIRReply>& replys);
+
+    Mclient& get_bucket_client() {return *client;}
+
+private:
+    std::shared_ptr<const BatchPIRLayout> layout;
+    std::unique_ptr<Mclient> client;
+    std::vector<int64_t> table;                 //table[b]: 放在bucket b中的index，-1表示空
+    std::vector<uint32_t> last_indices;
+};
+
+#endif
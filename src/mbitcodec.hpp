@@ -0,0 +1,91 @@
+#ifndef FASTPIR_BITCODEC_H
+#define FASTPIR_BITCODEC_H
+
+#include <cstdint>
+#include <cstddef>
+
+//消息字节与明文系数之间的转换: 每个系数放data_bits位数据，高位在前，最后一个系数不满时低位填1(与原来的bitset编码相同)。
+//kDataBits为编译期常数时移位和掩码都在编译期确定；kDataBits = 0时使用运行时的data_bits。
+//常用的参数(20、40位)通过dispatch选到特化的实例
+namespace bitcodec
+{
+inline size_t coeff_count(size_t bytes, int data_bits)
+{
+    return (bytes * 8 + data_bits - 1) / data_bits;
+}
+
+template <int kDataBits>
+void bytes_to_coeffs(const unsigned char* bytes, size_t len, uint64_t* coeffs, int data_bits = kDataBits)
+{
+    static_assert(kDataBits >= 0 && kDataBits <= 56, "data bits must fit in the accumulator");
+    const int w = kDataBits ? kDataBits : data_bits;
+    const uint64_t mask = (1ULL << w) - 1;
+    uint64_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        acc = (acc << 8) | bytes[i];
+        bits += 8;
+        if (bits >= w)
+        {
+            bits -= w;
+            *coeffs++ = (acc >> bits) & mask;
+        }
+    }
+    if (bits > 0)
+    {
+        *coeffs = ((acc << (w - bits)) | ((1ULL << (w - bits)) - 1)) & mask;
+    }
+}
+
+//coeffs可以是指针，也可以是按顺序读系数的迭代器(如回复中跨密文、循环移位的slot)
+template <int kDataBits, typename CoeffIter>
+void coeffs_to_bytes(CoeffIter coeffs, size_t len, unsigned char* bytes, int data_bits = kDataBits)
+{
+    static_assert(kDataBits >= 0 && kDataBits <= 56, "data bits must fit in the accumulator");
+    const int w = kDataBits ? kDataBits : data_bits;
+    const uint64_t mask = (1ULL << w) - 1;
+    uint64_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (bits < 8)
+        {
+            acc = (acc << w) | (*coeffs & mask);
+            ++coeffs;
+            bits += w;
+        }
+        bits -= 8;
+        bytes[i] = (acc >> bits) & 0xFF;
+    }
+}
+
+inline void bytes_to_coeffs(int data_bits, const unsigned char* bytes, size_t len, uint64_t* coeffs)
+{
+    switch (data_bits)
+    {
+    case 20:
+        return bytes_to_coeffs<20>(bytes, len, coeffs);
+    case 40:
+        return bytes_to_coeffs<40>(bytes, len, coeffs);
+    default:
+        return bytes_to_coeffs<0>(bytes, len, coeffs, data_bits);
+    }
+}
+
+template <typename CoeffIter>
+inline void coeffs_to_bytes(int data_bits, CoeffIter coeffs, size_t len, unsigned char* bytes)
+{
+    switch (data_bits)
+    {
+    case 20:
+        return coeffs_to_bytes<20>(coeffs, len, bytes);
+    case 40:
+        return coeffs_to_bytes<40>(coeffs, len, bytes);
+    default:
+        return coeffs_to_bytes<0>(coeffs, len, bytes, data_bits);
+    }
+}
+}
+
+#endif
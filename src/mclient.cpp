@@ -1,6 +1,17 @@
 #include "mclient.hpp"
+#include "mparallel.hpp"
 #include<algorithm>
 #include<cassert>
+#include<cerrno>
+#include<cstdio>
+#include<cstring>
+#include<map>
+#include<sstream>
+#include<stdexcept>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
 
 uint32_t get_number_of_bits(uint64_t number)
 {
@@ -25,10 +36,45 @@ uint32_t get_next_power_of_two(uint32_t number)
     return (1 << number_of_bits);
 }
 
-Mclient::Mclient(FastPIRParams params)
+Mclient::Mclient(FastPIRParams params, int rotation_window, const std::string& key_cache)
+{
+    init(params);
+    this->rotation_window = rotation_window;
+    if (!key_cache.empty() && load_keys(key_cache))
+    {
+        keygen = new seal::KeyGenerator(*context, secret_key);
+    }
+    else
+    {
+        keygen = new seal::KeyGenerator(*context);
+        secret_key = keygen->secret_key();
+        create_galois_keys_parallel(rotation_key_steps(N, rotation_window));
+        if (!key_cache.empty() && !save_keys(key_cache))
+            std::cout << "can't save keys to " << key_cache << std::endl;
+    }
+    encryptor = new seal::Encryptor(*context, secret_key);
+    decryptor = new seal::Decryptor(*context, secret_key);
+
+    return;
+}
+
+Mclient::Mclient(FastPIRParams params, const seal::SecretKey& secret_key, const seal::GaloisKeys& gal_keys)
+{
+    init(params);
+    keygen = new seal::KeyGenerator(*context, secret_key);
+    this->secret_key = secret_key;
+    encryptor = new seal::Encryptor(*context, secret_key);
+    decryptor = new seal::Decryptor(*context, secret_key);
+    this->gal_keys = gal_keys;
+    rotation_window = 0;                //key由调用者给出，不对应某个窗口
+}
+
+void Mclient::init(FastPIRParams& params)
 {
     this->num_obj = params.get_num_obj();
     this->obj_size = params.get_obj_size();
+    pack_factor = params.get_pack_factor();
+    record_size = params.get_record_size();
 
     N = params.get_poly_modulus_degree();
     num_columns_per_obj = params.get_num_columns_per_obj();
@@ -37,42 +83,156 @@ Mclient::Mclient(FastPIRParams params)
     reply_ciphertext_num = params.get_reply_ciphertext_num();
 
     context = new seal::SEALContext(params.get_seal_params());
-    keygen = new seal::KeyGenerator(*context);
-    secret_key = keygen->secret_key();
-    encryptor = new seal::Encryptor(*context, secret_key);
-    decryptor = new seal::Decryptor(*context, secret_key);
     batch_encoder = new seal::BatchEncoder(*context);
+    evaluator = new seal::Evaluator(*context);
+}
+
+Mclient::~Mclient()
+{
+    stop_precompute();
+}
+
+void Mclient::create_galois_keys_parallel(const std::vector<int>& steps)
+{
+    size_t threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), steps.size());
+    if (threads <= 1)
+    {
+        keygen->create_galois_keys(steps, gal_keys);
+        return;
+    }
+    std::vector<seal::GaloisKeys> parts(threads);
+    parallel_for(threads, threads, [&](size_t t)
+    {
+        std::vector<int> mine;
+        for (size_t i = t; i < steps.size(); i += threads)
+        {
+            mine.push_back(steps[i]);
+        }
+        seal::KeyGenerator generator(*context, secret_key);
+        generator.create_galois_keys(mine, parts[t]);
+    });
+    //每部分的data()都按galois元素的下标排列，大小相同，把非空的位置合并过来
+    gal_keys = std::move(parts[0]);
+    for (size_t t = 1; t < threads; t++)
+    {
+        for (size_t i = 0; i < parts[t].data().size(); i++)
+        {
+            if (!parts[t].data()[i].empty())
+                gal_keys.data()[i] = std::move(parts[t].data()[i]);
+        }
+    }
+}
+
+namespace
+{
+// key文件: | magic "FPIRKEY1" | N(uint32) plain bits(uint32) rotation window(int32) | 私钥 | galois keys |，本机字节序，密钥为SEAL的不压缩序列化
+const char kKeyMagic[8] = {'F', 'P', 'I', 'R', 'K', 'E', 'Y', '1'};
+const size_t kKeyHeaderLen = sizeof(kKeyMagic) + 3 * sizeof(uint32_t);
+}
+
+bool Mclient::save_keys(const std::string& path) const
+{
+    std::stringstream out;
+    uint32_t header[3] = {N, plain_bit_count, (uint32_t)rotation_window};
+    out.write(kKeyMagic, sizeof(kKeyMagic));
+    out.write((const char*)header, sizeof(header));
+    secret_key.save(out, seal::compr_mode_type::none);
+    gal_keys.save(out, seal::compr_mode_type::none);
+    std::string data = out.str();
+
+    //文件里有私钥: 临时文件一开始就只有自己可读写，O_EXCL保证不会写进别人预先放好的文件或符号链接
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
+    if (fd < 0)
+        return false;
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        written += n;
+    }
+    if (close(fd) != 0 || written < data.size())
+    {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool Mclient::load_keys(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    //组或其他用户能访问的文件不用，私钥可能已经泄露，也可能是别人放的
+    if (fstat(fd, &st) != 0 || (st.st_mode & (S_IRWXG | S_IRWXO)) || (size_t)st.st_size < kKeyHeaderLen)
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    const char* bytes = (const char*)map;
+    uint32_t header[3];
+    std::memcpy(header, bytes + sizeof(kKeyMagic), sizeof(header));
+    bool ok = std::equal(kKeyMagic, kKeyMagic + sizeof(kKeyMagic), bytes) && header[0] == N && header[1] == plain_bit_count
+              && header[2] == (uint32_t)rotation_window;
+    //参数不同时SEAL的load也会因为parms_id不匹配而失败
+    try
+    {
+        size_t offset = kKeyHeaderLen;
+        if (ok)
+            offset += secret_key.load(*context, (const seal::seal_byte*)(bytes + offset), size - offset);
+        if (ok)
+            gal_keys.load(*context, (const seal::seal_byte*)(bytes + offset), size - offset);
+    }
+    catch (const std::exception&)
+    {
+        ok = false;
+    }
+    munmap(map, size);
+    return ok;
+}
 
+std::vector<int> Mclient::rotation_key_steps(uint32_t N, int rotation_window)
+{
+    assert(rotation_window >= 1);
     std::vector<int> steps;
     for (int i = 1; /*i < (num_columns_per_obj / 2) && */ i < (N / 2); i *= 2)          
     {
-        steps.push_back(-i);
-        steps.push_back(i);
+        for (int d = 1; d < (1 << rotation_window) && d * i < (N / 2); d += 2)
+        {
+            steps.push_back(-d * i);
+            steps.push_back(d * i);
+        }
     }
-    keygen->create_galois_keys(steps, gal_keys);
-
-    return;
+    return steps;
 }
 
 Query Mclient::gen_query(uint32_t index,const std::vector<int>& indexOffset, const std::vector<int>& coeffOffset)              //根据index生成查询
 {
-    std::vector<seal::Ciphertext> query(num_query_ciphertext);          //查询的总数：即数据库每行的明文个数
+    std::vector<seal::Ciphertext> query = take_zeros(num_query_ciphertext);         //查询的总数：即数据库每行的明文个数
     seal::Plaintext pt;
     size_t slot_count = batch_encoder->slot_count();
     size_t row_size = slot_count / 2;                                   //分成两部分
 
     assert(indexOffset.size() == coeffOffset.size());
 
-    for (int i = 0; i < num_query_ciphertext; i++)
+    if (index / row_size < num_query_ciphertext)                        //一个查询中只有一个密文计索引
     {
         std::vector<uint64_t> pod_matrix(slot_count, 0ULL);
-        if ((index / row_size) == i)                         //一个查询中只有一半的slot计索引
-        {
-            pod_matrix[index % row_size] = 1;                   //两部分设为1
-            pod_matrix[row_size + (index % row_size)] = 1;
-        }
-        batch_encoder->encode(pod_matrix, pt);                  //编码、加密
-        encryptor->encrypt_symmetric(pt, query[i]);
+        pod_matrix[index % row_size] = 1;                       //两部分设为1
+        pod_matrix[row_size + (index % row_size)] = 1;
+        batch_encoder->encode(pod_matrix, pt);                  //编码后加到0的密文上
+        evaluator->add_plain_inplace(query[index / row_size], pt);
     }
     Query q;
     q.query = query;
@@ -83,63 +243,327 @@ Query Mclient::gen_query(uint32_t index,const std::vector<int>& indexOffset, con
 }
 
 
-std::vector<unsigned char> Mclient::decode_response(std::vector<seal::Ciphertext> response, uint32_t index, size_t queryCount)
+std::vector<Query> Mclient::gen_queries(const std::vector<uint32_t>& indices, int threads)
+{
+    //Encryptor/BatchEncoder/Evaluator的方法是const的，可以多个线程同时调用
+    std::vector<Query> queries(indices.size());
+    parallel_for(indices.size(), threads, [&](size_t i)
+    {
+        queries[i] = gen_query(indices[i]);
+    });
+    return queries;
+}
+
+std::vector<seal::Ciphertext> Mclient::take_zeros(size_t count)
+{
+    std::vector<seal::Ciphertext> zeros;
+    zeros.reserve(count);
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        while (zeros.size() < count && !zero_pool.empty())
+        {
+            zeros.push_back(std::move(zero_pool.front()));
+            zero_pool.pop_front();
+        }
+    }
+    pool_cond.notify_all();
+    //池不够时当场加密，不等后台线程
+    while (zeros.size() < count)
+    {
+        zeros.emplace_back();
+        encryptor->encrypt_zero_symmetric(zeros.back());
+    }
+    return zeros;
+}
+
+void Mclient::refill_zero_pool()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            pool_cond.wait(lock, [this]() { return pool_stopping || zero_pool.size() < zero_pool_target; });
+            if (pool_stopping)
+                return;
+        }
+        seal::Ciphertext zero;
+        encryptor->encrypt_zero_symmetric(zero);
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        zero_pool.push_back(std::move(zero));
+    }
+}
+
+void Mclient::start_precompute(size_t target_queries, int threads)
+{
+    stop_precompute();
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        zero_pool_target = target_queries * num_query_ciphertext;
+        pool_stopping = false;
+    }
+    for (int t = 0; t < std::max(threads, 1); t++)
+    {
+        refill_threads.emplace_back(&Mclient::refill_zero_pool, this);
+    }
+}
+
+void Mclient::stop_precompute()
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pool_stopping = true;
+    }
+    pool_cond.notify_all();
+    for (auto& t : refill_threads)
+    {
+        t.join();
+    }
+    refill_threads.clear();
+}
+
+size_t Mclient::precomputed_ciphertexts()
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return zero_pool.size();
+}
+
+std::vector<unsigned char> Mclient::extract_record(const std::vector<unsigned char>& obj, uint32_t record) const
+{
+    size_t offset = (record % pack_factor) * record_size;
+    assert(offset + record_size <= obj.size());
+    return std::vector<unsigned char>(obj.begin() + offset, obj.begin() + offset + record_size);
+}
+
+std::vector<std::vector<uint32_t>> Mclient::group_indices(std::vector<uint32_t> indices)
 {
-    assert(decryptor->invariant_noise_budget(response[0]) > 0);
-    seal::Plaintext pt;
-    std::vector<uint64_t> decoded_response;
     size_t row_size = N / 2;
-    
-    std::vector<std::vector<unsigned char>> charRes; 
-    std::vector<unsigned char> res;
-    res.resize(obj_size * queryCount);
-    int offset = 0;
-    for(auto c = response.begin(); c != response.end(); ++c)
-    {
-        decryptor->decrypt(*c, pt);
-        batch_encoder->decode(pt, decoded_response);
-        decoded_response = rotate_plain(decoded_response, index % row_size);
-        auto tempMsg = decode(decoded_response, queryCount > 1);                //decode直接解明文 
-        charRes.push_back(tempMsg);
-        //memcpy(res.data() + offset, tempMsg.data(), std::min(tempMsg.size(), res.size() - offset));
-        offset+=tempMsg.size();             
-    }
-    offset = 0;
-    int maxPlainSize = std::min((plain_bit_count - 1) * N / (2*8), obj_size / 2);
-    if(queryCount == 1)
-    {
-        for(int i = 0; i < 2; ++i)
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    std::vector<std::vector<uint32_t>> groups;
+    //回复多于一个密文时每个密文的一行都被一条消息占满，只能一组一个
+    if (reply_ciphertext_num != 1 || num_columns_per_obj > row_size)
+    {
+        for (auto i : indices)
         {
-            for(int j = 0; j < reply_ciphertext_num; ++j)
-            {
-                int tempSize = maxPlainSize;
-                if(j == reply_ciphertext_num - 1 && tempSize != (obj_size / 2))
-                {
-                    tempSize = (obj_size / 2) % maxPlainSize;
-                }
-                memcpy(res.data() + offset, charRes[j].data() + i * maxPlainSize, tempSize);
-                offset += tempSize;
-            }
+            groups.push_back({i});
         }
+        return groups;
     }
-    else
+    //按slot排序后first fit
+    std::sort(indices.begin(), indices.end(), [row_size](uint32_t a, uint32_t b) {
+        return a % row_size != b % row_size ? a % row_size < b % row_size : a < b;
+    });
+    for (auto i : indices)
     {
-        assert(reply_ciphertext_num == 1);                  //多查询目前仅支持用一个密文装下的结果
-        int msgPerCount =  N / get_next_power_of_two(num_columns_per_obj / 2) / 2;
-        for(int i = 0; i < charRes.size(); ++i)
+        bool placed = false;
+        for (auto& g : groups)
         {
-            for(int j = 0; j < queryCount && j < msgPerCount; ++j)
+            g.push_back(i);
+            if (batch_collision_free(g))
             {
-                for(int k = 0; k < 2 ;k++)
-                {
-                    memcpy(res.data() + offset, charRes[i].data() + k * charRes[i].size() / 2 + j * obj_size / 2, obj_size / 2);
-                    offset += obj_size / 2;
-                } 
+                placed = true;
+                break;
             }
-            queryCount -= msgPerCount;
+            g.pop_back();
         }
+        if (!placed)
+        {
+            groups.push_back({i});
+        }
+    }
+    return groups;
+}
+
+bool Mclient::batch_collision_free(const std::vector<uint32_t>& group)
+{
+    if (group.size() <= 1)
+        return true;
+    if (reply_ciphertext_num != 1)
+        return false;
+    size_t row_size = N / 2;
+    size_t width = num_columns_per_obj / 2;
+    for (size_t i = 0; i < group.size(); i++)
+    {
+        for (size_t j = i + 1; j < group.size(); j++)
+        {
+            size_t d = (group[j] % row_size + row_size - group[i] % row_size) % row_size;
+            if (d < width || row_size - d < width)
+                return false;
+        }
+    }
+    return true;
+}
+
+PIRQuery Mclient::gen_batch_query(const std::vector<uint32_t>& group)
+{
+    assert(batch_collision_free(group));
+    std::vector<seal::Ciphertext> query = take_zeros(num_query_ciphertext);
+    seal::Plaintext pt;
+    size_t slot_count = batch_encoder->slot_count();
+    size_t row_size = slot_count / 2;
+    std::map<uint32_t, std::vector<uint64_t>> pod_matrix;              //只有含1的密文需要编码
+    for (auto index : group)
+    {
+        assert(index < num_obj);
+        std::vector<uint64_t>& row = pod_matrix[index / row_size];
+        row.resize(slot_count, 0ULL);
+        row[index % row_size] = 1;
+        row[row_size + (index % row_size)] = 1;
+    }
+    for (auto& row : pod_matrix)
+    {
+        batch_encoder->encode(row.second, pt);
+        evaluator->add_plain_inplace(query[row.first], pt);
+    }
+    return query;
+}
+
+std::vector<std::vector<unsigned char>> Mclient::decode_batch_response(const PIRReply& response, const std::vector<uint32_t>& group)
+{
+    std::vector<std::vector<unsigned char>> res;
+    if (group.size() == 1)
+    {
+        res.push_back(decode_response(response, group[0]));
+        return res;
+    }
+    assert(response.size() == 1);
+    assert(decryptor->invariant_noise_budget(response[0]) > 0);
+    seal::Plaintext pt;
+    std::vector<uint64_t> decoded_response;
+    decryptor->decrypt(response[0], pt);                    //只解密一次，每条消息旋转到开头后再解码
+    batch_encoder->decode(pt, decoded_response);
+    for (auto index : group)
+    {
+        auto msg = decode(rotate_plain(decoded_response, index % (N / 2)));
+        msg.resize(obj_size);
+        res.push_back(std::move(msg));
+    }
+    return res;
+}
+
+namespace
+{
+//回复中消息一半的一段列: 某个密文一行中从slot start开始(循环)的len个slot
+struct SlotSegment
+{
+    const uint64_t* row;
+    size_t start;
+    size_t len;
+};
+
+//按列号顺序读取各段的slot，直接读解码后的明文
+class SlotIterator
+{
+public:
+    SlotIterator(const std::vector<SlotSegment>& segments, size_t row_size)
+        : segments(segments), row_size(row_size), seg(0), t(0), pos(segments.empty() ? 0 : segments[0].start)
+    {
+    }
+    uint64_t operator*() const
+    {
+        return seg < segments.size() ? segments[seg].row[pos] : 0;
+    }
+    SlotIterator& operator++()
+    {
+        if (seg >= segments.size())
+            return *this;
+        if (++t == segments[seg].len)
+        {
+            t = 0;
+            if (++seg < segments.size())
+                pos = segments[seg].start;
+        }
+        else if (++pos == row_size)
+        {
+            pos = 0;
+        }
+        return *this;
+    }
+
+private:
+    const std::vector<SlotSegment>& segments;
+    size_t row_size;
+    size_t seg;
+    size_t t;
+    size_t pos;
+};
+
+//第一行是消息的前一半，第二行是后一半，两行的段位置相同
+void decode_halves(std::vector<SlotSegment> segments, size_t row_size, int plain_data_bits, size_t obj_size, unsigned char* out)
+{
+    for (size_t h = 0; h < 2; h++)
+    {
+        bitcodec::coeffs_to_bytes(plain_data_bits, SlotIterator(segments, row_size), obj_size / 2, out + h * (obj_size / 2));
+        for (auto& segment : segments)
+        {
+            segment.row += row_size;
+        }
+    }
+}
+}
+
+std::vector<std::vector<uint64_t>> Mclient::decrypt_reply(const PIRReply& response)
+{
+    //Decryptor和BatchEncoder的方法是const的，每个密文由一个线程解密并解码
+    std::vector<std::vector<uint64_t>> plains(response.size());
+    parallel_for(response.size(), decode_threads, [&](size_t i)
+    {
+        seal::Plaintext pt;
+        decryptor->decrypt(response[i], pt);
+        batch_encoder->decode(pt, plains[i]);
+    });
+    return plains;
+}
+
+void Mclient::decode_response_into(const PIRReply& response, uint32_t index, unsigned char* out)
+{
+    size_t row_size = N / 2;
+    size_t columns = num_columns_per_obj / 2;
+    assert(response.size() == (columns + row_size - 1) / row_size);
+    std::vector<std::vector<uint64_t>> plains = decrypt_reply(response);
+    //第j个密文是第jN/2列开始的一段，第t列在slot (index + t) % (N/2)
+    std::vector<SlotSegment> segments;
+    for (size_t j = 0; j < plains.size(); j++)
+    {
+        segments.push_back(SlotSegment{plains[j].data(), index % row_size, std::min(row_size, columns - j * row_size)});
+    }
+    decode_halves(segments, row_size, plain_bit_count - 1, obj_size, out);
+}
+
+void Mclient::decode_multi_response_into(const PIRReply& response, const std::vector<uint32_t>& indices, unsigned char* out)
+{
+    ReplyPacking packing(indices.size(), num_columns_per_obj, N / 2);
+    assert(response.size() == packing.cipher_count());
+    size_t row_size = N / 2;
+    //每个密文只解密一次
+    std::vector<std::vector<uint64_t>> plains = decrypt_reply(response);
+    for (size_t m = 0; m < indices.size(); ++m)
+    {
+        std::vector<SlotSegment> segments;
+        for (size_t r = 0; r < packing.full_segments; ++r)
+        {
+            segments.push_back(SlotSegment{plains[packing.full_cipher(m, r)].data(), indices[m] % row_size, row_size});
+        }
+        if (packing.partial_length != 0)
+        {
+            segments.push_back(SlotSegment{plains[packing.partial_cipher(m)].data(), (indices[0] + packing.partial_offset(m)) % row_size, packing.partial_length});
+        }
+        decode_halves(segments, row_size, plain_bit_count - 1, obj_size, out + m * obj_size);
     }
+}
 
+std::vector<unsigned char> Mclient::decode_response(std::vector<seal::Ciphertext> response, uint32_t index, size_t queryCount)
+{
+    std::vector<unsigned char> res(obj_size * queryCount);
+    if(queryCount > 1)
+    {
+        //只知道第一个index时，只有没有整段(一个回复不满一个密文)的布局可以解码
+        if (ReplyPacking(queryCount, num_columns_per_obj, N / 2).full_segments != 0)
+            throw std::invalid_argument("multi-query reply with full segments needs every index, use decode_multi_response");
+        decode_multi_response_into(response, std::vector<uint32_t>(queryCount, index), res.data());
+        return res;
+    }
+    decode_response_into(response, index, res.data());
     return res;
 }
 
@@ -151,55 +575,82 @@ seal::GaloisKeys Mclient::get_galois_keys()
 
 std::vector<uint64_t> Mclient::rotate_plain(std::vector<uint64_t> original, int index)
 {
-    int sz = original.size();
-    int row_count = sz / 2;
-    std::vector<uint64_t> result(sz);
-    for (int i = 0; i < row_count; i++)
+    size_t row_count = original.size() / 2;
+    index %= row_count;
+    std::vector<uint64_t> result(original.size());
+    //每行左移index: 两段连续拷贝，不需要逐个取模
+    for (size_t row = 0; row < 2; row++)
     {
-        result[i] = original[(index + i) % row_count];
-        result[row_count + i] = original[row_count + ((index + i) % row_count)];
+        auto begin = original.begin() + row * row_count;
+        std::copy(begin + index, begin + row_count, result.begin() + row * row_count);
+        std::copy(begin, begin + index, result.begin() + row * row_count + (row_count - index));
     }
 
     return result;
 }
 
-std::vector<unsigned char> Mclient::decode(std::vector<uint64_t> v, bool isMulti)           //第二个参数用于判断是否一个密文带有多条消息
+std::vector<std::vector<unsigned char>> Mclient::decode_multi_response(const PIRReply& response, const std::vector<uint32_t>& indices)
 {
-    int n = v.size();
-    const int plain_data_bits = plain_bit_count - 1;
-    std::vector<unsigned char> res;
-    std::string bit_str;
-    if(isMulti)
+    std::vector<unsigned char> flat(indices.size() * obj_size);
+    decode_multi_response_into(response, indices, flat.data());
+    std::vector<std::vector<unsigned char>> res;
+    for(size_t m = 0; m < indices.size(); ++m)
     {
-        for(auto item : v)
-        {
-            bit_str += std::bitset<PLAIN_BIT>(item).to_string();
-        }
-        int coeffPerMsg = get_next_power_of_two(num_columns_per_obj / 2);
-        int msgPerPlain = N / coeffPerMsg / 2;
-        res.resize(obj_size * msgPerPlain);
-        for(int i = 0; i < msgPerPlain; ++i)
-        {
-            for(int j = 0; j < obj_size / 2; ++j)
-            {
-                res[i * obj_size / 2  + j] = std::bitset<8>(bit_str.substr(i * coeffPerMsg * PLAIN_BIT + j * 8, 8)).to_ulong();
-                res[i * obj_size / 2 + j + res.size() / 2] = std::bitset<8>(bit_str.substr(plain_data_bits * n / 2 + i * coeffPerMsg * PLAIN_BIT + j * 8, 8)).to_ulong();
-            }
-        }
-    }  
-    else
+        res.emplace_back(flat.begin() + m * obj_size, flat.begin() + (m + 1) * obj_size);
+    }
+    return res;
+}
+
+std::vector<unsigned char> Mclient::decode_range_response(const PIRReply& response, uint32_t index, size_t offset, size_t length)
+{
+    auto columns = FastPIRParams::column_range(obj_size, offset, length, plain_bit_count - 1);
+    size_t row_size = N / 2;
+    assert(response.size() == (columns.second - columns.first) / row_size + 1);
+    //范围之前的列不需要，补0使列号与消息中的位置对齐
+    std::vector<uint64_t> first(columns.second + 1, 0), second(columns.second + 1, 0);
+    std::vector<std::vector<uint64_t>> plains = decrypt_reply(response);
+    for(size_t i = 0; i < response.size(); ++i)
     {
-        for (auto item : v)
+        const std::vector<uint64_t>& plain = plains[i];
+        size_t start = columns.first + i * row_size;
+        for(size_t t = 0; start + t <= columns.second && t < row_size; ++t)
         {
-            bit_str += std::bitset<PLAIN_BIT>(item).to_string();            //bit_str: 一个明文中的数据按位排
-        }
-        size_t sz = bit_str.size() / 8;
-        res.resize(std::min((int)obj_size, (int)ceil(bit_str.size() / 8)));
-        for(int i = 0; i < res.size() / 2; ++i)
-        {
-            res[i] = std::bitset<8>(bit_str.substr(i * 8, 8)).to_ulong();
-            res[i + (res.size() / 2)] = std::bitset<8>(bit_str.substr((plain_data_bits * n / 2) + i * 8, 8)).to_ulong();
+            first[start + t] = plain[(index + t) % row_size];
+            second[start + t] = plain[row_size + (index + t) % row_size];
         }
     }
+    size_t half = obj_size / 2;
+    std::vector<unsigned char> res;
+    if(offset < half)
+    {
+        std::vector<unsigned char> head = coeffs_to_bytes(first, std::min(offset + length, half));
+        res.assign(head.begin() + offset, head.end());
+    }
+    if(offset + length > half)
+    {
+        size_t lo = offset > half ? offset - half : 0;
+        std::vector<unsigned char> tail = coeffs_to_bytes(second, offset + length - half);
+        res.insert(res.end(), tail.begin() + lo, tail.end());
+    }
+    return res;
+}
+
+std::vector<unsigned char> Mclient::coeffs_to_bytes(const std::vector<uint64_t>& coeffs, size_t bytes)
+{
+    //与Mserver::encode相反: 每个系数放plain_data_bits位，高位在前
+    std::vector<unsigned char> res(bytes, 0);
+    assert(coeffs.size() >= bitcodec::coeff_count(bytes, plain_bit_count - 1));
+    bitcodec::coeffs_to_bytes(plain_bit_count - 1, coeffs.data(), bytes, res.data());
+    return res;
+}
+
+std::vector<unsigned char> Mclient::decode(std::vector<uint64_t> v)
+{
+    int n = v.size();
+    const int plain_data_bits = plain_bit_count - 1;
+    //第一行是消息的前一半，第二行是后一半
+    std::vector<unsigned char> res(std::min((size_t)obj_size, (size_t)plain_data_bits * n / 8));
+    bitcodec::coeffs_to_bytes(plain_data_bits, v.data(), res.size() / 2, res.data());
+    bitcodec::coeffs_to_bytes(plain_data_bits, v.data() + n / 2, res.size() / 2, res.data() + res.size() / 2);
     return res;
 }
\ No newline at end of file
@@ -15,24 +15,72 @@
 #include <random>
 #include <unistd.h>
 #include <bitset>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "seal/seal.h"
 #include "mfastpirparams.hpp"
+#include "mbitcodec.hpp"
 
 class Mclient
 {
 
 public:
-    Mclient(FastPIRParams parms);
+    //rotation_window = w时，旋转key为±d*2^i(d为小于2^w的奇数)，w = 1即只有±2^i；
+    //w越大key越多，服务端移动查询需要的旋转越少(baby step d，giant step 2^i)。
+    //key_cache不为空时，文件存在且参数(N、明文位数、w)相同则直接mmap载入密钥，否则生成后保存到该文件
+    Mclient(FastPIRParams parms, int rotation_window = 1, const std::string& key_cache = "");
+    //使用已有的密钥，SEAL参数相同的多个库(如变长记录的各size class)共用一套密钥
+    Mclient(FastPIRParams parms, const seal::SecretKey& secret_key, const seal::GaloisKeys& gal_keys);
+    ~Mclient();
+    //查询中只有一个密文含1，其余都是0的加密: 0的密文从预计算池中取(不够时当场encrypt_zero)，
+    //只对含1的那个编码one-hot明文并add_plain，结果与逐个encrypt_symmetric的分布相同
     Query gen_query(uint32_t index, const std::vector<int>& indexOffset = std::vector<int>(), const std::vector<int>& coeffIndex = std::vector<int>());
+    //并行生成多个单查询，threads = 0时使用hardware_concurrency
+    std::vector<Query> gen_queries(const std::vector<uint32_t>& indices, int threads = 0);
+    //离线/在线分离: threads个后台线程把0的密文池补充到target_queries个查询所需的数量，池满时等待。
+    //每个0的密文只用一次
+    void start_precompute(size_t target_queries, int threads = 1);
+    void stop_precompute();
+    size_t precomputed_ciphertexts();
+    //queryCount > 1且回复中有整段时抛出std::invalid_argument(需要全部index，用decode_multi_response)
     std::vector<unsigned char> decode_response(std::vector<seal::Ciphertext> response, uint32_t index, size_t queryCount = 1);
+    //按ReplyPacking的布局解码多查询回复，indices[0]为生成查询时的index，结果与indices一一对应
+    std::vector<std::vector<unsigned char>> decode_multi_response(const PIRReply& response, const std::vector<uint32_t>& indices);
+    //与上面相同，但消息直接写到out(单查询obj_size字节，多查询按indices的顺序各obj_size字节)。
+    //回复密文并行解密，消息的系数按index算出的slot位置直接从解码后的明文读取，不生成旋转后的向量
+    void decode_response_into(const PIRReply& response, uint32_t index, unsigned char* out);
+    void decode_multi_response_into(const PIRReply& response, const std::vector<uint32_t>& indices, unsigned char* out);
+    //解密回复的线程数上限，0(默认)为hardware_concurrency
+    void set_decode_threads(int threads) {decode_threads = threads;}
+    //解码Mserver::get_range_response的回复，返回消息中[offset, offset + length)字节
+    std::vector<unsigned char> decode_range_response(const PIRReply& response, uint32_t index, size_t offset, size_t length);
+    //k-hot批量查询: 一个查询中放多个1，一次扫描取回多条消息。
+    //get_sum之后消息i的各列位于slot (i % (N/2)) 开始的连续num_columns_per_obj/2个位置，
+    //同一组内任意两个index的slot循环距离都不小于num_columns_per_obj/2时结果不会重叠
+    std::vector<std::vector<uint32_t>> group_indices(std::vector<uint32_t> indices);
+    bool batch_collision_free(const std::vector<uint32_t>& group);
+    PIRQuery gen_batch_query(const std::vector<uint32_t>& group);
+    std::vector<std::vector<unsigned char>> decode_batch_response(const PIRReply& response, const std::vector<uint32_t>& group);
     seal::GaloisKeys get_galois_keys();
+    //私钥和galois key(不压缩)写到path(权限0600)，先写临时文件再rename，多个进程同时保存不会读到半个文件。
+    //load_keys不接受组或其他用户有权限的文件
+    bool save_keys(const std::string& path) const;
+    const seal::SecretKey& get_secret_key() const {return secret_key;}
+    static std::vector<int> rotation_key_steps(uint32_t N, int rotation_window);
     //std::vector<unsigned char> decode_multi_response(std::vector<seal::Ciphertext> response, std::vector<uint32_t> index, size_t count);
     seal::Decryptor* getDec() const {return decryptor;}
     seal::SEALContext* getContext() const {return context;}
     uint32_t get_num_obj() const {return num_obj;}
     uint32_t get_obj_size() const {return obj_size;}
+    //小记录打包时，查询用消息的index，解码出的消息中再取出记录
+    uint32_t get_pack_factor() const {return pack_factor;}
+    uint32_t db_index(uint32_t record) const {return record / pack_factor;}
+    std::vector<unsigned char> extract_record(const std::vector<unsigned char>& obj, uint32_t record) const;
     uint32_t get_poly_degree() const {return N;}
+    uint32_t get_plain_data_bits() const {return plain_bit_count - 1;}
     uint32_t get_num_query_ciphertext() const {return num_query_ciphertext;}
 private:
     seal::SEALContext *context;
@@ -44,14 +92,34 @@ private:
     seal::GaloisKeys gal_keys;
     uint32_t num_obj;
     uint32_t obj_size;
+    uint32_t pack_factor;
+    uint32_t record_size;
     uint32_t N; //poly modulus degree
     uint32_t plain_bit_count;
     uint32_t num_columns_per_obj;
     uint32_t num_query_ciphertext;
     uint32_t reply_ciphertext_num;
+    seal::Evaluator *evaluator;
+    std::deque<seal::Ciphertext> zero_pool;         //预先加密的0
+    size_t zero_pool_target = 0;
+    bool pool_stopping = false;
+    std::mutex pool_mutex;
+    std::condition_variable pool_cond;
+    std::vector<std::thread> refill_threads;
+    int decode_threads = 0;
 
+    int rotation_window;
+
+    void init(FastPIRParams& params);
+    bool load_keys(const std::string& path);
+    //按步长分给多个线程，每个线程用自己的KeyGenerator(同一个私钥)生成一部分，最后合并到gal_keys
+    void create_galois_keys_parallel(const std::vector<int>& steps);
+    std::vector<seal::Ciphertext> take_zeros(size_t count);
+    void refill_zero_pool();
     std::vector<uint64_t> rotate_plain(std::vector<uint64_t> original, int index);
-    std::vector<unsigned char> decode(std::vector<uint64_t> v, bool last);
+    std::vector<unsigned char> decode(std::vector<uint64_t> v);
+    std::vector<unsigned char> coeffs_to_bytes(const std::vector<uint64_t>& coeffs, size_t bytes);
+    std::vector<std::vector<uint64_t>> decrypt_reply(const PIRReply& response);
 };
 
 #endif
\ No newline at end of file
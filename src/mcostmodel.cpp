@@ -0,0 +1,238 @@
+#include "mcostmodel.hpp"
+#include "mkernels.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <random>
+#include <sstream>
+
+namespace
+{
+template <typename F>
+double time_us(int repeat, F f)
+{
+    auto time_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < repeat; i++)
+    {
+        f();
+    }
+    auto time_end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time_end - time_start).count() / 1000.0 / repeat;
+}
+
+//与Mserver默认的planner相同，只有±2^i
+std::vector<int> default_key_steps(uint32_t N)
+{
+    std::vector<int> steps;
+    for (size_t i = 1; i < (N / 2); i *= 2)
+    {
+        steps.push_back(-(int)i);
+        steps.push_back((int)i);
+    }
+    return steps;
+}
+}
+
+PrimitiveTimings measure_primitives(FastPIRParams params, int repeat)
+{
+    repeat = std::max(repeat, 1);
+    const size_t terms = 16;                    //内积按16项测，取每项的平均
+    size_t N = params.get_poly_modulus_degree();
+    uint64_t plain_modulus = params.get_seal_params().plain_modulus().value();
+    seal::SEALContext context(params.get_seal_params());
+    seal::KeyGenerator keygen(context);
+    seal::Encryptor encryptor(context, keygen.secret_key());
+    seal::Decryptor decryptor(context, keygen.secret_key());
+    seal::Evaluator evaluator(context);
+    seal::BatchEncoder batch_encoder(context);
+    seal::GaloisKeys gal_keys;
+    keygen.create_galois_keys(std::vector<int>{-1}, gal_keys);         //key switch的时间与步长无关
+    const std::vector<seal::Modulus>& moduli = context.first_context_data()->parms().coeff_modulus();
+
+    std::mt19937_64 rng(std::random_device{}());
+    std::vector<uint64_t> slots(N);
+    std::vector<seal::Plaintext> plain(terms);
+    std::vector<seal::Ciphertext> query(terms);
+    for (size_t j = 0; j < terms; j++)
+    {
+        for (auto& s : slots)
+        {
+            s = rng() % plain_modulus;
+        }
+        batch_encoder.encode(slots, plain[j]);
+        evaluator.transform_to_ntt_inplace(plain[j], context.first_parms_id());
+    }
+    seal::Plaintext pt;
+    batch_encoder.encode(slots, pt);
+
+    PrimitiveTimings t;
+    t.encrypt = time_us(repeat, [&]() { encryptor.encrypt_symmetric(pt, query[0]); });
+    for (size_t j = 0; j < terms; j++)
+    {
+        encryptor.encrypt_symmetric(pt, query[j]);
+        evaluator.transform_to_ntt_inplace(query[j]);
+    }
+    seal::Ciphertext product, sum;
+    t.multiply_plain = time_us(repeat, [&]() { evaluator.multiply_plain(query[0], plain[0], product); });
+    kernels::InnerProductKernel inner_product = kernels::select_inner_product(N, moduli.size());
+    t.inner_product_term = time_us(repeat, [&]() { inner_product(query.data(), plain.data(), terms, moduli, sum); }) / terms;
+    t.add = time_us(repeat, [&]() { evaluator.add_inplace(sum, product); });
+    seal::Ciphertext reply;
+    t.intt = time_us(repeat, [&]() { evaluator.transform_from_ntt(sum, reply); });
+
+    seal::Ciphertext rotated = reply;
+    t.rotate = time_us(repeat, [&]() { evaluator.rotate_rows_inplace(rotated, -1, gal_keys); });
+    t.hoist = time_us(repeat, [&]() { HoistedRotator rotator(context, reply); });
+    HoistedRotator rotator(context, reply);
+    t.hoisted_rotate = time_us(repeat, [&]() { rotator.rotate(-1, gal_keys, rotated); });
+
+    seal::Plaintext result;
+    t.decrypt = time_us(repeat, [&]() { decryptor.decrypt(reply, result); });
+    std::string bytes;
+    t.serialize = time_us(repeat, [&]() {
+        std::stringstream ss;
+        reply.save(ss);
+        bytes = ss.str();
+    });
+    t.deserialize = time_us(repeat, [&]() {
+        std::stringstream ss(bytes);
+        rotated.load(context, ss);
+    });
+    t.ciphertext_bytes = bytes.size();
+    return t;
+}
+
+OperationCounts& OperationCounts::operator+=(const OperationCounts& other)
+{
+    inner_product_terms += other.inner_product_terms;
+    add += other.add;
+    intt += other.intt;
+    rotate += other.rotate;
+    hoist += other.hoist;
+    hoisted_rotate += other.hoisted_rotate;
+    deserialize += other.deserialize;
+    serialize += other.serialize;
+    return *this;
+}
+
+double OperationCounts::predict_us(const PrimitiveTimings& t) const
+{
+    return inner_product_terms * t.inner_product_term + add * t.add + intt * t.intt + rotate * t.rotate
+           + hoist * t.hoist + hoisted_rotate * t.hoisted_rotate + deserialize * t.deserialize + serialize * t.serialize;
+}
+
+ResponseCostModel::ResponseCostModel(FastPIRParams params, const PrimitiveTimings& timings, std::vector<int> key_steps)
+    : timings(timings), planner(params.get_poly_modulus_degree() / 2, key_steps.empty() ? default_key_steps(params.get_poly_modulus_degree()) : key_steps)
+{
+    N = params.get_poly_modulus_degree();
+    plain_bits = params.get_plain_data_bits();
+    obj_size = params.get_obj_size();
+    num_query_ciphertext = params.get_num_query_ciphertext();
+    num_columns_per_obj = params.get_num_columns_per_obj();
+}
+
+OperationCounts ResponseCostModel::sum_counts(uint32_t first, uint32_t last) const
+{
+    //每列一次内积(num_query_ciphertext项)和一次逆NTT；每N/2列一个回复密文，get_sum的旋转树对len列做len - 1次旋转和加法
+    OperationCounts c;
+    double columns = last - first + 1;
+    double segments = std::ceil(columns / (N / 2));
+    c.inner_product_terms = columns * num_query_ciphertext;
+    c.intt = columns;
+    c.rotate = columns - segments;
+    c.add = columns - segments;
+    return c;
+}
+
+OperationCounts ResponseCostModel::response_counts() const
+{
+    OperationCounts c = sum_counts(0, num_columns_per_obj / 2 - 1);
+    c.deserialize = num_query_ciphertext;
+    c.serialize = std::ceil(num_columns_per_obj / 2 / (double)(N / 2));
+    return c;
+}
+
+OperationCounts ResponseCostModel::range_counts(size_t offset, size_t length) const
+{
+    auto columns = FastPIRParams::column_range(obj_size, offset, length, plain_bits);
+    OperationCounts c = sum_counts(columns.first, columns.second);
+    c.deserialize = num_query_ciphertext;
+    c.serialize = std::ceil((columns.second - columns.first + 1) / (double)(N / 2));
+    return c;
+}
+
+OperationCounts ResponseCostModel::multi_counts(const std::vector<int>& coeffOffsets) const
+{
+    size_t query_count = coeffOffsets.size() + 1;
+    OperationCounts c;
+    for (size_t m = 0; m < query_count; m++)
+    {
+        c += sum_counts(0, num_columns_per_obj / 2 - 1);
+    }
+    c.deserialize = num_query_ciphertext;
+
+    //move_queries: 与rotate_many相同地把所有plan建成前缀树，只有一个分支的节点直接旋转，多个分支的节点分解一次再逐个旋转
+    std::vector<std::map<int, size_t>> children(1);
+    for (int offset : coeffOffsets)
+    {
+        size_t node = 0;
+        for (int step : planner.plan(offset))
+        {
+            auto it = children[node].find(step);
+            if (it == children[node].end())
+            {
+                children.emplace_back();
+                it = children[node].emplace(step, children.size() - 1).first;
+            }
+            node = it->second;
+        }
+    }
+    for (auto& node : children)
+    {
+        if (node.size() == 1)
+        {
+            c.rotate += num_query_ciphertext;
+        }
+        else if (node.size() > 1)
+        {
+            c.hoist += num_query_ciphertext;
+            c.hoisted_rotate += node.size() * num_query_ciphertext;
+        }
+    }
+
+    //concat_response: 不满一段的部分移到各自的位置，同一个打包密文中的相加
+    ReplyPacking packing(query_count, num_columns_per_obj, N / 2);
+    if (packing.partial_length > 0)
+    {
+        for (size_t m = 0; m < query_count; m++)
+        {
+            int step = (m == 0 ? 0 : -coeffOffsets[m - 1]) - (int)packing.partial_offset(m);
+            c.rotate += planner.rotations(step);
+        }
+        c.add += query_count - std::ceil(query_count / (double)packing.per_cipher);
+    }
+    c.serialize = packing.cipher_count();
+    return c;
+}
+
+OperationCounts ResponseCostModel::multi_counts(size_t query_count) const
+{
+    //偏移未知: 每个移动的查询按平均旋转次数，不考虑前缀共享
+    query_count = std::max<size_t>(query_count, 1);
+    OperationCounts c;
+    for (size_t m = 0; m < query_count; m++)
+    {
+        c += sum_counts(0, num_columns_per_obj / 2 - 1);
+    }
+    c.deserialize = num_query_ciphertext;
+    c.rotate += (query_count - 1) * num_query_ciphertext * planner.average_rotations();
+    ReplyPacking packing(query_count, num_columns_per_obj, N / 2);
+    if (packing.partial_length > 0)
+    {
+        c.rotate += (query_count - 1) * planner.average_rotations();
+        c.add += query_count - std::ceil(query_count / (double)packing.per_cipher);
+    }
+    c.serialize = packing.cipher_count();
+    return c;
+}
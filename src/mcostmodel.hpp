@@ -0,0 +1,75 @@
+#ifndef FASTPIR_COSTMODEL_H
+#define FASTPIR_COSTMODEL_H
+
+#include <vector>
+#include <cstddef>
+#include "mfastpirparams.hpp"
+#include "mrotation.hpp"
+
+//服务端用到的基本运算单次的时间(us)和序列化后密文的大小，由measure_primitives在给定参数下实测
+struct PrimitiveTimings
+{
+    double multiply_plain = 0;          //NTT形式的密文 x NTT形式的明文
+    double inner_product_term = 0;      //get_sum叶子的内积(mkernels)中平均每一项
+    double add = 0;
+    double rotate = 0;                  //rotate_rows_inplace，一次完整的key switch
+    double intt = 0;                    //transform_from_ntt_inplace
+    double hoist = 0;                   //HoistedRotator的构造(c1的分解，多个分支共用)
+    double hoisted_rotate = 0;          //分解之后的一次旋转
+    double encrypt = 0;
+    double decrypt = 0;
+    double serialize = 0;               //Ciphertext::save
+    double deserialize = 0;             //Ciphertext::load
+    size_t ciphertext_bytes = 0;        //Ciphertext::save的大小，查询和回复密文相同
+};
+
+PrimitiveTimings measure_primitives(FastPIRParams params, int repeat = 10);
+
+//一个请求在服务端执行的各种运算的次数
+struct OperationCounts
+{
+    double inner_product_terms = 0;
+    double add = 0;
+    double intt = 0;
+    double rotate = 0;
+    double hoist = 0;
+    double hoisted_rotate = 0;
+    double deserialize = 0;             //收到的查询密文
+    double serialize = 0;               //发出的回复密文
+
+    OperationCounts& operator+=(const OperationCounts& other);
+    double predict_us(const PrimitiveTimings& t) const;
+};
+
+//按Mserver的实现统计get_sum、move_queries、concat_response的运算次数，乘以实测的单次时间得到预测的延迟。
+//key_steps为客户端上传的旋转key(为空时与Mserver默认相同，只有±2^i)
+class ResponseCostModel
+{
+public:
+    ResponseCostModel(FastPIRParams params, const PrimitiveTimings& timings, std::vector<int> key_steps = std::vector<int>());
+
+    //get_sum扫描[first, last]列(每N/2列一个回复密文)
+    OperationCounts sum_counts(uint32_t first, uint32_t last) const;
+    //get_response(包括查询的反序列化和回复的序列化)
+    OperationCounts response_counts() const;
+    //按字节范围取回
+    OperationCounts range_counts(size_t offset, size_t length) const;
+    //get_multi_response，偏移已知时按旋转计划精确统计(与rotate_many相同地共享前缀)
+    OperationCounts multi_counts(const std::vector<int>& coeffOffsets) const;
+    //只知道查询的index个数时按平均旋转次数估计
+    OperationCounts multi_counts(size_t query_count) const;
+
+    double predict_us(const OperationCounts& counts) const {return counts.predict_us(timings);}
+    const PrimitiveTimings& get_timings() const {return timings;}
+
+private:
+    PrimitiveTimings timings;
+    RotationPlanner planner;
+    uint32_t N;
+    uint32_t plain_bits;
+    uint32_t obj_size;
+    uint32_t num_query_ciphertext;
+    uint32_t num_columns_per_obj;
+};
+
+#endif
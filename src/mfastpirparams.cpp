@@ -1,37 +1,65 @@
 
 #include "mfastpirparams.hpp"
-FastPIRParams::FastPIRParams(size_t num_obj, size_t obj_size, size_t polyDegree, size_t pmod)
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+FastPIRParams::FastPIRParams(size_t num_obj, size_t obj_size, size_t polyDegree, size_t pmod, size_t pack_factor)
 {
+    const BFVParamSet* set = find_param_set(polyDegree, pmod);
+    if (set == nullptr)
+    {
+        std::cout << "unsupported BFV parameters: N = " << polyDegree << " plain bits = " << pmod << std::endl;
+        exit(1);
+    }
     seal_params = seal::EncryptionParameters(seal::scheme_type::bfv);
-    
-    seal_params.set_poly_modulus_degree(POLY_MODULUS_DEGREE);                 
-    seal_params.set_coeff_modulus(COEFF_MOD_ARR);
-    seal_params.set_plain_modulus(seal::PlainModulus::Batching(POLY_MODULUS_DEGREE, PLAIN_BIT + 1));
-    
-    //4096
-    /*
-    seal_params.set_poly_modulus_degree(POLY_MODULUS_DEGREE);               
-    //seal_params.set_coeff_modulus(COEFF_MOD_ARR);  
-    seal_params.set_coeff_modulus(seal::CoeffModulus::Create(POLY_MODULUS_DEGREE, { 60, 49 }));
-    seal_params.set_plain_modulus(seal::PlainModulus::Batching(POLY_MODULUS_DEGREE, PLAIN_BIT + 1));
-    */
-    this->num_obj = num_obj;
-    this->obj_size = obj_size;
+    seal_params.set_poly_modulus_degree(polyDegree);
+    seal_params.set_coeff_modulus(seal::CoeffModulus::Create(polyDegree, set->coeff_bits));
+    seal_params.set_plain_modulus(seal::PlainModulus::Batching(polyDegree, pmod + 1));
+    plain_bits = pmod;
+
+    this->pack_factor = std::max<size_t>(pack_factor, 1);
+    record_num = num_obj;
+    record_size = obj_size;
+    this->num_obj = ceil(num_obj / (double)this->pack_factor);
+    this->obj_size = obj_size * this->pack_factor;
+    num_obj = this->num_obj;
+    obj_size = this->obj_size;
 
     //num_query_ciphertext = 2 * ceil(num_obj / (double)(POLY_MODULUS_DEGREE));
-    num_query_ciphertext = ceil(num_obj / (double)(POLY_MODULUS_DEGREE/2));     //查询密文的数量,1、2列各一个所以*2, 这里和查询的大小无关，因为后续的明文也是用相同的查询密文计算
+    num_query_ciphertext = ceil(num_obj / (double)(polyDegree/2));     //查询密文的数量,1、2列各一个所以*2, 这里和查询的大小无关，因为后续的明文也是用相同的查询密文计算
 
-    num_columns_per_obj = 2 * (ceil(((obj_size/2) * 8) / (float)(PLAIN_BIT)));  //每条消息所占的系数数量，必须分为两个部分
+    num_columns_per_obj = 2 * (ceil(((obj_size/2) * 8) / (float)(pmod)));  //每条消息所占的系数数量，必须分为两个部分
     num_columns_per_obj += num_columns_per_obj % 2;                             //因为分成2部分，必须是2的倍数(这行似乎没有必要了)
-    db_rows = ceil(num_obj / (double)POLY_MODULUS_DEGREE) * num_columns_per_obj;    //明文的总数
+    db_rows = ceil(num_obj / (double)polyDegree) * num_columns_per_obj;    //明文的总数
 
-    reply_ciphertext_num = ceil(num_columns_per_obj / (double)POLY_MODULUS_DEGREE);
+    reply_ciphertext_num = ceil(num_columns_per_obj / (double)polyDegree);
     //num_query_ciphertext * (num_columns_per_obj/2) 
                         
     return;
 }
 
 
+const std::vector<BFVParamSet>& FastPIRParams::param_sets()
+{
+    //系数模数的总位数不超过SEAL对该N的128位安全上限(4096: 109，8192: 218)
+    static const std::vector<BFVParamSet> sets = {
+        {4096, 20, {60, 49}},
+        {8192, 20, {60, 60, 60, 38}},
+        {8192, 40, {60, 60, 60, 38}},
+    };
+    return sets;
+}
+
+const BFVParamSet* FastPIRParams::find_param_set(size_t polyDegree, size_t pmod)
+{
+    for (auto& set : param_sets())
+    {
+        if (set.poly_degree == polyDegree && set.plain_bits == pmod)
+            return &set;
+    }
+    return nullptr;
+}
+
 size_t FastPIRParams::get_num_obj()
 {
     return num_obj;
@@ -75,4 +103,59 @@ size_t FastPIRParams::get_plain_modulus_size()
 size_t FastPIRParams::get_reply_ciphertext_num() const
 {
     return reply_ciphertext_num;
-}
\ No newline at end of file
+}
+size_t FastPIRParams::choose_pack_factor(size_t obj_size, size_t plain_bits)
+{
+    //一条记录的每一半占obj_size/2*8位，不满plain_bits的部分被填充。
+    //g条记录拼接后每一半占ceil(g*obj_size*4/plain_bits)个系数，g = plain_bits/gcd时正好没有填充
+    //节省不到10%时不打包，避免大记录被拼成很大的消息
+    size_t half_bits = obj_size / 2 * 8;
+    size_t best = 1;
+    double unpacked_cost = ceil(half_bits / (double)plain_bits);
+    double best_cost = unpacked_cost;
+    for (size_t g = 2; g <= plain_bits; g++)
+    {
+        double cost = ceil(g * half_bits / (double)plain_bits) / g;
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            best = g;
+        }
+    }
+    return best_cost <= 0.9 * unpacked_cost ? best : 1;
+}
+
+std::pair<uint32_t, uint32_t> FastPIRParams::column_range(size_t obj_size, size_t offset, size_t length, size_t plain_bits)
+{
+    assert(length > 0 && offset + length <= obj_size);
+    size_t half = obj_size / 2;
+    uint32_t first = UINT32_MAX, last = 0;
+    for (size_t h = 0; h < 2; h++)
+    {
+        size_t lo = std::max(offset, h * half), hi = std::min(offset + length, (h + 1) * half);
+        if (lo >= hi)
+            continue;
+        first = std::min<uint32_t>(first, (lo - h * half) * 8 / plain_bits);
+        last = std::max<uint32_t>(last, ((hi - h * half) * 8 - 1) / plain_bits);
+    }
+    return std::make_pair(first, last);
+}
+
+ReplyPacking::ReplyPacking(size_t reply_count, uint32_t num_columns_per_obj, uint32_t row_size)
+{
+    this->reply_count = reply_count;
+    size_t columns = num_columns_per_obj / 2;
+    full_segments = columns / row_size;
+    partial_length = columns % row_size;
+    per_cipher = partial_length == 0 ? 1 : row_size / partial_length;
+}
+
+size_t ReplyPacking::cipher_count() const
+{
+    size_t count = reply_count * full_segments;
+    if (partial_length != 0)
+    {
+        count += (reply_count + per_cipher - 1) / per_cipher;
+    }
+    return count;
+}
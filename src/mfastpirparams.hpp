@@ -17,11 +17,53 @@ struct Query
     std::vector<int> coeffOffset;
 };
 
+//多查询回复的打包布局，服务端和客户端用相同的参数算出相同的布局。
+//一个回复有reply_ciphertext_num个段，段r包含第[rR, min((r+1)R, C))列(R = N/2，C = num_columns_per_obj/2)，
+//get_sum之后位于查询index所在的slot开始的位置。长度为R的整段各占一个输出密文，不旋转；
+//最后不满R的段长度都是L，每floor(R/L)个连续放进一个打包密文，第j个放在slot s0 + jL(s0为第一个index的slot)
+struct ReplyPacking
+{
+    ReplyPacking(size_t reply_count, uint32_t num_columns_per_obj, uint32_t row_size);
+
+    size_t reply_count;
+    size_t full_segments;                   //每个回复的整段数
+    size_t partial_length;                  //L，0表示没有不满的段
+    size_t per_cipher;                      //每个打包密文中的段数
+
+    size_t cipher_count() const;
+    size_t full_cipher(size_t reply, size_t segment) const {return reply * full_segments + segment;}
+    size_t partial_cipher(size_t reply) const {return reply_count * full_segments + reply / per_cipher;}
+    size_t partial_offset(size_t reply) const {return (reply % per_cipher) * partial_length;}
+};
+
+//支持的BFV参数组合，运行时按(poly_degree, plain_bits)选择。
+//plain_bits为每个明文系数放的数据位数，明文模数为plain_bits + 1位的batching素数
+struct BFVParamSet
+{
+    size_t poly_degree;
+    size_t plain_bits;
+    std::vector<int> coeff_bits;
+};
+
 class FastPIRParams {
 public:
-    FastPIRParams(size_t num_obj, size_t obj_size, size_t polyDegree, size_t pmod);
+    //pack_factor > 1时每pack_factor条记录拼成一条消息(小记录打包)，num_obj/obj_size是记录的数量和大小，
+    //get_num_obj/get_obj_size返回的是拼接后的消息。(polyDegree, pmod)必须是param_sets中的一组，否则退出
+    FastPIRParams(size_t num_obj, size_t obj_size, size_t polyDegree = POLY_MODULUS_DEGREE, size_t pmod = PLAIN_BIT, size_t pack_factor = 1);
+
+    static const std::vector<BFVParamSet>& param_sets();
+    static const BFVParamSet* find_param_set(size_t polyDegree, size_t pmod);
     size_t get_num_obj();
     size_t get_obj_size();
+    size_t get_pack_factor() const {return pack_factor;}
+    size_t get_record_num() const {return record_num;}
+    size_t get_record_size() const {return record_size;}
+
+    //使每条记录平均占用的系数最少的最小pack_factor，大记录返回1
+    static size_t choose_pack_factor(size_t obj_size, size_t plain_bits = PLAIN_BIT);
+    //按字节范围取回: 消息中[offset, offset + length)字节所在的列[first, last]。
+    //前后两半的同一列在同一个系数位置，所以两半各自需要的列取并集；范围是公开的，与index无关
+    static std::pair<uint32_t, uint32_t> column_range(size_t obj_size, size_t offset, size_t length, size_t plain_bits = PLAIN_BIT);
     uint32_t get_num_query_ciphertext();
     uint32_t get_num_columns_per_obj();
     uint32_t get_db_rows();
@@ -29,6 +71,7 @@ public:
     seal::EncryptionParameters get_seal_params();
     size_t get_poly_modulus_degree();
     size_t get_plain_modulus_size();
+    size_t get_plain_data_bits() const {return plain_bits;}
     size_t get_reply_ciphertext_num() const;
 private:
     seal::EncryptionParameters seal_params;             //seal相关参数
@@ -40,6 +83,11 @@ private:
     uint32_t db_rows;                                   //总行数
 
     size_t reply_ciphertext_num;                        //返回的密文个数
+    size_t plain_bits;                                  //每个系数的数据位数
+
+    size_t pack_factor;                                 //每条消息中的记录数
+    size_t record_num;
+    size_t record_size;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,133 @@
+#ifndef FASTPIR_HISTOGRAM_H
+#define FASTPIR_HISTOGRAM_H
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// 对数-线性分桶的延迟直方图(单位us)，相对误差约3%
+// 每个桶是一个原子计数，多个线程可以直接record，不需要加锁
+class LatencyHistogram
+{
+public:
+    static const int kSubBucketBits = 5;
+    static const int kSubBucketCount = 1 << kSubBucketBits;          //每个2的幂区间分成32个桶
+    static const int kLinearCount = 2 * kSubBucketCount;             //[0, 64)逐个计数
+    static const int kBucketCount = kLinearCount + (64 - kSubBucketBits - 1) * kSubBucketCount;
+
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for(int i = 0; i < kBucketCount; ++i)
+        {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+        m_sum.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t value)
+    {
+        m_buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t prev = m_max.load(std::memory_order_relaxed);
+        while(value > prev && !m_max.compare_exchange_weak(prev, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void merge(const LatencyHistogram& other)
+    {
+        for(int i = 0; i < kBucketCount; ++i)
+        {
+            m_buckets[i].fetch_add(other.m_buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        m_count.fetch_add(other.count(), std::memory_order_relaxed);
+        m_sum.fetch_add(other.sum(), std::memory_order_relaxed);
+        uint64_t otherMax = other.max();
+        uint64_t prev = m_max.load(std::memory_order_relaxed);
+        while(otherMax > prev && !m_max.compare_exchange_weak(prev, otherMax, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    double mean() const { return count() == 0 ? 0 : (double)sum() / count(); }
+
+    //返回第p百分位(0~100)所在桶的上界
+    uint64_t percentile(double p) const
+    {
+        uint64_t total = count();
+        if(total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+        if(rank == 0)
+            rank = 1;
+        uint64_t seen = 0;
+        for(int i = 0; i < kBucketCount; ++i)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if(seen >= rank)
+            {
+                uint64_t upper = bucket_upper(i);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+    //累积到value(含)为止的计数，用于按固定边界导出
+    uint64_t count_le(uint64_t value) const
+    {
+        int last = bucket_index(value);
+        uint64_t seen = 0;
+        for(int i = 0; i <= last; ++i)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+        }
+        return seen;
+    }
+
+    std::string to_json() const
+    {
+        std::stringstream ss;
+        ss << "{\"count\": " << count() << ", \"mean\": " << mean() << ", \"p50\": " << percentile(50)
+           << ", \"p90\": " << percentile(90) << ", \"p99\": " << percentile(99) << ", \"p999\": " << percentile(99.9)
+           << ", \"max\": " << max() << "}";
+        return ss.str();
+    }
+
+private:
+    static int bucket_index(uint64_t value)
+    {
+        if(value < kLinearCount)
+            return (int)value;
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - kSubBucketBits;                                    //保留最高的kSubBucketBits+1位
+        return kLinearCount + (shift - 1) * kSubBucketCount + (int)((value >> shift) - kSubBucketCount);
+    }
+
+    static uint64_t bucket_upper(int index)
+    {
+        if(index < kLinearCount)
+            return index;
+        int shift = (index - kLinearCount) / kSubBucketCount + 1;
+        uint64_t sub = (index - kLinearCount) % kSubBucketCount + kSubBucketCount;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> m_buckets[kBucketCount];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
+
+#endif
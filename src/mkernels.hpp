@@ -0,0 +1,104 @@
+#ifndef FASTPIR_KERNELS_H
+#define FASTPIR_KERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include "seal/seal.h"
+
+//get_sum叶子上的内积: sum_j query[j] * plain[j]，查询和明文都是NTT形式。
+//原来每一项是multiply_plain(每个系数一次取模，写一个临时密文)再add_inplace(再读写一遍)；
+//这里按块把两个多项式的乘积累加在128位里，最多kLazyTerms项才做一次Barrett约减，结果只写一次。
+//kN/kLimbs为编译期常数时循环边界和每个RNS分量的偏移都在编译期确定；为0时用运行时的N和分量数(与bitcodec相同)。
+//模数由CoeffModulus::Create在运行时生成，Barrett常数在每个分量开始时读到局部常量里
+namespace kernels
+{
+//数据层的素数不超过60位，乘积小于2^120，255项加上约减后的余数不会超过2^128
+constexpr size_t kLazyTerms = 255;
+constexpr size_t kBlock = 256;
+
+//x mod q，ratio为floor(2^128 / q)的低、高64位(Modulus::const_ratio)，与SEAL的barrett_reduce_128相同
+inline uint64_t barrett_reduce_128(unsigned __int128 x, uint64_t q, uint64_t ratio0, uint64_t ratio1)
+{
+    uint64_t lo = (uint64_t)x;
+    uint64_t hi = (uint64_t)(x >> 64);
+    unsigned __int128 a = (unsigned __int128)lo * ratio1 + (((unsigned __int128)lo * ratio0) >> 64);
+    unsigned __int128 b = (unsigned __int128)hi * ratio0 + (uint64_t)a;
+    uint64_t quotient = hi * ratio1 + (uint64_t)(a >> 64) + (uint64_t)(b >> 64);
+    uint64_t r = lo - quotient * q;
+    return r >= q ? r - q : r;
+}
+
+template <size_t kN, size_t kLimbs>
+void inner_product_ntt(const seal::Ciphertext* query, const seal::Plaintext* plain, size_t count,
+                       const std::vector<seal::Modulus>& moduli, seal::Ciphertext& result)
+{
+    const size_t n = kN ? kN : query[0].poly_modulus_degree();
+    const size_t limbs = kLimbs ? kLimbs : moduli.size();
+    const size_t block = n < kBlock ? n : kBlock;
+    //RNS分量少的(低level)查询会使下面的读写越界，调用者应该已经检查过，这里再拒绝一次
+    for (size_t j = 0; j < count; j++)
+    {
+        if (query[j].size() != 2 || !query[j].is_ntt_form() || query[j].coeff_modulus_size() != limbs || query[j].poly_modulus_degree() != n)
+            throw std::invalid_argument("query ciphertext doesn't match the database parameters");
+    }
+    result = query[0];                  //大小、parms_id、NTT标记与查询相同，数据下面全部覆盖
+    unsigned __int128 acc0[kBlock], acc1[kBlock];
+    for (size_t i = 0; i < limbs; i++)
+    {
+        const uint64_t q = moduli[i].value();
+        const uint64_t ratio0 = moduli[i].const_ratio()[0];
+        const uint64_t ratio1 = moduli[i].const_ratio()[1];
+        for (size_t b = 0; b < n; b += block)
+        {
+            const size_t offset = i * n + b;
+            for (size_t k = 0; k < block; k++)
+            {
+                acc0[k] = 0;
+                acc1[k] = 0;
+            }
+            for (size_t j = 0; j < count; j++)
+            {
+                const uint64_t* c0 = query[j].data(0) + offset;
+                const uint64_t* c1 = query[j].data(1) + offset;
+                const uint64_t* p = plain[j].data() + offset;
+                for (size_t k = 0; k < block; k++)
+                {
+                    acc0[k] += (unsigned __int128)c0[k] * p[k];
+                    acc1[k] += (unsigned __int128)c1[k] * p[k];
+                }
+                if ((j + 1) % kLazyTerms == 0)
+                {
+                    for (size_t k = 0; k < block; k++)
+                    {
+                        acc0[k] = barrett_reduce_128(acc0[k], q, ratio0, ratio1);
+                        acc1[k] = barrett_reduce_128(acc1[k], q, ratio0, ratio1);
+                    }
+                }
+            }
+            uint64_t* r0 = result.data(0) + offset;
+            uint64_t* r1 = result.data(1) + offset;
+            for (size_t k = 0; k < block; k++)
+            {
+                r0[k] = barrett_reduce_128(acc0[k], q, ratio0, ratio1);
+                r1[k] = barrett_reduce_128(acc1[k], q, ratio0, ratio1);
+            }
+        }
+    }
+}
+
+typedef void (*InnerProductKernel)(const seal::Ciphertext*, const seal::Plaintext*, size_t, const std::vector<seal::Modulus>&, seal::Ciphertext&);
+
+//部署的参数(N = 4096数据层1个素数，N = 8192数据层3个素数；特殊素数只在key switch时用)选特化的实例，其余用通用实例
+inline InnerProductKernel select_inner_product(size_t n, size_t limbs)
+{
+    if (n == 4096 && limbs == 1)
+        return inner_product_ntt<4096, 1>;
+    if (n == 8192 && limbs == 3)
+        return inner_product_ntt<8192, 3>;
+    return inner_product_ntt<0, 0>;
+}
+}
+
+#endif
@@ -0,0 +1,258 @@
+#include "mkeywordpir.hpp"
+#include "mparallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <fstream>
+#include <unordered_set>
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <cassert>
+
+namespace
+{
+const int kMaxEvictions = 1000;
+}
+
+size_t KeywordPIRParams::get_slot_size() const
+{
+    size_t size = kHeaderSize + value_size;
+    return size + size % 2;                 //FastPIR的消息长度必须是偶数
+}
+
+FastPIRParams KeywordPIRParams::get_fastpir_params() const
+{
+    return FastPIRParams(get_num_slots(), get_slot_size(), poly_degree, plain_bits);
+}
+
+size_t KeywordPIRParams::partition_of(uint64_t key) const
+{
+    return mix64(key ^ seed) % partitions;
+}
+
+std::vector<uint32_t> KeywordPIRParams::candidate_slots(uint64_t key) const
+{
+    size_t base = partition_of(key) * slots_per_partition;
+    std::vector<uint32_t> res;
+    for (uint64_t h = 1; res.size() < kHashCount; h++)
+    {
+        uint32_t s = base + mix64(mix64(seed + h) ^ key) % slots_per_partition;
+        if (std::find(res.begin(), res.end(), s) == res.end())
+        {
+            res.push_back(s);
+        }
+    }
+    return res;
+}
+
+uint64_t KeywordPIRParams::tag(uint64_t key) const
+{
+    return mix64(key ^ ~seed) | 1;
+}
+
+std::vector<KeywordRecord> load_keyword_records(const std::vector<std::string>& files)
+{
+    std::vector<std::vector<KeywordRecord>> parts(files.size());
+    parallel_for(files.size(), files.size(), [&](size_t f) {
+        std::ifstream in(files[f], std::ios::binary);
+        if (!in)
+        {
+            std::cout << "open " << files[f] << " failed" << std::endl;
+            exit(1);
+        }
+        KeywordRecord record;
+        uint32_t len;
+        while (in.read(reinterpret_cast<char*>(&record.key), sizeof(record.key)))
+        {
+            if (!in.read(reinterpret_cast<char*>(&len), sizeof(len)))
+            {
+                std::cout << "truncated record in " << files[f] << std::endl;
+                exit(1);
+            }
+            record.value.resize(len);
+            if (len > 0 && !in.read(reinterpret_cast<char*>(record.value.data()), len))
+            {
+                std::cout << "truncated record in " << files[f] << std::endl;
+                exit(1);
+            }
+            parts[f].push_back(record);
+        }
+    });
+    std::vector<KeywordRecord> records;
+    for (auto& p : parts)
+    {
+        std::move(p.begin(), p.end(), std::back_inserter(records));
+    }
+    return records;
+}
+
+void save_keyword_records(const std::string& file, const std::vector<KeywordRecord>& records)
+{
+    std::ofstream out(file, std::ios::binary);
+    for (auto& r : records)
+    {
+        uint32_t len = r.value.size();
+        out.write(reinterpret_cast<const char*>(&r.key), sizeof(r.key));
+        out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        out.write(reinterpret_cast<const char*>(r.value.data()), len);
+    }
+}
+
+std::vector<std::vector<unsigned char>> build_keyword_table(const std::vector<KeywordRecord>& records, KeywordPIRParams& params,
+                                                            int threads, double load_factor)
+{
+    //重复的key只保留第一条
+    std::vector<uint32_t> items;
+    {
+        std::unordered_set<uint64_t> seen;
+        for (uint32_t i = 0; i < records.size(); i++)
+        {
+            if (seen.insert(records[i].key).second)
+                items.push_back(i);
+        }
+        if (items.size() != records.size())
+        {
+            std::cout << records.size() - items.size() << " duplicate keys ignored" << std::endl;
+        }
+    }
+    params.value_size = 1;
+    for (auto i : items)
+    {
+        params.value_size = std::max(params.value_size, records[i].value.size());
+    }
+
+    //一个partition最多占一个查询密文的一行
+    size_t row_size = params.poly_degree / 2;
+    double slots = std::max<double>(items.size() / load_factor, KeywordPIRParams::kHashCount);
+    std::vector<int64_t> table;
+    while (true)
+    {
+        params.slots_per_partition = std::min<size_t>(std::ceil(slots), row_size);
+        params.partitions = std::ceil(slots / params.slots_per_partition);
+        std::vector<std::vector<uint32_t>> parts(params.partitions);
+        for (auto i : items)
+        {
+            parts[params.partition_of(records[i].key)].push_back(i);
+        }
+
+        table.assign(params.get_num_slots(), -1);
+        std::atomic<bool> failed(false);
+        parallel_for(parts.size(), threads, [&](size_t p) {
+            std::mt19937_64 rng(mix64(params.seed ^ p));          //固定种子，构建结果可复现
+            for (auto item : parts[p])
+            {
+                int64_t cur = item;
+                bool placed = false;
+                for (int step = 0; step < kMaxEvictions && !placed && !failed; step++)
+                {
+                    auto candidates = params.candidate_slots(records[cur].key);
+                    for (auto s : candidates)
+                    {
+                        if (table[s] == -1)
+                        {
+                            table[s] = cur;
+                            placed = true;
+                            break;
+                        }
+                    }
+                    if (!placed)
+                    {
+                        std::swap(cur, table[candidates[rng() % candidates.size()]]);
+                    }
+                }
+                if (!placed)
+                {
+                    failed = true;
+                    return;
+                }
+            }
+        });
+        if (!failed)
+            break;
+        slots *= 1.1;
+        std::cout << "cuckoo insertion failed, rebuilding with " << (size_t)std::ceil(slots) << " slots" << std::endl;
+    }
+
+    std::vector<std::vector<unsigned char>> db(params.get_num_slots());
+    size_t slot_size = params.get_slot_size();
+    parallel_for(db.size(), threads, [&](size_t s) {
+        db[s].assign(slot_size, 0);
+        if (table[s] == -1)
+            return;
+        const KeywordRecord& r = records[table[s]];
+        uint64_t tag = params.tag(r.key);
+        uint32_t len = r.value.size();
+        memcpy(db[s].data(), &tag, sizeof(tag));
+        memcpy(db[s].data() + sizeof(tag), &len, sizeof(len));
+        std::copy(r.value.begin(), r.value.end(), db[s].begin() + KeywordPIRParams::kHeaderSize);
+    });
+    return db;
+}
+
+KeywordPIRClient::KeywordPIRClient(const KeywordPIRParams& params, int rotation_window)
+    : params(params), client(new Mclient(params.get_fastpir_params(), rotation_window))
+{
+
+}
+
+std::vector<PIRQuery> KeywordPIRClient::gen_query(const std::vector<uint64_t>& keys)
+{
+    std::vector<uint32_t> slots;
+    for (auto key : keys)
+    {
+        auto candidates = params.candidate_slots(key);
+        slots.insert(slots.end(), candidates.begin(), candidates.end());
+    }
+    last_keys = keys;
+    last_groups = client->group_indices(slots);
+    assert(last_groups.size() <= query_count(keys.size()));
+    std::vector<PIRQuery> querys;
+    for (auto& g : last_groups)
+    {
+        querys.push_back(client->gen_batch_query(g));
+    }
+    //假查询取回随机的一个slot，服务端看到的与真查询相同
+    std::mt19937_64 rng(std::random_device{}());
+    while (querys.size() < query_count(keys.size()))
+    {
+        querys.push_back(client->gen_batch_query({(uint32_t)(rng() % params.get_num_slots())}));
+    }
+    return querys;
+}
+
+std::vector<std::pair<bool, std::vector<unsigned char>>> KeywordPIRClient::decode_response(const std::vector<PIRReply>& replys)
+{
+    assert(replys.size() >= last_groups.size());
+    std::map<uint32_t, std::vector<unsigned char>> slots;
+    for (size_t g = 0; g < last_groups.size(); g++)
+    {
+        auto records = client->decode_batch_response(replys[g], last_groups[g]);
+        for (size_t i = 0; i < records.size(); i++)
+        {
+            slots[last_groups[g][i]] = std::move(records[i]);
+        }
+    }
+    std::vector<std::pair<bool, std::vector<unsigned char>>> res;
+    for (auto key : last_keys)
+    {
+        std::pair<bool, std::vector<unsigned char>> found(false, std::vector<unsigned char>());
+        uint64_t expected = params.tag(key);
+        for (auto s : params.candidate_slots(key))
+        {
+            const auto& slot = slots[s];
+            uint64_t tag;
+            uint32_t len;
+            memcpy(&tag, slot.data(), sizeof(tag));
+            memcpy(&len, slot.data() + sizeof(tag), sizeof(len));
+            if (tag == expected && len <= params.value_size)
+            {
+                found.first = true;
+                found.second.assign(slot.begin() + KeywordPIRParams::kHeaderSize, slot.begin() + KeywordPIRParams::kHeaderSize + len);
+                break;
+            }
+        }
+        res.push_back(std::move(found));
+    }
+    return res;
+}
@@ -0,0 +1,75 @@
+#ifndef FASTPIR_KEYWORDPIR_H
+#define FASTPIR_KEYWORDPIR_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+
+//关键字PIR: 按64位key取回消息。
+//服务端把(key, value)放进cuckoo hash表，表的每个slot是FastPIR库中的一条消息: | tag(8) | len(4) | value(value_size) |；
+//表分成若干partition，key先hash到一个partition，3个候选slot都在这个partition中，各partition可以并行构建。
+//客户端算出key的3个候选slot，用k-hot批量查询取回后比较tag
+struct KeywordRecord
+{
+    uint64_t key;
+    std::vector<unsigned char> value;
+};
+
+//表的公开参数，服务端构建后发给客户端
+struct KeywordPIRParams
+{
+    static const int kHashCount = 3;
+    static const size_t kHeaderSize = sizeof(uint64_t) + sizeof(uint32_t);
+
+    size_t partitions = 1;
+    size_t slots_per_partition = 0;
+    size_t value_size = 0;
+    uint64_t seed = 0x6b6579;
+    size_t poly_degree = POLY_MODULUS_DEGREE;           //BFV参数，partition的大小按N/2计算
+    size_t plain_bits = PLAIN_BIT;
+
+    size_t get_num_slots() const {return partitions * slots_per_partition;}
+    size_t get_slot_size() const;
+    FastPIRParams get_fastpir_params() const;
+
+    size_t partition_of(uint64_t key) const;
+    std::vector<uint32_t> candidate_slots(uint64_t key) const;
+    uint64_t tag(uint64_t key) const;                           //非0，空slot的tag为0
+};
+
+//文件格式: 若干条 | key(u64) | len(u32) | value(len) |，小端；每个文件一个线程解析
+std::vector<KeywordRecord> load_keyword_records(const std::vector<std::string>& files);
+void save_keyword_records(const std::string& file, const std::vector<KeywordRecord>& records);
+
+//构建cuckoo表，返回值可以直接作为Mserver::set_db的输入。
+//load_factor为slot的目标利用率，某个partition插入失败时增加slot数重新构建
+std::vector<std::vector<unsigned char>> build_keyword_table(const std::vector<KeywordRecord>& records, KeywordPIRParams& params,
+                                                            int threads = 1, double load_factor = 0.75);
+
+class KeywordPIRClient
+{
+public:
+    KeywordPIRClient(const KeywordPIRParams& params, int rotation_window = 1);
+
+    seal::GaloisKeys get_galois_keys() {return client->get_galois_keys();}
+
+    //每个返回的查询是一次全库扫描(服务端调用Mserver::get_response)。
+    //查询个数固定为query_count(keys.size())，不足时用假查询补齐: 实际需要的个数取决于各key的候选slot是否冲突，会泄露key的信息
+    std::vector<PIRQuery> gen_query(const std::vector<uint64_t>& keys);
+    //最坏情况(每个候选slot单独一组)的查询个数，只与key的个数有关
+    static size_t query_count(size_t key_count) {return KeywordPIRParams::kHashCount * key_count;}
+
+    //与上一次gen_query的keys一一对应，first为false表示key不存在；假查询的回复被忽略
+    std::vector<std::pair<bool, std::vector<unsigned char>>> decode_response(const std::vector<PIRReply>& replys);
+
+private:
+    KeywordPIRParams params;
+    std::unique_ptr<Mclient> client;
+    std::vector<uint64_t> last_keys;
+    std::vector<std::vector<uint32_t>> last_groups;
+};
+
+#endif
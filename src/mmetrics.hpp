@@ -0,0 +1,147 @@
+#ifndef FASTPIR_METRICS_H
+#define FASTPIR_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include "mhistogram.hpp"
+
+//服务端各阶段的计数和延迟直方图。记录只是几次relaxed原子加(和两次读时钟)，
+//导出(Prometheus文本格式)只在有人抓取时进行，没有抓取时几乎没有额外开销
+enum MetricStage
+{
+    kStageDeserialize,          //查询密文的load
+    kStageQueryNtt,             //查询密文转成NTT形式
+    kStageInnerProduct,         //get_sum叶子的内积(含逆NTT)
+    kStageRotation,             //get_sum的旋转、移动查询、回复对齐
+    kStagePacking,              //concat_response
+    kStageSerialize,            //回复密文的save
+    kStageSend,                 //交给连接发送
+    kStageCount
+};
+
+struct ServerMetrics
+{
+    LatencyHistogram stages[kStageCount];       //单位ns
+    std::atomic<uint64_t> queries{0};           //kQuery
+    std::atomic<uint64_t> range_queries{0};     //kRangeQuery
+    std::atomic<uint64_t> rejected{0};          //回复busy
+    std::atomic<uint64_t> errors{0};            //回复error或断开
+    std::atomic<uint64_t> bytes_received{0};    //查询payload
+    std::atomic<uint64_t> bytes_sent{0};        //回复payload
+    std::atomic<uint64_t> db_bytes{0};          //编码后的库(明文)
+    std::atomic<uint64_t> key_store_bytes{0};   //所有客户端的galois key
+
+    static const char* stage_name(int stage)
+    {
+        static const char* names[kStageCount] = {"deserialize", "query_ntt", "inner_product", "rotation", "packing", "serialize", "send"};
+        return names[stage];
+    }
+
+    //pool_bytes为SEAL内存池当前分配的字节数，由调用者在抓取时读取
+    std::string to_prometheus(uint64_t pool_bytes) const
+    {
+        //导出的桶边界(秒)，直方图内部是对数分桶，按边界累积
+        static const double bounds[] = {1e-6, 1e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+        std::stringstream ss;
+        ss << "# HELP fastpir_stage_seconds Time spent in each server stage.\n# TYPE fastpir_stage_seconds histogram\n";
+        for (int s = 0; s < kStageCount; s++)
+        {
+            for (double b : bounds)
+            {
+                ss << "fastpir_stage_seconds_bucket{stage=\"" << stage_name(s) << "\",le=\"" << b << "\"} " << stages[s].count_le((uint64_t)(b * 1e9)) << "\n";
+            }
+            ss << "fastpir_stage_seconds_bucket{stage=\"" << stage_name(s) << "\",le=\"+Inf\"} " << stages[s].count() << "\n";
+            ss << "fastpir_stage_seconds_sum{stage=\"" << stage_name(s) << "\"} " << stages[s].sum() / 1e9 << "\n";
+            ss << "fastpir_stage_seconds_count{stage=\"" << stage_name(s) << "\"} " << stages[s].count() << "\n";
+        }
+        counter(ss, "fastpir_queries_total", "Full queries received.", queries);
+        counter(ss, "fastpir_range_queries_total", "Byte-range queries received.", range_queries);
+        counter(ss, "fastpir_rejected_total", "Requests answered with busy.", rejected);
+        counter(ss, "fastpir_errors_total", "Malformed or failed requests.", errors);
+        counter(ss, "fastpir_received_bytes_total", "Query payload bytes received.", bytes_received);
+        counter(ss, "fastpir_sent_bytes_total", "Reply payload bytes sent.", bytes_sent);
+        gauge(ss, "fastpir_db_bytes", "Bytes of the encoded database.", db_bytes.load(std::memory_order_relaxed));
+        gauge(ss, "fastpir_key_store_bytes", "Bytes of galois keys held for clients.", key_store_bytes.load(std::memory_order_relaxed));
+        gauge(ss, "fastpir_seal_pool_bytes", "Bytes allocated by the SEAL memory pool.", pool_bytes);
+        return ss.str();
+    }
+
+private:
+    static void counter(std::stringstream& ss, const char* name, const char* help, const std::atomic<uint64_t>& value)
+    {
+        ss << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n" << name << " " << value.load(std::memory_order_relaxed) << "\n";
+    }
+    static void gauge(std::stringstream& ss, const char* name, const char* help, uint64_t value)
+    {
+        ss << "# HELP " << name << " " << help << "\n# TYPE " << name << " gauge\n" << name << " " << value << "\n";
+    }
+};
+
+//单个请求的各阶段耗时和运算次数。处理请求的线程用TraceScope设置当前请求，
+//StageTimer除了记到直方图外也累加到当前请求(packing包含其中的旋转，两者有重叠)
+struct RequestTrace
+{
+    uint64_t stage_ns[kStageCount] = {0};
+    uint64_t queue_ns = 0;                      //从收到请求到开始处理
+    uint64_t multiply_plain = 0;                //内积的项数
+    uint64_t rotations = 0;                     //key switch次数
+};
+
+inline RequestTrace*& current_trace()
+{
+    thread_local RequestTrace* trace = nullptr;
+    return trace;
+}
+
+class TraceScope
+{
+public:
+    TraceScope(RequestTrace* trace)
+        : prev(current_trace())
+    {
+        current_trace() = trace;
+    }
+    ~TraceScope()
+    {
+        current_trace() = prev;
+    }
+
+private:
+    RequestTrace* prev;
+};
+
+inline void trace_ops(uint64_t multiply_plain, uint64_t rotations)
+{
+    if (RequestTrace* trace = current_trace())
+    {
+        trace->multiply_plain += multiply_plain;
+        trace->rotations += rotations;
+    }
+}
+
+//作用域结束时把经过的时间记到一个阶段的直方图
+class StageTimer
+{
+public:
+    StageTimer(ServerMetrics& metrics, MetricStage stage)
+        : histogram(metrics.stages[stage]), stage(stage), start(std::chrono::steady_clock::now())
+    {
+    }
+    ~StageTimer()
+    {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        histogram.record(ns);
+        if (RequestTrace* trace = current_trace())
+            trace->stage_ns[stage] += ns;
+    }
+
+private:
+    LatencyHistogram& histogram;
+    MetricStage stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif
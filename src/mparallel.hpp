@@ -0,0 +1,64 @@
+#ifndef FASTPIR_PARALLEL_H
+#define FASTPIR_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//splitmix64，用于各种确定性的哈希(cuckoo hash的位置、分区、种子)
+inline uint64_t mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+//把[0, count)动态分给threads个线程执行(调用线程也算一个)，threads <= 0时使用hardware_concurrency，线程数不超过count。
+//func抛出异常后不再领取新的下标，等所有线程结束后把第一个异常重新抛给调用者
+inline void parallel_for(size_t count, int threads, const std::function<void (size_t)>& func)
+{
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t thread_count = std::min<size_t>(threads, count);
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]()
+    {
+        try
+        {
+            for (size_t i = next++; i < count; i = next++)
+            {
+                func(i);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+            next = count;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < thread_count; t++)
+    {
+        workers.emplace_back(worker);
+    }
+    if (thread_count > 0)
+        worker();
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef FASTPIR_PERF_H
+#define FASTPIR_PERF_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//定义FASTPIR_USDT时(需要systemtap的sys/sdt.h)在每个阶段前后放USDT探针fastpir:phase_begin/phase_end，
+//参数为PerfPhase，可以用bpftrace/perf probe按阶段采样；没有定义时为空
+#ifdef FASTPIR_USDT
+#include <sys/sdt.h>
+#define FASTPIR_PROBE(name, phase) DTRACE_PROBE1(fastpir, name, phase)
+#else
+#define FASTPIR_PROBE(name, phase)
+#endif
+
+//响应路径中按硬件计数器分析的阶段
+enum PerfPhase
+{
+    kPhaseQueryNtt,             //查询密文转成NTT形式
+    kPhaseInnerProduct,         //get_sum叶子的内积(含逆NTT)，即扫描库
+    kPhaseRotation,             //get_sum的旋转树
+    kPhaseCount
+};
+
+enum PerfCounter
+{
+    kCounterCycles,
+    kCounterInstructions,
+    kCounterLlcReferences,
+    kCounterLlcMisses,
+    kCounterCount
+};
+
+//当前线程上的一组计数器(cycles为leader，一次read读出全部)。
+//perf_event_paranoid不允许或不是Linux时available()为false，只统计时间
+class PerfCounterGroup
+{
+public:
+    PerfCounterGroup()
+    {
+        std::fill(fds, fds + kCounterCount, -1);
+#ifdef __linux__
+        const uint64_t configs[kCounterCount] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES};
+        for (int i = 0; i < kCounterCount; i++)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+            if (fds[i] < 0)
+            {
+                close_all();
+                return;
+            }
+        }
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    ~PerfCounterGroup()
+    {
+        close_all();
+    }
+    PerfCounterGroup(const PerfCounterGroup&) = delete;
+    PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+
+    bool available() const
+    {
+        return fds[0] >= 0;
+    }
+
+    //计数器被复用(PMU不够)时按enabled/running的比例放大
+    bool read(uint64_t values[kCounterCount]) const
+    {
+#ifdef __linux__
+        if (!available())
+            return false;
+        uint64_t buf[3 + kCounterCount];
+        if (::read(fds[0], buf, sizeof(buf)) != sizeof(buf) || buf[0] != kCounterCount)
+            return false;
+        double scale = buf[2] > 0 ? (double)buf[1] / buf[2] : 1.0;
+        for (int i = 0; i < kCounterCount; i++)
+        {
+            values[i] = (uint64_t)(buf[3 + i] * scale);
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    void close_all()
+    {
+#ifdef __linux__
+        for (int i = kCounterCount - 1; i >= 0; i--)
+        {
+            if (fds[i] >= 0)
+                close(fds[i]);
+            fds[i] = -1;
+        }
+#endif
+    }
+
+    int fds[kCounterCount];
+};
+
+struct PhaseProfile
+{
+    uint64_t calls = 0;
+    uint64_t ns = 0;
+    uint64_t counters[kCounterCount] = {0};
+};
+
+//按阶段累积的硬件计数器。Mserver::set_profiler之后，各阶段在执行它的线程上计数(每个线程第一次用时打开自己的计数器组)，
+//没有设置时只是一次空指针判断
+class PerfProfiler
+{
+public:
+    static const char* phase_name(int phase)
+    {
+        static const char* names[kPhaseCount] = {"query_ntt", "inner_product", "rotation"};
+        return names[phase];
+    }
+
+    static PerfCounterGroup& thread_group()
+    {
+        thread_local std::unique_ptr<PerfCounterGroup> group(new PerfCounterGroup);
+        return *group;
+    }
+
+    void record(PerfPhase phase, uint64_t ns, const uint64_t* delta)
+    {
+        calls[phase].fetch_add(1, std::memory_order_relaxed);
+        elapsed[phase].fetch_add(ns, std::memory_order_relaxed);
+        if (delta)
+        {
+            for (int i = 0; i < kCounterCount; i++)
+            {
+                counters[phase][i].fetch_add(delta[i], std::memory_order_relaxed);
+            }
+        }
+    }
+
+    PhaseProfile get(PerfPhase phase) const
+    {
+        PhaseProfile p;
+        p.calls = calls[phase].load(std::memory_order_relaxed);
+        p.ns = elapsed[phase].load(std::memory_order_relaxed);
+        for (int i = 0; i < kCounterCount; i++)
+        {
+            p.counters[i] = counters[phase][i].load(std::memory_order_relaxed);
+        }
+        return p;
+    }
+
+    void reset()
+    {
+        for (int p = 0; p < kPhaseCount; p++)
+        {
+            calls[p] = 0;
+            elapsed[p] = 0;
+            for (int i = 0; i < kCounterCount; i++)
+            {
+                counters[p][i] = 0;
+            }
+        }
+    }
+
+private:
+    std::atomic<uint64_t> calls[kPhaseCount] = {};
+    std::atomic<uint64_t> elapsed[kPhaseCount] = {};
+    std::atomic<uint64_t> counters[kPhaseCount][kCounterCount] = {};
+};
+
+//作用域内的计数器增量记到profiler的一个阶段，profiler为空时什么都不做
+class PerfScope
+{
+public:
+    PerfScope(PerfProfiler* profiler, PerfPhase phase)
+        : profiler(profiler), phase(phase), counted(false)
+    {
+        if (!profiler)
+            return;
+        FASTPIR_PROBE(phase_begin, (int)phase);
+        counted = PerfProfiler::thread_group().read(start_values);
+        start = std::chrono::steady_clock::now();
+    }
+    ~PerfScope()
+    {
+        if (!profiler)
+            return;
+        auto end = std::chrono::steady_clock::now();
+        uint64_t end_values[kCounterCount];
+        uint64_t delta[kCounterCount];
+        bool ok = counted && PerfProfiler::thread_group().read(end_values);
+        if (ok)
+        {
+            for (int i = 0; i < kCounterCount; i++)
+            {
+                delta[i] = end_values[i] > start_values[i] ? end_values[i] - start_values[i] : 0;
+            }
+        }
+        profiler->record(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), ok ? delta : nullptr);
+        FASTPIR_PROBE(phase_end, (int)phase);
+    }
+
+private:
+    PerfProfiler* profiler;
+    PerfPhase phase;
+    bool counted;
+    uint64_t start_values[kCounterCount];
+    std::chrono::steady_clock::time_point start;
+};
+
+//类似STREAM triad(a = b + s * c)的单线程内存带宽(GB/s，按每个元素读两次写一次计)，取repeat次中最好的一次。
+//get_sum在一个线程上扫描库，因此与单核的峰值比较
+inline double measure_stream_bandwidth(size_t bytes_per_array = 64ULL << 20, int repeat = 5)
+{
+    size_t n = bytes_per_array / sizeof(double);
+    std::vector<double> a(n, 0.0), b(n, 1.0), c(n, 2.0);
+    double best = 0;
+    for (int r = 0; r < std::max(repeat, 1); r++)
+    {
+        auto time_start = std::chrono::steady_clock::now();
+        double s = 3.0 + r;
+        for (size_t i = 0; i < n; i++)
+        {
+            a[i] = b[i] + s * c[i];
+        }
+        auto time_end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(time_end - time_start).count();
+        if (seconds > 0)
+            best = std::max(best, 3.0 * n * sizeof(double) / seconds / 1e9);
+    }
+    volatile double sink = a[n / 2];            //防止写被优化掉
+    (void)sink;
+    return best;
+}
+
+#endif
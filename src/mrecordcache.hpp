@@ -0,0 +1,200 @@
+#ifndef FASTPIR_RECORDCACHE_H
+#define FASTPIR_RECORDCACHE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//客户端的记录缓存，放在Mclient前面: 按index缓存解出的记录，超过ttl或服务端的库版本变化后失效，容量满时淘汰最久未用的。
+//命中只是一次哈希查找和一次拷贝，不经过PIR。
+//预取: 多查询请求的宽度保持不变，命中的位置换成预测下一步会访问的index(记下的后继，否则是index + 1)，
+//还不够时用随机的未缓存index补齐，服务端看到的请求与全部未命中时一样，无法区分哪些访问命中了缓存
+class RecordCache
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;            //过期的也算未命中
+        uint64_t prefetched = 0;        //为预取加进请求的index
+        uint64_t prefetch_hits = 0;     //预取进来后至少命中过一次的记录
+    };
+
+    //capacity = 0表示不限制条数
+    RecordCache(size_t capacity, std::chrono::milliseconds ttl)
+        : capacity(capacity), ttl(ttl), db_version(0), has_version(false), rng(std::random_device{}())
+    {
+    }
+
+    //收到服务端参数时调用，库版本变了则清空缓存和学到的后继
+    void set_version(uint64_t version)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (has_version && version == db_version)
+            return;
+        entries.clear();
+        lru.clear();
+        successor.clear();
+        has_last = false;
+        db_version = version;
+        has_version = true;
+    }
+
+    //命中且未过期时拷贝到record。每次查找都记为一次访问，用来学习后继
+    bool get(uint32_t index, std::vector<unsigned char>& record)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        learn(index);
+        auto it = lookup(index);
+        if (it == entries.end())
+        {
+            stats.misses++;
+            return false;
+        }
+        lru.splice(lru.begin(), lru, it->second.lru_pos);
+        if (it->second.prefetched)
+        {
+            stats.prefetch_hits++;
+            it->second.prefetched = false;
+        }
+        stats.hits++;
+        record = it->second.record;
+        return true;
+    }
+
+    //prefetched为true表示是预取进来的，不是本次要访问的
+    void put(uint32_t index, const unsigned char* data, size_t size, bool prefetched = false)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(index);
+        if (it != entries.end())
+        {
+            lru.splice(lru.begin(), lru, it->second.lru_pos);
+        }
+        else
+        {
+            if (capacity > 0 && entries.size() >= capacity)
+            {
+                entries.erase(lru.back());
+                lru.pop_back();
+            }
+            lru.push_front(index);
+            it = entries.emplace(index, Entry()).first;
+            it->second.lru_pos = lru.begin();
+        }
+        it->second.record.assign(data, data + size);
+        it->second.expire = Clock::now() + ttl;
+        it->second.prefetched = prefetched;
+    }
+
+    //把未命中的index扩成width个互不相同的index(未命中的在前)，misses为空时就是全部命中时发的掩护请求。
+    //prefetch为false时用随机的未缓存index补齐，只保持请求宽度；宽度不够放下全部未命中时返回空
+    std::vector<uint32_t> fill_request(const std::vector<uint32_t>& misses, size_t width, uint32_t num_obj, bool prefetch)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<uint32_t> request;
+        std::unordered_set<uint32_t> used;
+        for (auto index : misses)
+        {
+            if (used.insert(index).second)
+                request.push_back(index);
+        }
+        if (request.size() > width)
+            return std::vector<uint32_t>();
+        size_t wanted = request.size();
+        auto add = [&](uint32_t index)
+        {
+            if (request.size() < width && index < num_obj && lookup(index) == entries.end() && used.insert(index).second)
+                request.push_back(index);
+        };
+        if (prefetch)
+        {
+            //先用本次请求里各index的后继，再用上一次访问的下一个
+            for (size_t i = 0; i < request.size() && request.size() < width; i++)
+            {
+                auto next = successor.find(request[i]);
+                add(next != successor.end() ? next->second : request[i] + 1);
+            }
+            if (request.size() < width && has_last)
+                add(last + 1);
+            stats.prefetched += request.size() - wanted;
+        }
+        //库几乎全部在缓存里时随机可能找不到，尝试次数有上限，剩下的位置用已缓存的index
+        for (size_t tries = 0; request.size() < width && tries < 64 * width; tries++)
+        {
+            add(rng() % num_obj);
+        }
+        for (uint32_t index = 0; request.size() < width && index < num_obj; index++)
+        {
+            if (used.insert(index).second)
+                request.push_back(index);
+        }
+        return request;
+    }
+
+    Stats get_stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+private:
+    struct Entry
+    {
+        std::vector<unsigned char> record;
+        Clock::time_point expire;
+        std::list<uint32_t>::iterator lru_pos;
+        bool prefetched = false;
+    };
+
+    //过期的在查到时删除
+    std::unordered_map<uint32_t, Entry>::iterator lookup(uint32_t index)
+    {
+        auto it = entries.find(index);
+        if (it != entries.end() && it->second.expire <= Clock::now())
+        {
+            lru.erase(it->second.lru_pos);
+            entries.erase(it);
+            return entries.end();
+        }
+        return it;
+    }
+
+    //只记上一次访问到这一次的转移，后继表与缓存条数同样受capacity限制
+    void learn(uint32_t index)
+    {
+        if (has_last && last != index && (capacity == 0 || successor.size() < capacity || successor.count(last)))
+            successor[last] = index;
+        last = index;
+        has_last = true;
+    }
+
+    size_t capacity;
+    std::chrono::milliseconds ttl;
+    uint64_t db_version;
+    bool has_version;
+    std::unordered_map<uint32_t, Entry> entries;
+    std::list<uint32_t> lru;                            //最近使用的在前
+    std::unordered_map<uint32_t, uint32_t> successor;
+    uint32_t last = 0;                                  //上一次访问的index
+    bool has_last = false;
+    std::mt19937 rng;
+    Stats stats;
+    std::mutex mutex;
+};
+
+#endif
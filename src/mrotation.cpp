@@ -0,0 +1,334 @@
+#include "mrotation.hpp"
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include "seal/util/galois.h"
+#include "seal/util/ntt.h"
+#include "seal/util/polyarithsmallmod.h"
+#include "seal/util/uintarithsmallmod.h"
+#include "seal/util/rns.h"
+
+HoistedRotator::HoistedRotator(const seal::SEALContext& context, const seal::Ciphertext& source)
+    : context(&context), source(source)
+{
+    if (source.size() != 2 || source.is_ntt_form())
+    {
+        throw std::invalid_argument("HoistedRotator expects a size 2 ciphertext in coefficient form");
+    }
+    auto &key_context_data = *context.key_context_data();
+    auto &key_modulus = key_context_data.parms().coeff_modulus();
+    auto key_ntt_tables = key_context_data.small_ntt_tables();
+    size_t key_modulus_size = key_modulus.size();
+
+    coeff_count = source.poly_modulus_degree();
+    decomp_modulus_size = source.coeff_modulus_size();
+    rns_modulus_size = decomp_modulus_size + 1;
+    digits.resize(rns_modulus_size * decomp_modulus_size * coeff_count);
+
+    //与SEAL的switch_key_inplace相同的分解: c1 mod q_j 转到每个key模数下再做NTT
+    const uint64_t *c1 = source.data(1);
+    for (size_t i = 0; i < rns_modulus_size; i++)
+    {
+        size_t key_index = (i == decomp_modulus_size ? key_modulus_size - 1 : i);
+        for (size_t j = 0; j < decomp_modulus_size; j++)
+        {
+            uint64_t *digit = digits.data() + (i * decomp_modulus_size + j) * coeff_count;
+            if (key_modulus[j].value() <= key_modulus[key_index].value())
+            {
+                std::copy(c1 + j * coeff_count, c1 + (j + 1) * coeff_count, digit);
+            }
+            else
+            {
+                seal::util::modulo_poly_coeffs(c1 + j * coeff_count, coeff_count, key_modulus[key_index], digit);
+            }
+            seal::util::ntt_negacyclic_harvey_lazy(digit, key_ntt_tables[key_index]);
+        }
+    }
+}
+
+void HoistedRotator::rotate(int step, const seal::GaloisKeys& gal_keys, seal::Ciphertext& destination) const
+{
+    auto &context_data = *context->get_context_data(source.parms_id());
+    auto &coeff_modulus = context_data.parms().coeff_modulus();
+    auto &key_context_data = *context->key_context_data();
+    auto &key_modulus = key_context_data.parms().coeff_modulus();
+    auto key_ntt_tables = key_context_data.small_ntt_tables();
+    auto galois_tool = key_context_data.galois_tool();
+    size_t key_modulus_size = key_modulus.size();
+
+    uint32_t galois_elt = galois_tool->get_elt_from_step(step);
+    if (!gal_keys.has_key(galois_elt))
+    {
+        throw std::invalid_argument("Galois key not present");
+    }
+    auto &key_vector = gal_keys.data()[seal::GaloisKeys::get_index(galois_elt)];
+
+    //(σ(c0), 0)，c1部分由key switch得到
+    destination = source;
+    for (size_t j = 0; j < decomp_modulus_size; j++)
+    {
+        galois_tool->apply_galois(source.data(0) + j * coeff_count, galois_elt, coeff_modulus[j], destination.data(0) + j * coeff_count);
+    }
+    std::fill(destination.data(1), destination.data(1) + decomp_modulus_size * coeff_count, 0);
+
+    //σ与RNS分解可交换，分解后的每一位在NTT域直接置换，与key相乘并累加
+    std::vector<uint64_t> t_poly_prod(2 * rns_modulus_size * coeff_count);
+    std::vector<uint64_t> t_permuted(coeff_count);
+    std::vector<unsigned __int128> accumulator(2 * coeff_count);
+    for (size_t i = 0; i < rns_modulus_size; i++)
+    {
+        size_t key_index = (i == decomp_modulus_size ? key_modulus_size - 1 : i);
+        const seal::Modulus &modulus = key_modulus[key_index];
+        std::fill(accumulator.begin(), accumulator.end(), 0);
+        for (size_t j = 0; j < decomp_modulus_size; j++)
+        {
+            const uint64_t *digit = digits.data() + (i * decomp_modulus_size + j) * coeff_count;
+            galois_tool->apply_galois_ntt(digit, galois_elt, t_permuted.data());
+            for (size_t k = 0; k < 2; k++)
+            {
+                const uint64_t *key = key_vector[j].data().data(k) + key_index * coeff_count;
+                unsigned __int128 *acc = accumulator.data() + k * coeff_count;
+                for (size_t n = 0; n < coeff_count; n++)
+                {
+                    acc[n] += (unsigned __int128)t_permuted[n] * key[n];        //< 4q * q < 2^122，最多累加32项
+                }
+            }
+            if ((j + 1) % 32 == 0)
+            {
+                for (auto &a : accumulator)
+                {
+                    uint64_t words[2] = { (uint64_t)a, (uint64_t)(a >> 64) };
+                    a = seal::util::barrett_reduce_128(words, modulus);
+                }
+            }
+        }
+        for (size_t k = 0; k < 2; k++)
+        {
+            uint64_t *prod = t_poly_prod.data() + (k * rns_modulus_size + i) * coeff_count;
+            const unsigned __int128 *acc = accumulator.data() + k * coeff_count;
+            for (size_t n = 0; n < coeff_count; n++)
+            {
+                uint64_t words[2] = { (uint64_t)acc[n], (uint64_t)(acc[n] >> 64) };
+                prod[n] = seal::util::barrett_reduce_128(words, modulus);
+            }
+        }
+    }
+
+    //除以特殊模数并取整(mod down)，与SEAL中BFV的处理相同
+    const seal::Modulus &special = key_modulus[key_modulus_size - 1];
+    uint64_t qk = special.value();
+    uint64_t qk_half = qk >> 1;
+    auto modswitch_factors = key_context_data.rns_tool()->inv_q_last_mod_q();
+    std::vector<uint64_t> t_ntt(coeff_count);
+    for (size_t k = 0; k < 2; k++)
+    {
+        uint64_t *t_last = t_poly_prod.data() + (k * rns_modulus_size + decomp_modulus_size) * coeff_count;
+        seal::util::inverse_ntt_negacyclic_harvey_lazy(t_last, key_ntt_tables[key_modulus_size - 1]);
+        for (size_t n = 0; n < coeff_count; n++)
+        {
+            t_last[n] = seal::util::barrett_reduce_64(t_last[n] + qk_half, special);
+        }
+        for (size_t j = 0; j < decomp_modulus_size; j++)
+        {
+            const seal::Modulus &qi_mod = key_modulus[j];
+            uint64_t qi = qi_mod.value();
+            if (qk > qi)
+            {
+                seal::util::modulo_poly_coeffs(t_last, coeff_count, qi_mod, t_ntt.data());
+            }
+            else
+            {
+                std::copy(t_last, t_last + coeff_count, t_ntt.data());
+            }
+            uint64_t fix = qi - seal::util::barrett_reduce_64(qk_half, qi_mod);
+            uint64_t qi_lazy = qi << 1;
+            uint64_t *prod = t_poly_prod.data() + (k * rns_modulus_size + j) * coeff_count;
+            seal::util::inverse_ntt_negacyclic_harvey_lazy(prod, key_ntt_tables[j]);
+            for (size_t n = 0; n < coeff_count; n++)
+            {
+                prod[n] = prod[n] + (qi_lazy - (t_ntt[n] + fix));
+            }
+            seal::util::multiply_poly_scalar_coeffmod(prod, coeff_count, modswitch_factors[j], qi_mod, prod);
+            uint64_t *dest = destination.data(k) + j * coeff_count;
+            seal::util::add_poly_coeffmod(prod, dest, coeff_count, qi_mod, dest);
+        }
+    }
+}
+
+RotationPlanner::RotationPlanner(size_t row_size, std::vector<int> steps)
+    : row_size(row_size), key_steps(std::move(steps)), via(row_size, 0), dist(row_size, std::numeric_limits<uint32_t>::max())
+{
+    //大的step优先，同样的旋转次数下plan的前几步更容易相同
+    std::sort(key_steps.begin(), key_steps.end(), [](int a, int b) {
+        return std::abs(a) != std::abs(b) ? std::abs(a) > std::abs(b) : a > b;
+    });
+    key_steps.erase(std::unique(key_steps.begin(), key_steps.end()), key_steps.end());
+
+    std::deque<size_t> queue;
+    dist[0] = 0;
+    queue.push_back(0);
+    while (!queue.empty())
+    {
+        size_t t = queue.front();
+        queue.pop_front();
+        for (int s : key_steps)
+        {
+            size_t next = (t + normalize(s)) % row_size;
+            if (dist[next] == std::numeric_limits<uint32_t>::max())
+            {
+                dist[next] = dist[t] + 1;
+                via[next] = s;
+                queue.push_back(next);
+            }
+        }
+    }
+}
+
+std::vector<int> RotationPlanner::available_steps(const seal::SEALContext& context, const seal::GaloisKeys& gal_keys)
+{
+    auto &key_context_data = *context.key_context_data();
+    auto galois_tool = key_context_data.galois_tool();
+    int row_size = static_cast<int>(key_context_data.parms().poly_modulus_degree() / 2);
+    std::vector<int> steps;
+    for (int s = 1; s < row_size; s++)
+    {
+        if (gal_keys.has_key(galois_tool->get_elt_from_step(s)))
+        {
+            steps.push_back(s <= row_size / 2 ? s : s - row_size);
+        }
+    }
+    return steps;
+}
+
+std::vector<int> RotationPlanner::naf(int step, size_t row_size)
+{
+    int rs = static_cast<int>(row_size);
+    step %= rs;
+    if (step > rs / 2)
+        step -= rs;
+    if (step < -rs / 2)
+        step += rs;
+    std::vector<int> plan;
+    int sign = step < 0 ? -1 : 1;
+    int k = std::abs(step);
+    for (int bit = 1; k != 0; bit <<= 1, k >>= 1)
+    {
+        if (k & 1)
+        {
+            int z = 2 - (k & 3);            //k mod 4 = 1 -> +1, k mod 4 = 3 -> -1
+            k -= z;
+            if (bit != rs)
+                plan.push_back(sign * z * bit);
+        }
+    }
+    return plan;
+}
+
+size_t RotationPlanner::normalize(int step) const
+{
+    long r = static_cast<long>(row_size);
+    return static_cast<size_t>(((step % r) + r) % r);
+}
+
+std::vector<int> RotationPlanner::plan(int step) const
+{
+    size_t t = normalize(step);
+    if (dist[t] == std::numeric_limits<uint32_t>::max())
+    {
+        throw std::invalid_argument("rotation step not reachable with available galois keys");
+    }
+    std::vector<int> plan(dist[t]);
+    for (size_t i = dist[t]; i > 0; i--)
+    {
+        plan[i - 1] = via[t];
+        t = (t + row_size - normalize(via[t])) % row_size;
+    }
+    return plan;
+}
+
+size_t RotationPlanner::rotations(int step) const
+{
+    return dist[normalize(step)];
+}
+
+size_t RotationPlanner::max_rotations() const
+{
+    return *std::max_element(dist.begin(), dist.end());
+}
+
+double RotationPlanner::average_rotations() const
+{
+    double sum = 0;
+    for (auto d : dist)
+    {
+        sum += d;
+    }
+    return sum / row_size;
+}
+
+namespace
+{
+struct PlanNode
+{
+    std::map<int, size_t> children;
+    std::vector<size_t> plans;              //在该节点结束的plan
+};
+
+void rotate_subtree(const seal::SEALContext& context, const seal::Evaluator& evaluator, const std::vector<PlanNode>& nodes, size_t node,
+                    const seal::Ciphertext& ciphertext, const seal::GaloisKeys& gal_keys, std::vector<seal::Ciphertext>& results)
+{
+    for (auto p : nodes[node].plans)
+    {
+        results[p] = ciphertext;
+    }
+    if (nodes[node].children.empty())
+    {
+        return;
+    }
+    if (nodes[node].children.size() == 1)
+    {
+        auto child = nodes[node].children.begin();
+        seal::Ciphertext rotated;
+        evaluator.rotate_rows(ciphertext, child->first, gal_keys, rotated);
+        rotate_subtree(context, evaluator, nodes, child->second, rotated, gal_keys, results);
+        return;
+    }
+    HoistedRotator rotator(context, ciphertext);
+    for (auto &child : nodes[node].children)
+    {
+        seal::Ciphertext rotated;
+        rotator.rotate(child.first, gal_keys, rotated);
+        rotate_subtree(context, evaluator, nodes, child.second, rotated, gal_keys, results);
+    }
+}
+}
+
+std::vector<seal::Ciphertext> rotate_many(const seal::SEALContext& context, const seal::Evaluator& evaluator, const seal::Ciphertext& source,
+                                          const std::vector<std::vector<int>>& plans, const seal::GaloisKeys& gal_keys, size_t* key_switch_count)
+{
+    std::vector<PlanNode> nodes(1);
+    for (size_t p = 0; p < plans.size(); p++)
+    {
+        size_t node = 0;
+        for (int step : plans[p])
+        {
+            auto it = nodes[node].children.find(step);
+            if (it == nodes[node].children.end())
+            {
+                nodes.emplace_back();
+                it = nodes[node].children.emplace(step, nodes.size() - 1).first;
+            }
+            node = it->second;
+        }
+        nodes[node].plans.push_back(p);
+    }
+    if (key_switch_count)
+    {
+        *key_switch_count += nodes.size() - 1;              //每条边一次key switch
+    }
+    std::vector<seal::Ciphertext> results(plans.size());
+    rotate_subtree(context, evaluator, nodes, 0, source, gal_keys, results);
+    return results;
+}
@@ -0,0 +1,63 @@
+#ifndef FASTPIR_ROTATION_H
+#define FASTPIR_ROTATION_H
+
+#include <vector>
+#include <cstdint>
+#include "seal/seal.h"
+
+//Hoisted rotation: 同一个密文需要旋转多个不同的step时，c1的gadget分解(RNS分解+NTT)只做一次，
+//之后每个step只需要在NTT域做一次置换、与key相乘、mod down，省掉了每次key switch中的分解和NTT
+class HoistedRotator
+{
+public:
+    //source必须是非NTT形式的BFV密文(size = 2)
+    HoistedRotator(const seal::SEALContext& context, const seal::Ciphertext& source);
+
+    //destination = rotate_rows(source, step)，结果与evaluator->rotate_rows一致(解密后)
+    void rotate(int step, const seal::GaloisKeys& gal_keys, seal::Ciphertext& destination) const;
+
+private:
+    const seal::SEALContext* context;
+    seal::Ciphertext source;
+    std::vector<uint64_t> digits;           //[rns_modulus_size][decomp_modulus_size][N]，NTT形式(lazy, [0, 4q))
+    size_t coeff_count;
+    size_t decomp_modulus_size;
+    size_t rns_modulus_size;
+};
+
+//旋转分解: 行旋转是长度row_size的循环移位，把任意step分解成可用key的step之和。
+//在Z_row_size上以可用step为边做BFS，得到每个step旋转次数最少的分解；
+//plan(t) = plan(t - via[t]) + via[t]，所有plan构成一棵最短路树，rotate_many可以最大程度共享前缀
+class RotationPlanner
+{
+public:
+    RotationPlanner(size_t row_size, std::vector<int> steps);
+
+    //检测GaloisKeys中有哪些行旋转step(每个galois元素取|step| <= row_size/2的表示)
+    static std::vector<int> available_steps(const seal::SEALContext& context, const seal::GaloisKeys& gal_keys);
+
+    //只有±2^i的key时的NAF(non-adjacent form)分解，没有相邻的非零位
+    static std::vector<int> naf(int step, size_t row_size);
+
+    //旋转次数最少的分解，step不可达时抛出std::invalid_argument
+    std::vector<int> plan(int step) const;
+
+    size_t rotations(int step) const;
+    size_t max_rotations() const;
+    double average_rotations() const;
+    const std::vector<int>& steps() const {return key_steps;}
+
+private:
+    size_t row_size;
+    std::vector<int> key_steps;
+    std::vector<int> via;                   //via[t]: 最短路上到达t的最后一个step，via[0]和不可达为0
+    std::vector<uint32_t> dist;             //dist[t]: 旋转次数，不可达为UINT32_MAX
+    size_t normalize(int step) const;
+};
+
+//一个密文按多个plan(每个plan是一串旋转step)旋转，step前缀相同的plan共享中间结果，
+//有多个分支的节点用HoistedRotator，返回值与plans一一对应
+std::vector<seal::Ciphertext> rotate_many(const seal::SEALContext& context, const seal::Evaluator& evaluator, const seal::Ciphertext& source,
+                                          const std::vector<std::vector<int>>& plans, const seal::GaloisKeys& gal_keys, size_t* key_switch_count = nullptr);
+
+#endif
@@ -8,20 +8,50 @@ Mserver::Mserver(FastPIRParams params)
 
     evaluator = new seal::Evaluator(*context);
     batch_encoder = new seal::BatchEncoder(*context);
+    coeff_modulus = context->first_context_data()->parms().coeff_modulus();
+    inner_product = kernels::select_inner_product(N, coeff_modulus.size());
 
     this->num_obj = params.get_num_obj();
     this->obj_size = params.get_obj_size();
+    pack_factor = params.get_pack_factor();
+    record_num = params.get_record_num();
+    record_size = params.get_record_size();
 
     num_query_ciphertext = params.get_num_query_ciphertext();
     num_columns_per_obj = params.get_num_columns_per_obj();
     db_rows = params.get_db_rows();
     db_preprocessed = false;
     reply_ciphertext_num = params.get_reply_ciphertext_num();
+
+    std::vector<int> steps;
+    for (int i = 1; i < (N / 2); i *= 2)
+    {
+        steps.push_back(-i);
+        steps.push_back(i);
+    }
+    default_planner = std::make_shared<const RotationPlanner>(N / 2, steps);
 }
 
 void Mserver::set_client_galois_keys(uint32_t client_id, seal::GaloisKeys gal_keys)
 {
-    client_galois_keys[client_id] = gal_keys;
+    auto keys = std::make_shared<const seal::GaloisKeys>(std::move(gal_keys));
+    //按实际上传的key生成planner，客户端可以上传额外的旋转key来减少旋转次数
+    auto planner = std::make_shared<const RotationPlanner>(N / 2, RotationPlanner::available_steps(*context, *keys));
+    size_t bytes = keys->save_size(seal::compr_mode_type::none);
+    std::lock_guard<std::mutex> lock(key_mutex);
+    client_galois_keys[client_id] = keys;
+    client_planners[client_id] = planner;
+    metrics.key_store_bytes += bytes - client_key_bytes[client_id];
+    client_key_bytes[client_id] = bytes;
+}
+
+void Mserver::remove_client_galois_keys(uint32_t client_id)
+{
+    std::lock_guard<std::mutex> lock(key_mutex);
+    client_galois_keys.erase(client_id);
+    client_planners.erase(client_id);
+    metrics.key_store_bytes -= client_key_bytes[client_id];
+    client_key_bytes.erase(client_id);
 }
 
 void Mserver::encode_db(std::vector<std::vector<uint64_t>> db)
@@ -35,6 +65,18 @@ void Mserver::encode_db(std::vector<std::vector<uint64_t>> db)
 
 void Mserver::set_db(std::vector<std::vector<unsigned char> > db)
 {
+    if(pack_factor > 1)
+    {
+        //小记录打包: 第i条记录放在第i/pack_factor条消息的第i%pack_factor个位置，不满的部分填0
+        assert(db.size() == record_num);
+        std::vector<std::vector<unsigned char>> packed(num_obj, std::vector<unsigned char>(obj_size, 0));
+        for(size_t i = 0; i < db.size(); ++i)
+        {
+            assert(db[i].size() == record_size);
+            std::copy(db[i].begin(), db[i].end(), packed[i / pack_factor].begin() + (i % pack_factor) * record_size);
+        }
+        db = std::move(packed);
+    }
     assert(db.size() == num_obj);
     std::vector<std::vector<uint64_t> > extended_db(db_rows);       //明文的总数
     for(int i = 0; i < db_rows;i++) {
@@ -75,14 +117,27 @@ void Mserver::preprocess_db()
         evaluator->transform_to_ntt_inplace(encoded_db[i], pid);            //NTT方法，有利于多项式计算
     }
     db_preprocessed = true;
+    uint64_t bytes = 0;
+    for (auto& pt : encoded_db)
+    {
+        bytes += pt.coeff_count() * sizeof(uint64_t);
+    }
+    metrics.db_bytes = bytes;
 }
 
 PIRReply Mserver::get_response(uint32_t client_id, PIRQuery query)
+{
+    auto gal_keys = get_key(client_id);
+    if (gal_keys == nullptr)
+        throw std::invalid_argument("galois keys of client " + std::to_string(client_id) + " not set");
+    return get_response(std::move(query), *gal_keys);
+}
+
+PIRReply Mserver::get_response(PIRQuery query, const seal::GaloisKeys& gal_keys)
 {
     if (query.size() != num_query_ciphertext)
     {
-        std::cout << "query size doesn't match" <<std::endl;
-        exit(1);
+        throw std::invalid_argument("query size doesn't match");
     }
     seal::Ciphertext result;
     preprocess_query(query);
@@ -91,7 +146,6 @@ PIRReply Mserver::get_response(uint32_t client_id, PIRQuery query)
         preprocess_db();
     }
 
-    seal::GaloisKeys gal_keys = client_galois_keys[client_id];
     PIRReply response(reply_ciphertext_num);
     
     for(size_t i = 0; i < reply_ciphertext_num; ++i)
@@ -103,80 +157,183 @@ PIRReply Mserver::get_response(uint32_t client_id, PIRQuery query)
     return response;
 }
 
-PIRReply Mserver::get_multi_response(uint32_t client_id, const Query& query)
+PIRReply Mserver::get_range_response(uint32_t client_id, PIRQuery query, size_t offset, size_t length)
+{
+    auto gal_keys = get_key(client_id);
+    if (gal_keys == nullptr)
+        throw std::invalid_argument("galois keys of client " + std::to_string(client_id) + " not set");
+    return get_range_response(std::move(query), *gal_keys, offset, length);
+}
+
+PIRReply Mserver::get_range_response(PIRQuery query, const seal::GaloisKeys& gal_keys, size_t offset, size_t length)
+{
+    if (query.size() != num_query_ciphertext)
+    {
+        throw std::invalid_argument("query size doesn't match");
+    }
+    if (length == 0 || offset + length > obj_size)
+    {
+        throw std::invalid_argument("byte range [" + std::to_string(offset) + ", " + std::to_string(offset + length) + ") out of object");
+    }
+    preprocess_query(query);
+    if (!db_preprocessed)
+    {
+        preprocess_db();
+    }
+
+    auto columns = FastPIRParams::column_range(obj_size, offset, length, plain_bit_count - 1);
+    uint32_t row_size = N / 2;
+    PIRReply response;
+    for (uint32_t start = columns.first; start <= columns.second; start += row_size)
+    {
+        response.push_back(get_sum(query, gal_keys, start, std::min(start + row_size - 1, columns.second)));
+    }
+    return response;
+}
+
+PIRReply Mserver::get_multi_response(uint32_t client_id, const Query& query, ResponseStats* stats)
+{
+    auto gal_keys = get_key(client_id);
+    if (gal_keys == nullptr)
+        throw std::invalid_argument("galois keys of client " + std::to_string(client_id) + " not set");
+    auto planner = get_planner(client_id);
+    return get_multi_response(query, *gal_keys, *planner, stats);
+}
+
+PIRReply Mserver::get_multi_response(const Query& query, const seal::GaloisKeys& gal_keys, const RotationPlanner& planner, ResponseStats* stats)
 {
     PIRQuery tempQuery = query.query;
+    if(stats)
+    {
+        //每个回复密文对应的列数为count时，get_sum需要count - 1次旋转
+        stats->sum_rotations += (query.coeffOffset.size() + 1) * (num_columns_per_obj / 2 - reply_ciphertext_num);
+    }
     if(query.coeffOffset.empty())
     {
-        return get_response(client_id, tempQuery);
+        return get_response(tempQuery, gal_keys);
     }
     else
     {
         std::vector<PIRReply> replys;
-        replys.push_back(get_response(client_id, tempQuery));
-        for(int i = 0; i < query.coeffOffset.size(); ++i)
+        replys.push_back(get_response(tempQuery, gal_keys));
+        std::vector<PIRQuery> movedQuerys = move_queries(query.query, query.indexOffset, query.coeffOffset, gal_keys, &planner, stats);
+        for(auto& q : movedQuerys)
         {
-            move_query(tempQuery, query.indexOffset[i], query.coeffOffset[i], client_galois_keys[client_id]);
-            replys.push_back(get_response(client_id, tempQuery));
-            tempQuery = query.query;
+            replys.push_back(get_response(std::move(q), gal_keys));
         }
-        return concat_response(client_id, replys, query.coeffOffset);
+        return concat_response(replys, query.coeffOffset, gal_keys, planner, stats);
     }
 }
 
-PIRReply Mserver::concat_response(uint32_t client_id, const std::vector<PIRReply>& replys, const std::vector<int>& coeffOffsets)
+PIRReply Mserver::concat_response(uint32_t client_id, const std::vector<PIRReply>& replys, const std::vector<int>& coeffOffsets, ResponseStats* stats)
 {
-    PIRReply reply;
-    if(reply_ciphertext_num == 1 && num_columns_per_obj <= N / 2)
+    auto gal_keys = get_key(client_id);
+    if (gal_keys == nullptr)
+        throw std::invalid_argument("galois keys of client " + std::to_string(client_id) + " not set");
+    auto planner = get_planner(client_id);
+    return concat_response(replys, coeffOffsets, *gal_keys, *planner, stats);
+}
+
+PIRReply Mserver::concat_response(const std::vector<PIRReply>& replys, const std::vector<int>& coeffOffsets, const seal::GaloisKeys& gal_keys, const RotationPlanner& planner,
+                                  ResponseStats* stats)
+{
+    StageTimer timer(metrics, kStagePacking);           //包括其中对齐用的旋转(也记在rotation里)
+    size_t rotations = 0;
+    ReplyPacking packing(replys.size(), num_columns_per_obj, N / 2);
+    PIRReply reply(packing.cipher_count());
+    std::vector<bool> filled(reply.size(), false);
+    for(size_t m = 0; m < replys.size(); ++m)
     {
-        int moveCount = get_next_power_of_two(num_columns_per_obj / 2);         //旋转step必须是2的幂(可以旋转多次，但这样增加时间消耗)
-        int msgCountPerCipher = N / 2 / moveCount;
-        for(int i = 0; i < std::ceil((double)replys.size() / msgCountPerCipher); ++i)       //需要的总密文数量
+        for(size_t r = 0; r < packing.full_segments; ++r)
         {
-            seal::Ciphertext temp = replys[i * msgCountPerCipher][0];
-            if(i != 0)
-            {
-                rotateCipher(temp, -coeffOffsets[i * msgCountPerCipher - 1], client_galois_keys[client_id]);
-            }
-            for(int j = 1; j < msgCountPerCipher && i * msgCountPerCipher + j < replys.size(); ++j)
-            {
-                seal::Ciphertext mvCiphertext = replys[i * msgCountPerCipher + j][0];
-                //每个密文必须要先旋转，因为第一个消息的位置不是固定的
-                rotateCipher(mvCiphertext, -coeffOffsets[i * msgCountPerCipher + j - 1], client_galois_keys[client_id]);    //可能有问题
-           
-                evaluator->rotate_rows_inplace(mvCiphertext, -moveCount * j, client_galois_keys[client_id]);
-                
-                evaluator->add_inplace(temp, mvCiphertext);
-            }
-            reply.push_back(temp);
+            reply[packing.full_cipher(m, r)] = replys[m][r];            //整段不需要移动，客户端按各自index的slot解码
         }
-    }
-    
-    //todo：目前其它情况没有作任何处理，直接把每一个response全部返回了
-    else
-    {
-        for(auto& i : replys)
+        if(packing.partial_length == 0)
+            continue;
+        //回复m的数据从slot s_m开始，s_m - s0 = -coeffOffsets[m - 1]，对齐到s0之后再错开partial_offset，两次旋转合并成一次
+        seal::Ciphertext mvCiphertext = replys[m][packing.full_segments];
+        int step = (m == 0 ? 0 : -coeffOffsets[m - 1]) - (int)packing.partial_offset(m);
+        rotations += rotateCipher(mvCiphertext, step, gal_keys, planner);
+        size_t o = packing.partial_cipher(m);
+        if(!filled[o])
         {
-            for(auto& j : i)
-            {
-                reply.push_back(j);
-            }
+            reply[o] = std::move(mvCiphertext);
+            filled[o] = true;
+        }
+        else
+        {
+            evaluator->add_inplace(reply[o], mvCiphertext);
         }
     }
-
+    if(stats)
+    {
+        stats->concat_rotations += rotations;
+    }
     return reply;
 }
 
-void Mserver::move_query(PIRQuery& query, int indexOffset, int coeffOffset, const seal::GaloisKeys& gal_key)
+void Mserver::move_query(PIRQuery& query, int indexOffset, int coeffOffset, const seal::GaloisKeys& gal_key, const RotationPlanner* planner)
 {
-    assert(indexOffset < (int)num_query_ciphertext);
-    assert(coeffOffset < POLY_MODULUS_DEGREE / 2);
+    check_offsets(indexOffset, coeffOffset);
     //coeffmove
     for(auto& i : query)
     {
         //每个查询向量都有一次旋转，即带来O(n)的时间复杂度
-        rotateCipher(i, coeffOffset, gal_key);
+        rotateCipher(i, coeffOffset, gal_key, planner ? *planner : *default_planner);
     } 
+    shift_query_index(query, indexOffset);
+}
+
+std::vector<PIRQuery> Mserver::move_queries(const PIRQuery& query, const std::vector<int>& indexOffsets, const std::vector<int>& coeffOffsets, const seal::GaloisKeys& gal_key,
+                                            const RotationPlanner* planner, ResponseStats* stats)
+{
+    if(indexOffsets.size() != coeffOffsets.size())
+        throw std::invalid_argument("index and coeff offset counts don't match");
+    std::vector<std::vector<int>> plans(coeffOffsets.size());
+    for(size_t i = 0; i < coeffOffsets.size(); ++i)
+    {
+        check_offsets(indexOffsets[i], coeffOffsets[i]);
+        plans[i] = get_rotation_plan(coeffOffsets[i], planner);
+        if(stats)
+        {
+            stats->planned_rotations += plans[i].size() * query.size();
+        }
+    }
+    std::vector<PIRQuery> movedQuerys(coeffOffsets.size(), PIRQuery(query.size()));
+    StageTimer timer(metrics, kStageRotation);
+    size_t key_switches = 0;
+    for(size_t c = 0; c < query.size(); ++c)
+    {
+        //同一个查询密文的所有偏移一起旋转
+        std::vector<seal::Ciphertext> rotated = rotate_many(*context, *evaluator, query[c], plans, gal_key, &key_switches);
+        for(size_t i = 0; i < rotated.size(); ++i)
+        {
+            movedQuerys[i][c] = std::move(rotated[i]);
+        }
+    }
+    if(stats)
+    {
+        stats->move_rotations += key_switches;
+    }
+    trace_ops(0, key_switches);
+    for(size_t i = 0; i < movedQuerys.size(); ++i)
+    {
+        shift_query_index(movedQuerys[i], indexOffsets[i]);
+    }
+    return movedQuerys;
+}
+
+//偏移来自客户端，超出范围时shift_query_index的std::rotate越界
+void Mserver::check_offsets(int indexOffset, int coeffOffset) const
+{
+    if(indexOffset <= -(int)num_query_ciphertext || indexOffset >= (int)num_query_ciphertext)
+        throw std::invalid_argument("index offset " + std::to_string(indexOffset) + " out of range");
+    if(coeffOffset <= -(int)(N / 2) || coeffOffset >= (int)(N / 2))
+        throw std::invalid_argument("coeff offset " + std::to_string(coeffOffset) + " out of range");
+}
+
+void Mserver::shift_query_index(PIRQuery& query, int indexOffset)
+{
     //indexOffset  s = num_query_ciphertext
     // |c1|c2|c3|c4|c5|c6!c7|c8|c9|c10|c11|c12|c13|c14|
     // |  s-indexOffset  |    indexOffset             |
@@ -212,7 +369,7 @@ void Mserver::move_query(PIRQuery& query, int indexOffset, int coeffOffset, cons
     */
 }
 
-seal::Ciphertext Mserver::get_sum(std::vector<seal::Ciphertext> &query, seal::GaloisKeys &gal_keys, uint32_t start, uint32_t end)
+seal::Ciphertext Mserver::get_sum(std::vector<seal::Ciphertext> &query, const seal::GaloisKeys &gal_keys, uint32_t start, uint32_t end)
 {
     static int num = 0;
 
@@ -225,7 +382,12 @@ seal::Ciphertext Mserver::get_sum(std::vector<seal::Ciphertext> &query, seal::Ga
         int mid = next_power_of_two / 2;
         seal::Ciphertext left_sum = get_sum(query, gal_keys, start, start + mid - 1);           //递归计算
         seal::Ciphertext right_sum = get_sum(query, gal_keys, start + mid, end);                //算出两个
-        evaluator->rotate_rows_inplace(right_sum, -mid, gal_keys);          //旋转、相加(旋转算法)
+        {
+            StageTimer timer(metrics, kStageRotation);
+            PerfScope perf(profiler, kPhaseRotation);
+            evaluator->rotate_rows_inplace(right_sum, -mid, gal_keys);          //旋转、相加(旋转算法)
+        }
+        trace_ops(0, 1);
         evaluator->add_inplace(left_sum, right_sum);
         return left_sum;
        
@@ -233,28 +395,32 @@ seal::Ciphertext Mserver::get_sum(std::vector<seal::Ciphertext> &query, seal::Ga
     else
     {           //递归结束，只在行明文中查
 
+        StageTimer timer(metrics, kStageInnerProduct);
+        PerfScope perf(profiler, kPhaseInnerProduct);
         seal::Ciphertext column_sum;
-        seal::Ciphertext temp_ct;
-        evaluator->multiply_plain(query[0], encoded_db[num_query_ciphertext * start], column_sum);      //初始化
-
-        for (int j = 1; j < num_query_ciphertext; j++)              
-        {
-            evaluator->multiply_plain(query[j], encoded_db[num_query_ciphertext * start + j], temp_ct);
-            evaluator->add_inplace(column_sum, temp_ct);
-        }           //column_sum是求出的单个明文的计算结果
+        inner_product(query.data(), &encoded_db[num_query_ciphertext * start], num_query_ciphertext, coeff_modulus, column_sum);      //column_sum是求出的单个明文的计算结果
         evaluator->transform_from_ntt_inplace(column_sum);
+        trace_ops(num_query_ciphertext, 0);
         return column_sum;
     }
 }
 
-void Mserver::rotateCipher(seal::Ciphertext& ctxt, int step, const seal::GaloisKeys& gal_key)
+size_t Mserver::rotateCipher(seal::Ciphertext& ctxt, int step, const seal::GaloisKeys& gal_key, const RotationPlanner& planner)
 {
-    while(step != 0)
+    StageTimer timer(metrics, kStageRotation);
+    std::vector<int> plan = planner.plan(step);
+    for(int realStep : plan)
     {
-        int realStep = get_real_coeff_step(step);
-        step -= realStep;
         evaluator->rotate_rows_inplace(ctxt, realStep, gal_key);
     }
+    trace_ops(0, plan.size());
+    return plan.size();
+}
+
+std::vector<int> Mserver::get_rotation_plan(int step, const RotationPlanner* planner)
+{
+    //旋转次数最少的分解(原来按get_real_coeff_step贪心取最近的2的幂)
+    return planner ? planner->plan(step) : default_planner->plan(step);
 }
 
 uint32_t Mserver::get_next_power_of_two(uint32_t number)
@@ -297,6 +463,14 @@ int Mserver::get_real_coeff_step(int step)
 
 void Mserver::preprocess_query(std::vector<seal::Ciphertext> &query)
 {
+    StageTimer timer(metrics, kStageQueryNtt);
+    PerfScope perf(profiler, kPhaseQueryNtt);
+    //查询必须是数据层(first_parms_id)、大小为2、还没有转成NTT的密文，低level的密文RNS分量少，内积会越界
+    for (auto& c : query)
+    {
+        if (c.parms_id() != context->first_parms_id() || c.size() != 2 || c.is_ntt_form())
+            throw std::invalid_argument("query ciphertext has wrong level, size or form");
+    }
     for (int i = 0; i < query.size(); i++)
     {
         evaluator->transform_to_ntt_inplace(query[i]);
@@ -317,23 +491,12 @@ uint32_t Mserver::get_number_of_bits(uint64_t number)
 }
 
 std::vector<uint64_t> Mserver::encode(std::vector<unsigned char> str){       //将bit转换成uint64
-    std::vector<uint64_t> res;
-    std::string bit_str;
+    //前后两半各自按plain_data_bits位一个系数排列，不满一个系数的部分填1
     int plain_data_bits = plain_bit_count - 1;                          //数据=明文模位数 - 1
-    int n = str.size();
-    int remain = ((n/2)*8)%plain_data_bits;                             //放不满一个系数的数据位数剩余，因为要分到2个部分，所以/2
-    for(int iter = 0; iter < 2;iter++) {
-        int start_byte = iter * (n/2);
-        for (int i=0; i<n/2; i++) {
-            bit_str += std::bitset<8>(str[start_byte + i]).to_string();         //将单条消息的每个部分用位表示
-        }
-        if (remain != 0){
-            for (int i=0; i<(plain_data_bits - remain); i++)
-                bit_str += "1";                                                 //剩余部分填满
-        }
-    }   
-    for (int i=0; i<bit_str.length(); i+=plain_data_bits)
-        res.push_back((uint64_t)std::stoll(bit_str.substr(i,plain_data_bits), nullptr, 2));          //将str按uint64t放到结果中，每次取plain_data_bits位
-    //这样将数据分成两份，放到vector<uint64>中，就可以直接放到明文系数中了
+    size_t half = str.size() / 2;
+    size_t per_half = bitcodec::coeff_count(half, plain_data_bits);
+    std::vector<uint64_t> res(2 * per_half);
+    bitcodec::bytes_to_coeffs(plain_data_bits, str.data(), half, res.data());
+    bitcodec::bytes_to_coeffs(plain_data_bits, str.data() + half, half, res.data() + per_half);
     return res;
 }
\ No newline at end of file
@@ -10,8 +10,27 @@
 #include <unistd.h>
 #include <bitset>
 #include<cassert>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include "seal/seal.h"
 #include "mfastpirparams.hpp"
+#include "mrotation.hpp"
+#include "mbitcodec.hpp"
+#include "mkernels.hpp"
+#include "mmetrics.hpp"
+#include "mperf.hpp"
+
+//一次查询中的旋转(key switch)次数，用于按延迟调整客户端上传的旋转key
+struct ResponseStats
+{
+    size_t planned_rotations = 0;           //移动查询按plan逐个旋转需要的次数
+    size_t move_rotations = 0;              //移动查询实际的key switch次数(共享前缀之后)
+    size_t concat_rotations = 0;            //合并回复的旋转次数
+    size_t sum_rotations = 0;               //get_sum中的旋转次数
+    size_t total() const {return move_rotations + concat_rotations + sum_rotations;}
+};
 
 class Mserver
 {
@@ -19,16 +38,33 @@ class Mserver
 public:
     
     Mserver(FastPIRParams parms);
+    //以下查询接口在客户端没有key、查询密文的数量/level/大小/形式、多查询偏移或范围不对时抛出std::invalid_argument，不退出进程
     void set_client_galois_keys(uint32_t client_id, seal::GaloisKeys gal_keys);
+    void remove_client_galois_keys(uint32_t client_id);
     void set_db(std::vector<std::vector<unsigned char>> db);
     void preprocess_db();
     PIRReply get_response(uint32_t client_id, PIRQuery query);
+    PIRReply get_response(PIRQuery query, const seal::GaloisKeys& gal_keys);
+
+    //只取回消息中[offset, offset + length)字节: 只计算FastPIRParams::column_range中的列，
+    //每N/2列一个回复密文，第first + iN/2 + t列在第i个密文的slot (index % N/2) + t
+    PIRReply get_range_response(uint32_t client_id, PIRQuery query, size_t offset, size_t length);
+    PIRReply get_range_response(PIRQuery query, const seal::GaloisKeys& gal_keys, size_t offset, size_t length);
 
-    PIRReply get_multi_response(uint32_t client_id, const Query& query);
+    PIRReply get_multi_response(uint32_t client_id, const Query& query, ResponseStats* stats = nullptr);
+    //使用调用者给出的key和planner，调度器排队期间客户端断开(key被删除)也不受影响
+    PIRReply get_multi_response(const Query& query, const seal::GaloisKeys& gal_keys, const RotationPlanner& planner, ResponseStats* stats = nullptr);
 
-    PIRReply concat_response(uint32_t client_id, const std::vector<PIRReply>& replys, const std::vector<int>& coeffOffsets);
+    PIRReply concat_response(uint32_t client_id, const std::vector<PIRReply>& replys, const std::vector<int>& coeffOffsets, ResponseStats* stats = nullptr);
+    PIRReply concat_response(const std::vector<PIRReply>& replys, const std::vector<int>& coeffOffsets, const seal::GaloisKeys& gal_keys, const RotationPlanner& planner,
+                             ResponseStats* stats = nullptr);
 
-    void move_query(PIRQuery& query, int indexOffset, int coeffOffset, const seal::GaloisKeys& gal_key);
+    //planner为空时使用只有±2^i旋转key(Mclient默认key)的planner
+    void move_query(PIRQuery& query, int indexOffset, int coeffOffset, const seal::GaloisKeys& gal_key, const RotationPlanner* planner = nullptr);
+
+    //与逐个调用move_query结果相同，每个查询密文的分解只做一次(hoisting)，旋转前缀相同的偏移共享中间结果
+    std::vector<PIRQuery> move_queries(const PIRQuery& query, const std::vector<int>& indexOffsets, const std::vector<int>& coeffOffsets, const seal::GaloisKeys& gal_key,
+                                       const RotationPlanner* planner = nullptr, ResponseStats* stats = nullptr);
 
     seal::SEALContext getContext() const {return *context;}
 
@@ -38,18 +74,52 @@ public:
 
     uint32_t get_obj_size() const {return obj_size;}
 
-    seal::GaloisKeys* get_key(uint32_t id)
+    uint32_t get_pack_factor() const {return pack_factor;}
+
+    uint32_t get_poly_degree() const {return N;}
+
+    uint32_t get_plain_data_bits() const {return plain_bit_count - 1;}
+
+    //多个线程可以同时查询，密钥用shared_ptr保存，查询期间即使密钥被替换也不会失效
+    std::shared_ptr<const seal::GaloisKeys> get_key(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(key_mutex);
+        auto it = client_galois_keys.find(id);
+        return it == client_galois_keys.end() ? nullptr : it->second;
+    }
+
+    //各阶段的计数和延迟，TcpQueryServer的反序列化/序列化/发送也记在这里
+    ServerMetrics& get_metrics() {return metrics;}
+
+    //设置后query_ntt、内积和旋转树按硬件计数器分阶段统计，nullptr关闭(默认)
+    void set_profiler(PerfProfiler* p) {profiler = p;}
+
+    //按客户端上传的key集合生成的旋转planner，没有上传key时返回默认planner
+    std::shared_ptr<const RotationPlanner> get_planner(uint32_t id)
     {
-        return client_galois_keys.find(id) == client_galois_keys.end() ? nullptr : &(client_galois_keys[id]);
+        std::lock_guard<std::mutex> lock(key_mutex);
+        auto it = client_planners.find(id);
+        return it == client_planners.end() ? default_planner : it->second;
     }
 private:
     seal::SEALContext *context;
     seal::Evaluator *evaluator;
     seal::BatchEncoder *batch_encoder;
-    std::map<uint32_t, seal::GaloisKeys> client_galois_keys;
+    std::map<uint32_t, std::shared_ptr<const seal::GaloisKeys>> client_galois_keys;
+    std::map<uint32_t, std::shared_ptr<const RotationPlanner>> client_planners;
+    std::shared_ptr<const RotationPlanner> default_planner;
+    std::mutex key_mutex;
+    std::map<uint32_t, size_t> client_key_bytes;
+    ServerMetrics metrics;
+    PerfProfiler* profiler = nullptr;
     std::vector<seal::Plaintext> encoded_db;
+    std::vector<seal::Modulus> coeff_modulus;           //数据层的RNS素数
+    kernels::InnerProductKernel inner_product;          //按(N, 素数个数)在构造时选择
     uint32_t num_obj;
     uint32_t obj_size;
+    uint32_t pack_factor;
+    uint32_t record_num;
+    uint32_t record_size;
     uint32_t num_columns_per_obj;
     uint32_t num_query_ciphertext;
     uint32_t N;
@@ -61,13 +131,16 @@ private:
     void encode_db(std::vector<std::vector<uint64_t>> db);
     void preprocess_query(std::vector<seal::Ciphertext> &query);
     std::vector<uint64_t> encode(std::vector<unsigned char> str);
-    seal::Ciphertext get_sum(std::vector<seal::Ciphertext> &query, seal::GaloisKeys &gal_keys, uint32_t start, uint32_t end);
+    seal::Ciphertext get_sum(std::vector<seal::Ciphertext> &query, const seal::GaloisKeys &gal_keys, uint32_t start, uint32_t end);
     uint32_t get_next_power_of_two(uint32_t number);
     uint32_t get_number_of_bits(uint64_t number);
     uint32_t get_last_power_of_two(uint32_t number);
-    void rotateCipher(seal::Ciphertext&, int step, const seal::GaloisKeys& gal_key);
+    void check_offsets(int indexOffset, int coeffOffset) const;
+    size_t rotateCipher(seal::Ciphertext&, int step, const seal::GaloisKeys& gal_key, const RotationPlanner& planner);
+    void shift_query_index(PIRQuery& query, int indexOffset);
 public:
     int get_real_coeff_step(int step);
+    std::vector<int> get_rotation_plan(int step, const RotationPlanner* planner = nullptr);
 //private:
 //    seal::Decryptor* dec;
 };
@@ -0,0 +1,176 @@
+#include "mtuner.hpp"
+#include "mclient.hpp"
+#include "mrotation.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace
+{
+//模拟噪声用的一组SEAL对象
+struct Bench
+{
+    Bench(FastPIRParams& params)
+        : context(params.get_seal_params()), keygen(context), encryptor(context, keygen.secret_key()),
+          decryptor(context, keygen.secret_key()), evaluator(context), batch_encoder(context)
+    {
+        N = params.get_poly_modulus_degree();
+        plain_modulus = params.get_seal_params().plain_modulus().value();
+        keygen.create_galois_keys(std::vector<int>{-1}, gal_keys);      //key switch的噪声与步长无关，只生成一个
+    }
+
+    seal::Ciphertext encrypt_one_hot()
+    {
+        std::vector<uint64_t> slots(N, 0);
+        slots[0] = 1;
+        seal::Plaintext pt;
+        batch_encoder.encode(slots, pt);
+        seal::Ciphertext ct;
+        encryptor.encrypt_symmetric(pt, ct);
+        return ct;
+    }
+
+    //每个slot都取模数范围内的随机值，乘法的噪声增长最大
+    seal::Plaintext random_ntt_plain()
+    {
+        std::mt19937_64 rng(std::random_device{}());
+        std::vector<uint64_t> slots(N);
+        for (auto& s : slots)
+        {
+            s = rng() % plain_modulus;
+        }
+        seal::Plaintext pt;
+        batch_encoder.encode(slots, pt);
+        evaluator.transform_to_ntt_inplace(pt, context.first_parms_id());
+        return pt;
+    }
+
+    size_t N;
+    uint64_t plain_modulus;
+    seal::SEALContext context;
+    seal::KeyGenerator keygen;
+    seal::Encryptor encryptor;
+    seal::Decryptor decryptor;
+    seal::Evaluator evaluator;
+    seal::BatchEncoder batch_encoder;
+    seal::GaloisKeys gal_keys;
+};
+
+uint32_t ceil_log2(uint64_t number)
+{
+    uint32_t bits = 0;
+    while ((1ULL << bits) < number)
+    {
+        bits++;
+    }
+    return bits;
+}
+}
+
+int simulate_noise_budget(FastPIRParams params, size_t move_rotations)
+{
+    Bench bench(params);
+    uint32_t columns = params.get_num_columns_per_obj() / 2;
+    uint32_t row_size = bench.N / 2;
+
+    seal::Ciphertext ct = bench.encrypt_one_hot();
+    for (size_t i = 0; i < move_rotations; i++)
+    {
+        bench.evaluator.rotate_rows_inplace(ct, -1, bench.gal_keys);
+    }
+    bench.evaluator.transform_to_ntt_inplace(ct);
+    bench.evaluator.multiply_plain_inplace(ct, bench.random_ntt_plain());
+    //内积是num_query_ciphertext个噪声相近的乘积之和，每次自加噪声翻倍，不小于逐个相加的最坏情况
+    for (uint32_t i = ceil_log2(params.get_num_query_ciphertext()); i > 0; i--)
+    {
+        bench.evaluator.add_inplace(ct, ct);
+    }
+    bench.evaluator.transform_from_ntt_inplace(ct);
+    //get_sum的旋转树: 最深的一条路径上每层旋转一次再相加
+    for (uint32_t i = ceil_log2(std::min(columns, row_size)); i > 0; i--)
+    {
+        seal::Ciphertext rotated;
+        bench.evaluator.rotate_rows(ct, -1, bench.gal_keys, rotated);
+        bench.evaluator.add_inplace(ct, rotated);
+    }
+    return bench.decryptor.invariant_noise_budget(ct);
+}
+
+FastPIRParams TuneCandidate::params(size_t num_obj, size_t obj_size) const
+{
+    return FastPIRParams(num_obj, obj_size + obj_size % 2, poly_degree, plain_bits, pack_factor);
+}
+
+std::vector<TuneCandidate> tune_params(size_t num_obj, size_t obj_size, const TuneOptions& options)
+{
+    obj_size += obj_size % 2;                   //FastPIR要求消息大小为偶数
+    std::vector<TuneCandidate> candidates;
+    for (auto& set : FastPIRParams::param_sets())
+    {
+        FastPIRParams base(num_obj, obj_size, set.poly_degree, set.plain_bits);
+        PrimitiveTimings t = measure_primitives(base, options.repeat);
+        //多查询时每个移动的查询密文按coeffOffset旋转，最坏情况是分解最长的偏移
+        size_t move_rotations = 0;
+        if (options.query_count > 1)
+        {
+            RotationPlanner planner(set.poly_degree / 2, Mclient::rotation_key_steps(set.poly_degree, 1));
+            move_rotations = planner.max_rotations();
+        }
+
+        std::vector<size_t> pack_factors = {1};
+        size_t pack = FastPIRParams::choose_pack_factor(obj_size, set.plain_bits);
+        if (pack > 1)
+            pack_factors.push_back(pack);
+        for (size_t pack_factor : pack_factors)
+        {
+            FastPIRParams params(num_obj, obj_size, set.poly_degree, set.plain_bits, pack_factor);
+            TuneCandidate c;
+            c.poly_degree = set.poly_degree;
+            c.plain_bits = set.plain_bits;
+            c.pack_factor = pack_factor;
+            c.num_query_ciphertext = params.get_num_query_ciphertext();
+            c.num_columns_per_obj = params.get_num_columns_per_obj();
+            c.reply_ciphertext_num = params.get_reply_ciphertext_num();
+            c.noise_budget = simulate_noise_budget(params, move_rotations);
+            c.safe = c.noise_budget >= options.min_noise_budget;
+
+            ResponseCostModel model(params, t);
+            c.server_us = model.predict_us(model.response_counts());
+            c.client_us = c.num_query_ciphertext * t.encrypt + c.reply_ciphertext_num * t.decrypt;
+            c.query_bytes = c.num_query_ciphertext * t.ciphertext_bytes;
+            c.reply_bytes = c.reply_ciphertext_num * t.ciphertext_bytes;
+            candidates.push_back(c);
+        }
+    }
+
+    double best_latency = std::numeric_limits<double>::infinity();
+    double best_bytes = std::numeric_limits<double>::infinity();
+    for (auto& c : candidates)
+    {
+        if (!c.safe)
+            continue;
+        best_latency = std::min(best_latency, c.server_us + c.client_us);
+        best_bytes = std::min(best_bytes, (double)(c.query_bytes + c.reply_bytes));
+    }
+    for (auto& c : candidates)
+    {
+        double latency = c.server_us + c.client_us;
+        double bytes = c.query_bytes + c.reply_bytes;
+        if (!c.safe)
+            c.score = std::numeric_limits<double>::infinity();
+        else if (options.target == TuneTarget::kLatency)
+            c.score = latency;
+        else if (options.target == TuneTarget::kBytes)
+            c.score = bytes;
+        else
+            c.score = options.weight * latency / best_latency + (1 - options.weight) * bytes / best_bytes;
+    }
+    //score相同时(如按字节数)延迟小的在前
+    std::stable_sort(candidates.begin(), candidates.end(), [](const TuneCandidate& a, const TuneCandidate& b) {
+        if (a.score != b.score)
+            return a.score < b.score;
+        return a.server_us + a.client_us < b.server_us + b.client_us;
+    });
+    return candidates;
+}
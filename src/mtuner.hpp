@@ -0,0 +1,55 @@
+#ifndef FASTPIR_TUNER_H
+#define FASTPIR_TUNER_H
+
+#include <vector>
+#include <string>
+#include "mfastpirparams.hpp"
+#include "mcostmodel.hpp"
+
+//参数调优: 对每组候选参数(FastPIRParams::param_sets() x 是否打包)
+//1. 模拟最坏情况的噪声增长(内积、get_sum的旋转树，query_count > 1时还有多查询移动)，剩余噪声预算不足的参数淘汰；
+//2. 测量该参数下基本运算的时间，用ResponseCostModel估计服务端时间，再估计客户端时间和通信量；
+//3. 按目标(延迟、通信量或两者加权)排序
+
+//最坏情况下回复剩余的噪声预算(bit)，move_rotations为多查询移动查询需要的旋转次数
+int simulate_noise_budget(FastPIRParams params, size_t move_rotations = 0);
+
+enum class TuneTarget
+{
+    kLatency,                           //端到端的计算时间最小(服务端 + 客户端，不含网络)
+    kBytes,                             //查询+回复的字节数最小
+    kMix                                //weight * 延迟/最小延迟 + (1 - weight) * 字节数/最小字节数
+};
+
+struct TuneCandidate
+{
+    size_t poly_degree;
+    size_t plain_bits;
+    size_t pack_factor;
+    int noise_budget;
+    bool safe;
+    uint32_t num_query_ciphertext;
+    uint32_t num_columns_per_obj;
+    size_t reply_ciphertext_num;
+    double server_us;                   //预测的服务端计算时间
+    double client_us;                   //预测的客户端加密+解密时间
+    size_t query_bytes;
+    size_t reply_bytes;
+    double score;                       //越小越好，不安全的参数为无穷大
+
+    FastPIRParams params(size_t num_obj, size_t obj_size) const;
+};
+
+struct TuneOptions
+{
+    TuneTarget target = TuneTarget::kLatency;
+    double weight = 0.5;                //只用于kMix
+    int repeat = 10;                    //测量基本运算的重复次数
+    int min_noise_budget = 2;           //剩余预算低于此值视为不安全
+    int query_count = 1;                //每个请求的查询个数，> 1时移动查询的旋转按默认key集合(rotation window 1)最坏的分解计入噪声
+};
+
+//返回所有候选参数，按score从小到大排序
+std::vector<TuneCandidate> tune_params(size_t num_obj, size_t obj_size, const TuneOptions& options = TuneOptions());
+
+#endif
@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include <chrono>
 #include <fstream>
+#include <algorithm>
+#include <map>
 
 #include "bfvparams.h"
 #include "mfastpirparams.hpp"
@@ -15,14 +17,18 @@ int main(int argc, char *argv[])
 {
     size_t obj_size = 0; // Size of each object in bytes
     size_t num_obj = 0;  // Total number of objects in DB
-    size_t poly = 4096;
-    size_t p = 20;
+    size_t poly = POLY_MODULUS_DEGREE;
+    size_t p = PLAIN_BIT;
     size_t query_count = 5;         //查询5次
+    int rotation_window = 1;
+    bool batch = false;             //k-hot批量查询，每组一次扫描
+    bool pack = false;              //小记录打包
+    size_t range_offset = 0, range_length = 0;        //按字节范围取回第一个index的消息
     int option;
     std::ofstream file;
     file.open("/tmp/null", std::ios::app);
     //assert(file);
-    const char *optstring = "n:s:N:p:t:";
+    const char *optstring = "n:s:N:p:t:w:bPr:";
     while ((option = getopt(argc, argv, optstring)) != -1)
     {
         switch (option)
@@ -42,6 +48,28 @@ int main(int argc, char *argv[])
         case 't':
             query_count = std::stoi(optarg);
             break;
+        case 'w':
+            rotation_window = std::stoi(optarg);
+            break;
+        case 'b':
+            batch = true;
+            break;
+        case 'P':
+            pack = true;
+            break;
+        case 'r':
+        {
+            std::string range(optarg);
+            size_t comma = range.find(',');
+            if (comma == std::string::npos)
+            {
+                print_usage();
+                return 1;
+            }
+            range_offset = std::stoul(range.substr(0, comma));
+            range_length = std::stoul(range.substr(comma + 1));
+            break;
+        }
         case '?':
             print_usage();
             return 1;
@@ -61,19 +89,25 @@ int main(int argc, char *argv[])
     srand(time(NULL));
     std::chrono::high_resolution_clock::time_point time_start, time_end;
 
-    FastPIRParams params(num_obj, obj_size, poly, p);            //参数：一条数据大小、数据条数
+    FastPIRParams params(num_obj, obj_size, poly, p, pack ? FastPIRParams::choose_pack_factor(obj_size, p) : 1);            //参数：一条数据大小、数据条数
+    if(params.get_pack_factor() > 1)
+    {
+        std::cout << "pack factor = " << params.get_pack_factor() << ", " << params.get_num_obj() << " objects of " << params.get_obj_size() << " bytes" << std::endl;
+    }
     //int desired_index = rand()%num_obj;
-    std::vector<int> desires(query_count);
+    std::vector<int> desires(query_count);                       //记录的index
+    std::vector<int> dbDesires(query_count);                     //记录所在消息的index
     for(int i = 0; i < desires.size(); ++i)
     {
         desires[i] = rand() % num_obj;
+        dbDesires[i] = desires[i] / params.get_pack_factor();
     }
     std::vector<int> indexOffsets(query_count - 1);              //左-右+
     std::vector<int> coeffOffsets(query_count - 1);              //左+右-
     for(size_t i = 1; i < query_count; ++i)
     {
-        indexOffsets[i - 1] = desires[i] / (POLY_MODULUS_DEGREE / 2) - desires[0] / (POLY_MODULUS_DEGREE / 2);  
-        coeffOffsets[i - 1] = -(desires[i] %  (POLY_MODULUS_DEGREE / 2) - desires[0] % (POLY_MODULUS_DEGREE / 2));
+        indexOffsets[i - 1] = dbDesires[i] / (poly / 2) - dbDesires[0] / (poly / 2);  
+        coeffOffsets[i - 1] = -(dbDesires[i] %  (poly / 2) - dbDesires[0] % (poly / 2));
     }
     
     for(int i = 0; i < indexOffsets.size(); ++i)
@@ -85,7 +119,7 @@ int main(int argc, char *argv[])
     //std::cout<<"Retrieving element at index "<<desired_index<<std::endl<<std::endl;
 
     Mserver server(params);
-    Mclient client(params);
+    Mclient client(params, rotation_window);
     file << "params : n = " << num_obj << " size = " << obj_size << " N = " << params.get_poly_modulus_degree() << " p = " << params.get_plain_modulus_size() << std::endl; 
     time_start = std::chrono::high_resolution_clock::now();
     std::vector<std::vector<unsigned char>> db = populate_db(num_obj, obj_size);        //随机生成db
@@ -102,26 +136,122 @@ int main(int argc, char *argv[])
 
     server.set_client_galois_keys(0, client.get_galois_keys());         //设置旋转密钥
 
+    if(range_length > 0)
+    {
+        if(range_offset + range_length > params.get_obj_size())
+        {
+            print_usage();
+            return 1;
+        }
+        Query query = client.gen_query(dbDesires[0]);
+        time_start = std::chrono::high_resolution_clock::now();
+        PIRReply full = server.get_response(0, query.query);
+        time_end = std::chrono::high_resolution_clock::now();
+        auto full_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        time_start = std::chrono::high_resolution_clock::now();
+        PIRReply ranged = server.get_range_response(0, query.query, range_offset, range_length);
+        time_end = std::chrono::high_resolution_clock::now();
+        auto range_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        //打包时范围是相对于拼接后的消息的
+        std::vector<unsigned char> obj = client.decode_response(full, dbDesires[0]);
+        std::vector<unsigned char> part = client.decode_range_response(ranged, dbDesires[0], range_offset, range_length);
+        bool range_incorrect = part.size() != range_length || !std::equal(part.begin(), part.end(), obj.begin() + range_offset);
+        auto columns = FastPIRParams::column_range(params.get_obj_size(), range_offset, range_length, p);
+        std::cout << (range_incorrect ? "PIR Result is incorrect!" : "PIR result correct!") << std::endl << std::endl;
+        std::cout << "Range [" << range_offset << ", " << range_offset + range_length << ") columns " << columns.second - columns.first + 1
+                  << " of " << params.get_num_columns_per_obj() / 2 << std::endl;
+        std::cout << "Full response: " << full_time << " us, " << full.size() << " Ciphertext" << std::endl;
+        std::cout << "Range response: " << range_time << " us, " << ranged.size() << " Ciphertext" << std::endl;
+        file << "Range response time (us): " << range_time << " full response time (us): " << full_time << std::endl << std::endl;
+        return range_incorrect;
+    }
+
+    if(batch)
+    {
+        std::vector<uint32_t> indices(dbDesires.begin(), dbDesires.end());
+        time_start = std::chrono::high_resolution_clock::now();
+        std::vector<std::vector<uint32_t>> groups = client.group_indices(indices);
+        std::vector<PIRQuery> batchQuerys;
+        for(auto& g : groups)
+        {
+            batchQuerys.push_back(client.gen_batch_query(g));
+        }
+        time_end = std::chrono::high_resolution_clock::now();
+        auto batch_query_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        time_start = std::chrono::high_resolution_clock::now();
+        std::vector<PIRReply> batchReplys;
+        for(auto& q : batchQuerys)
+        {
+            batchReplys.push_back(server.get_response(0, q));           //每组一次全库扫描
+        }
+        time_end = std::chrono::high_resolution_clock::now();
+        auto batch_response_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        time_start = std::chrono::high_resolution_clock::now();
+        std::map<uint32_t, std::vector<unsigned char>> objs;
+        for(size_t g = 0; g < groups.size(); ++g)
+        {
+            auto records = client.decode_batch_response(batchReplys[g], groups[g]);
+            for(size_t j = 0; j < groups[g].size(); ++j)
+            {
+                objs[groups[g][j]] = std::move(records[j]);
+            }
+        }
+        bool batch_incorrect = false;
+        for(auto d : desires)
+        {
+            if(client.extract_record(objs[client.db_index(d)], d) != db[d])
+            {
+                batch_incorrect = true;
+                std::cout << "error index = " << d << std::endl;
+            }
+        }
+        time_end = std::chrono::high_resolution_clock::now();
+        auto batch_decode_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        std::cout << (batch_incorrect ? "PIR Result is incorrect!" : "PIR result correct!") << std::endl << std::endl;
+        std::cout << "Batch groups (DB scans): " << groups.size() << " for " << indices.size() << " indices" << std::endl;
+        std::cout << "Query generation time (us): " << batch_query_time << std::endl;
+        std::cout << "Response generation time (us): " << batch_response_time << std::endl;
+        std::cout << "Response decode time (us): "<< batch_decode_time << std::endl;
+        file << "Batch groups (DB scans): " << groups.size() << " for " << indices.size() << " indices" << std::endl
+            << "Query generation time (us): " << batch_query_time << std::endl
+            << "Response generation time (us): " << batch_response_time << std::endl
+            << "Response decode time (us): "<< batch_decode_time << std::endl
+            << std::endl;
+        return batch_incorrect;
+    }
+
     time_start = std::chrono::high_resolution_clock::now();     
-    Query query = client.gen_query(desires[0], indexOffsets, coeffOffsets);                   //生成查询，查询的数量和列数相同
+    Query query = client.gen_query(dbDesires[0], indexOffsets, coeffOffsets);                   //生成查询，查询的数量和列数相同
     time_end = std::chrono::high_resolution_clock::now();
     auto query_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
     std::cout<<"Generated PIR query!"<<std::endl;
-    std::cout<<"Query size: "<< query.query.size() << " Ciphertext, " <<query.query.size() * query.query[0].size() * query.query[0].coeff_modulus_size() * POLY_MODULUS_DEGREE * 8<<" bytes"<<std::endl<<std::endl;
+    std::cout<<"Query size: "<< query.query.size() << " Ciphertext, " <<query.query.size() * query.query[0].size() * query.query[0].coeff_modulus_size() * poly * 8<<" bytes"<<std::endl<<std::endl;
                                             //！！ 当数量很大的时候查询会变得很大！
-    file << "Query size: "<< query.query.size() * (query.coeffOffset.size() + 1) << " Ciphertext, " <<query.query.size() * (query.coeffOffset.size() + 1) * query.query[0].size() * query.query[0].coeff_modulus_size() * POLY_MODULUS_DEGREE * 8<<" bytes"<<std::endl<<std::endl;
+    file << "Query size: "<< query.query.size() * (query.coeffOffset.size() + 1) << " Ciphertext, " <<query.query.size() * (query.coeffOffset.size() + 1) * query.query[0].size() * query.query[0].coeff_modulus_size() * poly * 8<<" bytes"<<std::endl<<std::endl;
     std::cout<<"Generating PIR response..."<<std::endl;
     time_start = std::chrono::high_resolution_clock::now();
-    PIRReply response = server.get_multi_response(0, query);
+    ResponseStats stats;
+    PIRReply response = server.get_multi_response(0, query, &stats);
     time_end = std::chrono::high_resolution_clock::now();
     auto response_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
     std::cout<<"PIR response generated!"<<std::endl;
-    //std::cout<<"Response size: "<<response.size() * response.coeff_modulus_size() * POLY_MODULUS_DEGREE * 8<<" bytes"<<std::endl<<std::endl;
-    std::cout << "Response size: " << response.size() << " Ciphertext, " << response.size() * response[0].coeff_modulus_size() * POLY_MODULUS_DEGREE * 8 << " bytes" << std::endl;
-    file << "Response size: " << response.size() << " Ciphertext, " << response.size() * response[0].coeff_modulus_size() * POLY_MODULUS_DEGREE * 8 << " bytes" << std::endl;
+    //std::cout<<"Response size: "<<response.size() * response.coeff_modulus_size() * poly * 8<<" bytes"<<std::endl<<std::endl;
+    std::cout << "Response size: " << response.size() << " Ciphertext, " << response.size() * response[0].coeff_modulus_size() * poly * 8 << " bytes" << std::endl;
+    file << "Response size: " << response.size() << " Ciphertext, " << response.size() * response[0].coeff_modulus_size() * poly * 8 << " bytes" << std::endl;
 
     time_start = std::chrono::high_resolution_clock::now();
-    std::vector<unsigned char> decoded_response = client.decode_response(response, desires[0], query_count);
+    std::vector<unsigned char> decoded_response;
+    std::vector<std::vector<unsigned char>> objs = client.decode_multi_response(response, std::vector<uint32_t>(dbDesires.begin(), dbDesires.end()));
+    for(size_t j = 0; j < objs.size(); ++j)
+    {
+        auto record = client.extract_record(objs[j], desires[j]);
+        decoded_response.insert(decoded_response.end(), record.begin(), record.end());
+    }
     time_end = std::chrono::high_resolution_clock::now();
     auto decode_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
     std::cout<<"Decoded PIR response!"<<std::endl<<std::endl;
@@ -155,6 +285,8 @@ int main(int argc, char *argv[])
     std::cout << "Query generation time (us): " << query_time << std::endl;
     std::cout << "Response generation time (us): " << response_time << std::endl;
     std::cout << "Response decode time (us): "<< decode_time << std::endl;
+    std::cout << "Rotations: move " << stats.move_rotations << " (planned " << stats.planned_rotations << ") concat " << stats.concat_rotations
+              << " sum " << stats.sum_rotations << " total " << stats.total() << std::endl;
 
     file << "Query generation time (us): " << query_time << std::endl 
         << "Response generation time (us): " << response_time << std::endl 
@@ -164,7 +296,7 @@ int main(int argc, char *argv[])
 
 void print_usage()
 {
-    std::cout << "usage: main -n <number of objects> -s <object size in bytes>" << std::endl;
+    std::cout << "usage: main -n <number of objects> -s <object size in bytes> [-N <poly degree>] [-p <plain bits>] [-t <query count>] [-w <rotation key window>] [-b] [-P] [-r <offset,length>]" << std::endl;
 }
 
 
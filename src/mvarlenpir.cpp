@@ -0,0 +1,271 @@
+#include "mvarlenpir.hpp"
+#include "mparallel.hpp"
+#include <cmath>
+#include <limits>
+#include <cassert>
+#include <stdexcept>
+
+namespace
+{
+//一个size class的消息格式: 打包系数g和每条(打包后)消息的系数个数
+struct ClassShape
+{
+    size_t pack_factor;
+    size_t columns;
+};
+
+ClassShape class_shape(size_t obj_size, size_t plain_bits)
+{
+    ClassShape shape;
+    shape.pack_factor = FastPIRParams::choose_pack_factor(obj_size, plain_bits);
+    shape.columns = 2 * ceil((shape.pack_factor * obj_size / 2 * 8) / (double)plain_bits);
+    return shape;
+}
+
+//扫描一遍的明文-密文乘法次数: 查询密文个数 * 每条消息的系数个数
+double shape_cost(size_t num_obj, const ClassShape& shape, size_t poly_degree, double class_overhead)
+{
+    size_t packed = (num_obj + shape.pack_factor - 1) / shape.pack_factor;
+    size_t query_ciphertexts = (packed + poly_degree / 2 - 1) / (poly_degree / 2);
+    return query_ciphertexts * shape.columns + class_overhead;
+}
+
+size_t even_size(size_t len)
+{
+    return std::max<size_t>(len + len % 2, 2);           //FastPIR的消息长度必须是偶数
+}
+}
+
+VarLenLayout::VarLenLayout(const std::vector<size_t>& record_sizes, size_t max_chunk_size, size_t poly_degree, size_t plain_bits, double class_overhead)
+    : poly_degree(poly_degree), plain_bits(plain_bits)
+{
+    assert(!record_sizes.empty());
+    if (max_chunk_size)
+        max_chunk_size = even_size(max_chunk_size);
+
+    //切块: 整块的长度都是max_chunk_size
+    std::vector<std::vector<size_t>> pieces(record_sizes.size());
+    size_t full_chunks = 1;
+    for (size_t r = 0; r < record_sizes.size(); r++)
+    {
+        size_t len = record_sizes[r];
+        if (max_chunk_size && len > max_chunk_size)
+        {
+            pieces[r].assign(len / max_chunk_size, max_chunk_size);
+            full_chunks = std::max(full_chunks, pieces[r].size());
+            len %= max_chunk_size;
+            if (len == 0)
+                continue;
+        }
+        pieces[r].push_back(len);
+    }
+
+    std::map<size_t, size_t> histogram;
+    for (auto& p : pieces)
+    {
+        for (auto len : p)
+        {
+            histogram[even_size(len)]++;
+        }
+    }
+    std::vector<size_t> sizes;
+    std::vector<size_t> prefix(1, 0);
+    std::vector<ClassShape> shapes;
+    for (auto& h : histogram)
+    {
+        sizes.push_back(h.first);
+        prefix.push_back(prefix.back() + h.second);
+        shapes.push_back(class_shape(h.first, plain_bits));
+    }
+
+    //动态规划: best[j]为前j种长度分成若干class的最小开销，一个class覆盖长度(sizes[i-1], sizes[j-1]]。
+    //最大的class每次查询要扫描full_chunks次
+    size_t D = sizes.size();
+    std::vector<double> best(D + 1, std::numeric_limits<double>::infinity());
+    std::vector<size_t> from(D + 1, 0);
+    best[0] = 0;
+    for (size_t j = 1; j <= D; j++)
+    {
+        double weight = j == D ? full_chunks : 1;
+        for (size_t i = 0; i < j; i++)
+        {
+            double c = best[i] + weight * shape_cost(prefix[j] - prefix[i], shapes[j - 1], poly_degree, class_overhead);
+            if (c < best[j])
+            {
+                best[j] = c;
+                from[j] = i;
+            }
+        }
+    }
+    for (size_t j = D; j > 0; j = from[j])
+    {
+        class_size.push_back(sizes[j - 1]);
+    }
+    std::reverse(class_size.begin(), class_size.end());
+
+    //按记录顺序给每一块分配class中的index
+    class_num_obj.assign(class_size.size(), 0);
+    chunks.resize(record_sizes.size());
+    rounds = 1;
+    for (size_t r = 0; r < pieces.size(); r++)
+    {
+        size_t top = 0;
+        for (auto len : pieces[r])
+        {
+            uint32_t c = std::lower_bound(class_size.begin(), class_size.end(), even_size(len)) - class_size.begin();
+            chunks[r].push_back({c, (uint32_t)class_num_obj[c]++, (uint32_t)len});
+            top += c + 1 == class_size.size();
+        }
+        rounds = std::max(rounds, top);          //余块也可能落在最大的class中
+    }
+
+    cost = 0;
+    for (size_t c = 0; c < class_size.size(); c++)
+    {
+        double weight = c + 1 == class_size.size() ? rounds : 1;
+        cost += weight * shape_cost(class_num_obj[c], class_shape(class_size[c], plain_bits), poly_degree, class_overhead);
+    }
+}
+
+FastPIRParams VarLenLayout::class_params(size_t c) const
+{
+    return FastPIRParams(class_num_obj[c], class_size[c], poly_degree, plain_bits, FastPIRParams::choose_pack_factor(class_size[c], plain_bits));
+}
+
+double VarLenLayout::class_cost(size_t num_obj, size_t obj_size, size_t poly_degree, size_t plain_bits, double class_overhead)
+{
+    return shape_cost(num_obj, class_shape(even_size(obj_size), plain_bits), poly_degree, class_overhead);
+}
+
+VarLenPIRServer::VarLenPIRServer(std::shared_ptr<const VarLenLayout> layout, int threads)
+    : layout(layout), threads(std::max(threads, 1))
+{
+    classes.resize(layout->get_num_classes());
+    for (size_t c = 0; c < classes.size(); c++)
+    {
+        classes[c].reset(new Mserver(layout->class_params(c)));
+    }
+}
+
+void VarLenPIRServer::set_db(const std::vector<std::vector<unsigned char>>& db)
+{
+    assert(db.size() == layout->get_num_records());
+    std::vector<std::vector<std::vector<unsigned char>>> class_db(classes.size());
+    for (size_t c = 0; c < classes.size(); c++)
+    {
+        class_db[c].assign(layout->get_class_num_obj(c), std::vector<unsigned char>(layout->get_class_size(c), 0));
+    }
+    for (uint32_t r = 0; r < db.size(); r++)
+    {
+        size_t offset = 0;
+        for (auto& chunk : layout->record_chunks(r))
+        {
+            assert(offset + chunk.length <= db[r].size());
+            std::copy(db[r].begin() + offset, db[r].begin() + offset + chunk.length, class_db[chunk.cls][chunk.index].begin());
+            offset += chunk.length;
+        }
+        assert(offset == db[r].size());
+    }
+    parallel_for(classes.size(), threads, [&](size_t c) {
+        classes[c]->set_db(std::move(class_db[c]));
+        classes[c]->preprocess_db();
+    });
+}
+
+void VarLenPIRServer::set_client_galois_keys(uint32_t client_id, seal::GaloisKeys gal_keys)
+{
+    auto keys = std::make_shared<const seal::GaloisKeys>(std::move(gal_keys));
+    std::lock_guard<std::mutex> lock(key_mutex);
+    client_galois_keys[client_id] = keys;
+}
+
+void VarLenPIRServer::remove_client_galois_keys(uint32_t client_id)
+{
+    std::lock_guard<std::mutex> lock(key_mutex);
+    client_galois_keys.erase(client_id);
+}
+
+std::vector<PIRReply> VarLenPIRServer::get_response(uint32_t client_id, const std::vector<PIRQuery>& querys)
+{
+    std::shared_ptr<const seal::GaloisKeys> gal_keys;
+    {
+        std::lock_guard<std::mutex> lock(key_mutex);
+        auto it = client_galois_keys.find(client_id);
+        if (it != client_galois_keys.end())
+            gal_keys = it->second;
+    }
+    if (gal_keys == nullptr)
+        throw std::invalid_argument("galois keys of client " + std::to_string(client_id) + " not set");
+    if (querys.size() != layout->query_count())
+        throw std::invalid_argument("varlen query size doesn't match");
+    std::vector<PIRReply> replys(querys.size());
+    parallel_for(querys.size(), threads, [&](size_t q) {
+        replys[q] = classes[layout->query_class(q)]->get_response(querys[q], *gal_keys);
+    });
+    return replys;
+}
+
+VarLenPIRClient::VarLenPIRClient(std::shared_ptr<const VarLenLayout> layout, int rotation_window)
+    : layout(layout)
+{
+    clients.resize(layout->get_num_classes());
+    clients[0].reset(new Mclient(layout->class_params(0), rotation_window));
+    for (size_t c = 1; c < clients.size(); c++)
+    {
+        clients[c].reset(new Mclient(layout->class_params(c), clients[0]->get_secret_key(), clients[0]->get_galois_keys()));
+    }
+}
+
+std::vector<PIRQuery> VarLenPIRClient::gen_query(uint32_t record)
+{
+    assert(record < layout->get_num_records());
+    const auto& chunks = layout->record_chunks(record);
+    size_t top = layout->get_num_classes() - 1;
+    last_chunks.assign(layout->query_count(), -1);
+    for (size_t j = 0; j < chunks.size(); j++)
+    {
+        //最大的class的第2、3...块用最后rounds - 1个查询
+        size_t q = chunks[j].cls;
+        if (chunks[j].cls == top)
+        {
+            while (last_chunks[q] != -1)
+                q++;
+        }
+        assert(q < last_chunks.size() && last_chunks[q] == -1);
+        last_chunks[q] = j;
+    }
+
+    //没有用到的查询取index 0，服务端看不出记录落在哪些class
+    std::vector<PIRQuery> querys(last_chunks.size());
+    for (size_t q = 0; q < querys.size(); q++)
+    {
+        Mclient& client = *clients[layout->query_class(q)];
+        uint32_t index = last_chunks[q] == -1 ? 0 : chunks[last_chunks[q]].index;
+        querys[q] = client.gen_query(client.db_index(index)).query;
+    }
+    last_record = record;
+    return querys;
+}
+
+std::vector<unsigned char> VarLenPIRClient::decode_response(const std::vector<PIRReply>& replys)
+{
+    assert(replys.size() == last_chunks.size());
+    const auto& chunks = layout->record_chunks(last_record);
+    std::vector<std::vector<unsigned char>> parts(chunks.size());
+    for (size_t q = 0; q < replys.size(); q++)
+    {
+        if (last_chunks[q] == -1)
+            continue;
+        Mclient& client = *clients[layout->query_class(q)];
+        const VarLenChunk& chunk = chunks[last_chunks[q]];
+        auto obj = client.decode_response(replys[q], client.db_index(chunk.index));
+        parts[last_chunks[q]] = client.extract_record(obj, chunk.index);
+        parts[last_chunks[q]].resize(chunk.length);
+    }
+    std::vector<unsigned char> res;
+    for (auto& p : parts)
+    {
+        res.insert(res.end(), p.begin(), p.end());
+    }
+    return res;
+}
@@ -0,0 +1,108 @@
+#ifndef FASTPIR_VARLENPIR_H
+#define FASTPIR_VARLENPIR_H
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+
+//变长记录: 按长度把记录分到若干size class，每个class是一个独立的FastPIR库，消息长度为class的上界(小的class还会打包)；
+//客户端每次查询所有class(不需要的class查index 0)，服务端看不出记录的长度，总的扫描量只和各class的数据量有关。
+//超过max_chunk_size的记录切成max_chunk_size的整块和一个余块，整块放在最大的class中，
+//最大的class每次查询rounds次(rounds为一条记录最多的整块数)，其余class每次查询一次
+
+//记录的一块在哪个class的第几条
+struct VarLenChunk
+{
+    uint32_t cls;
+    uint32_t index;
+    uint32_t length;
+};
+
+//布局由记录长度(公开)算出，客户端和服务端各自算出相同的布局
+class VarLenLayout
+{
+public:
+    //class_overhead为每多一个class的固定开销，单位是一次明文-密文乘法(查询密文、get_sum的旋转、回复)
+    static constexpr double kDefaultClassOverhead = 64;
+
+    //max_chunk_size = 0表示不分块；poly_degree、plain_bits为各class使用的BFV参数(运行时选择的参数组)
+    VarLenLayout(const std::vector<size_t>& record_sizes, size_t max_chunk_size = 0, size_t poly_degree = POLY_MODULUS_DEGREE, size_t plain_bits = PLAIN_BIT,
+                 double class_overhead = kDefaultClassOverhead);
+
+    size_t get_num_records() const {return chunks.size();}
+    size_t get_num_classes() const {return class_size.size();}
+    size_t get_class_size(size_t c) const {return class_size[c];}
+    size_t get_class_num_obj(size_t c) const {return class_num_obj[c];}
+    size_t get_rounds() const {return rounds;}
+    const std::vector<VarLenChunk>& record_chunks(uint32_t record) const {return chunks[record];}
+
+    //查询个数: 每个class一个，最大的class再多rounds - 1个；第q个查询所属的class
+    size_t query_count() const {return class_size.size() + rounds - 1;}
+    size_t query_class(size_t q) const {return std::min(q, class_size.size() - 1);}
+
+    FastPIRParams class_params(size_t c) const;
+
+    //一次查询的扫描开销，单位同class_overhead
+    double scan_cost() const {return cost;}
+    static double class_cost(size_t num_obj, size_t obj_size, size_t poly_degree = POLY_MODULUS_DEGREE, size_t plain_bits = PLAIN_BIT,
+                             double class_overhead = kDefaultClassOverhead);
+
+private:
+    std::vector<size_t> class_size;
+    std::vector<size_t> class_num_obj;
+    std::vector<std::vector<VarLenChunk>> chunks;
+    size_t rounds;
+    double cost;
+    size_t poly_degree;
+    size_t plain_bits;
+};
+
+class VarLenPIRServer
+{
+public:
+    VarLenPIRServer(std::shared_ptr<const VarLenLayout> layout, int threads = 1);
+
+    //db[i]的长度必须与布局中的记录长度一致
+    void set_db(const std::vector<std::vector<unsigned char>>& db);
+
+    //所有class的SEAL参数相同，共用一套密钥
+    void set_client_galois_keys(uint32_t client_id, seal::GaloisKeys gal_keys);
+    void remove_client_galois_keys(uint32_t client_id);
+
+    //querys的个数为layout->query_count()，返回值与之一一对应。没有key或查询个数不对时抛出std::invalid_argument
+    std::vector<PIRReply> get_response(uint32_t client_id, const std::vector<PIRQuery>& querys);
+
+private:
+    std::shared_ptr<const VarLenLayout> layout;
+    std::vector<std::unique_ptr<Mserver>> classes;
+    std::map<uint32_t, std::shared_ptr<const seal::GaloisKeys>> client_galois_keys;
+    std::mutex key_mutex;
+    int threads;
+};
+
+class VarLenPIRClient
+{
+public:
+    VarLenPIRClient(std::shared_ptr<const VarLenLayout> layout, int rotation_window = 1);
+
+    seal::GaloisKeys get_galois_keys() {return clients[0]->get_galois_keys();}
+
+    std::vector<PIRQuery> gen_query(uint32_t record);
+
+    //返回上一次gen_query的记录
+    std::vector<unsigned char> decode_response(const std::vector<PIRReply>& replys);
+
+private:
+    std::shared_ptr<const VarLenLayout> layout;
+    std::vector<std::unique_ptr<Mclient>> clients;
+    std::vector<int64_t> last_chunks;                   //last_chunks[q]: 第q个查询取回的是记录的第几块，-1表示假查询
+    uint32_t last_record;
+};
+
+#endif
@@ -0,0 +1,148 @@
+//按库的形状(记录数、记录大小)选择最快的安全参数，-v时用选出的参数实际跑一次查询验证预测
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <iomanip>
+
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+#include "mtuner.hpp"
+
+void print_usage();
+int main(int argc, char *argv[])
+{
+    size_t num_obj = 0;
+    size_t obj_size = 0;
+    TuneOptions options;
+    bool validate = false;
+    int option;
+    const char *optstring = "n:s:o:a:r:m:k:v";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            num_obj = std::stoi(optarg);
+            break;
+        case 's':
+            obj_size = std::stoi(optarg);
+            break;
+        case 'o':
+        {
+            std::string target(optarg);
+            if (target == "latency")
+                options.target = TuneTarget::kLatency;
+            else if (target == "bytes")
+                options.target = TuneTarget::kBytes;
+            else if (target == "mix")
+                options.target = TuneTarget::kMix;
+            else
+            {
+                print_usage();
+                return 1;
+            }
+            break;
+        }
+        case 'a':
+            options.weight = std::stod(optarg);
+            break;
+        case 'r':
+            options.repeat = std::stoi(optarg);
+            break;
+        case 'm':
+            options.min_noise_budget = std::stoi(optarg);
+            break;
+        case 'k':
+            options.query_count = std::stoi(optarg);
+            break;
+        case 'v':
+            validate = true;
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (!num_obj || !obj_size || options.weight < 0 || options.weight > 1)
+    {
+        print_usage();
+        return 1;
+    }
+
+    std::vector<TuneCandidate> candidates = tune_params(num_obj, obj_size, options);
+    std::cout << std::setw(6) << "N" << std::setw(6) << "bits" << std::setw(6) << "pack" << std::setw(8) << "noise"
+              << std::setw(8) << "query" << std::setw(8) << "reply" << std::setw(14) << "server(us)" << std::setw(14) << "client(us)"
+              << std::setw(14) << "query(B)" << std::setw(14) << "reply(B)" << std::setw(12) << "score" << std::endl;
+    for (auto& c : candidates)
+    {
+        std::cout << std::setw(6) << c.poly_degree << std::setw(6) << c.plain_bits << std::setw(6) << c.pack_factor
+                  << std::setw(8) << c.noise_budget << std::setw(8) << c.num_query_ciphertext << std::setw(8) << c.reply_ciphertext_num
+                  << std::setw(14) << (long long)c.server_us << std::setw(14) << (long long)c.client_us
+                  << std::setw(14) << c.query_bytes << std::setw(14) << c.reply_bytes << std::setw(12) << c.score
+                  << (c.safe ? "" : "  (noise budget too small)") << std::endl;
+    }
+    const TuneCandidate& best = candidates.front();
+    if (!best.safe)
+    {
+        std::cout << "no parameter set has enough noise budget" << std::endl;
+        return 1;
+    }
+    std::cout << std::endl << "chosen: N = " << best.poly_degree << " plain bits = " << best.plain_bits << " pack factor = " << best.pack_factor << std::endl;
+    std::cout << "predicted server time (us): " << (long long)best.server_us << std::endl;
+    std::cout << "predicted client time (us): " << (long long)best.client_us << std::endl;
+    std::cout << "predicted query size (bytes): " << best.query_bytes << std::endl;
+    std::cout << "predicted reply size (bytes): " << best.reply_bytes << std::endl;
+    if (!validate)
+        return 0;
+
+    //验证: 用选出的参数建库，查询随机的一条记录，比较实际时间和预测
+    FastPIRParams params = best.params(num_obj, obj_size);
+    std::mt19937_64 rng(std::random_device{}());
+    std::vector<std::vector<unsigned char>> db(num_obj, std::vector<unsigned char>(params.get_record_size()));
+    for (auto& record : db)
+    {
+        for (auto& c : record)
+        {
+            c = rng() % 0xFF;
+        }
+    }
+    Mserver server(params);
+    Mclient client(params);
+    server.set_db(db);
+    server.preprocess_db();
+    server.set_client_galois_keys(0, client.get_galois_keys());
+
+    std::chrono::high_resolution_clock::time_point time_start, time_end;
+    uint32_t record = rng() % num_obj;
+    time_start = std::chrono::high_resolution_clock::now();
+    Query query = client.gen_query(client.db_index(record));
+    time_end = std::chrono::high_resolution_clock::now();
+    auto query_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+    time_start = std::chrono::high_resolution_clock::now();
+    PIRReply reply = server.get_response(0, query.query);
+    time_end = std::chrono::high_resolution_clock::now();
+    auto response_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+    time_start = std::chrono::high_resolution_clock::now();
+    std::vector<unsigned char> obj = client.decode_response(reply, client.db_index(record));
+    time_end = std::chrono::high_resolution_clock::now();
+    auto decode_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+    int noise_budget = client.getDec()->invariant_noise_budget(reply[0]);
+    bool incorrect_result = client.extract_record(obj, record) != db[record];
+    std::cout << std::endl << (incorrect_result ? "PIR Result is incorrect!" : "PIR result correct!") << std::endl;
+    std::cout << "Reply noise budget (bits): " << noise_budget << " (simulated worst case " << best.noise_budget << ")" << std::endl;
+    std::cout << "Response generation time (us): " << response_time << " (predicted " << (long long)best.server_us << ")" << std::endl;
+    std::cout << "Query generation + decode time (us): " << query_time + decode_time << " (predicted " << (long long)best.client_us << ")" << std::endl;
+    std::cout << "Reply ciphertexts: " << reply.size() << " (predicted " << best.reply_ciphertext_num << ")" << std::endl;
+    return incorrect_result;
+}
+
+void print_usage()
+{
+    std::cout << "usage: param_tuner -n <number of records> -s <record size> [-o latency|bytes|mix] [-a <latency weight for mix>]"
+              << " [-r <repeats per primitive>] [-m <min noise budget>] [-k <queries per request>] [-v]" << std::endl;
+}
@@ -0,0 +1,136 @@
+//用硬件计数器分析get_response的各阶段(query_ntt、内积扫描库、旋转树): cycles、指令数、LLC访问/缺失，
+//估计每个阶段达到的内存带宽并与实测的单核STREAM峰值比较，判断当前部署是计算受限还是带宽受限
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <random>
+
+#include "bfvparams.h"
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+#include "mperf.hpp"
+
+void print_usage();
+int main(int argc, char *argv[])
+{
+    size_t num_obj = 0;
+    size_t obj_size = 0;
+    size_t poly_degree = POLY_MODULUS_DEGREE;
+    size_t plain_bits = PLAIN_BIT;
+    int repeat = 5;
+    size_t stream_mb = 64;
+    int option;
+    const char *optstring = "n:s:N:b:r:m:";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            num_obj = std::stoi(optarg);
+            break;
+        case 's':
+            obj_size = std::stoi(optarg);
+            break;
+        case 'N':
+            poly_degree = std::stoi(optarg);
+            break;
+        case 'b':
+            plain_bits = std::stoi(optarg);
+            break;
+        case 'r':
+            repeat = std::stoi(optarg);
+            break;
+        case 'm':
+            stream_mb = std::stoi(optarg);
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (!num_obj || !obj_size || repeat <= 0 || !stream_mb)
+    {
+        print_usage();
+        return 1;
+    }
+    if (FastPIRParams::find_param_set(poly_degree, plain_bits) == nullptr)
+    {
+        std::cout << "unsupported BFV parameters: N = " << poly_degree << " plain bits = " << plain_bits << std::endl;
+        return 1;
+    }
+    obj_size += obj_size % 2;
+
+    std::cout << "measuring single-core stream bandwidth ..." << std::endl;
+    double peak_gbps = measure_stream_bandwidth(stream_mb << 20);
+    std::cout << "stream triad peak " << peak_gbps << " GB/s" << std::endl;
+
+    FastPIRParams params(num_obj, obj_size, poly_degree, plain_bits);
+    std::mt19937_64 rng(std::random_device{}());
+    std::vector<std::vector<unsigned char>> db(num_obj, std::vector<unsigned char>(obj_size));
+    for (auto& record : db)
+    {
+        for (auto& c : record)
+        {
+            c = rng() % 0xFF;
+        }
+    }
+    Mserver server(params);
+    Mclient client(params);
+    server.set_db(db);
+    server.preprocess_db();
+    server.set_client_galois_keys(0, client.get_galois_keys());
+
+    PerfProfiler profiler;
+    if (!PerfProfiler::thread_group().available())
+        std::cout << "hardware counters unavailable (check /proc/sys/kernel/perf_event_paranoid), reporting wall time only" << std::endl;
+    server.set_profiler(&profiler);
+    //预热一次，库和key都进过缓存后再统计
+    uint32_t index = rng() % num_obj;
+    server.get_response(0, client.gen_query(index).query);
+    profiler.reset();
+
+    bool incorrect_result = false;
+    for (int r = 0; r < repeat; r++)
+    {
+        index = rng() % num_obj;
+        PIRQuery query = client.gen_query(index).query;
+        PIRReply reply = server.get_response(0, query);
+        incorrect_result |= client.decode_response(reply, index) != db[index];
+    }
+    server.set_profiler(nullptr);
+
+    std::cout << std::left << std::setw(15) << "phase" << std::right << std::setw(8) << "calls" << std::setw(12) << "ms/query"
+              << std::setw(14) << "cycles" << std::setw(14) << "instructions" << std::setw(7) << "IPC"
+              << std::setw(14) << "LLC refs" << std::setw(14) << "LLC misses" << std::setw(10) << "DRAM GB/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    double dram_gbps[kPhaseCount];
+    for (int p = 0; p < kPhaseCount; p++)
+    {
+        PhaseProfile prof = profiler.get((PerfPhase)p);
+        double seconds = prof.ns / 1e9;
+        double ipc = prof.counters[kCounterCycles] ? (double)prof.counters[kCounterInstructions] / prof.counters[kCounterCycles] : 0;
+        //每次LLC缺失按一个64字节的cache line从内存读入估计
+        dram_gbps[p] = seconds > 0 ? prof.counters[kCounterLlcMisses] * 64.0 / seconds / 1e9 : 0;
+        std::cout << std::left << std::setw(15) << PerfProfiler::phase_name(p) << std::right << std::setw(8) << prof.calls
+                  << std::setw(12) << prof.ns / 1e6 / repeat << std::setw(14) << prof.counters[kCounterCycles] / repeat
+                  << std::setw(14) << prof.counters[kCounterInstructions] / repeat << std::setw(7) << ipc
+                  << std::setw(14) << prof.counters[kCounterLlcReferences] / repeat << std::setw(14) << prof.counters[kCounterLlcMisses] / repeat
+                  << std::setw(10) << dram_gbps[p] << std::endl;
+    }
+
+    //内积每次查询把编码后的库完整读一遍
+    PhaseProfile scan = profiler.get(kPhaseInnerProduct);
+    double scan_gbps = scan.ns > 0 ? (double)server.get_metrics().db_bytes * repeat / (scan.ns / 1e9) / 1e9 : 0;
+    double achieved = PerfProfiler::thread_group().available() ? dram_gbps[kPhaseInnerProduct] : scan_gbps;
+    std::cout << "db scan: " << server.get_metrics().db_bytes / 1e6 << " MB per query, " << scan_gbps << " GB/s logical, "
+              << dram_gbps[kPhaseInnerProduct] << " GB/s from DRAM (" << (peak_gbps > 0 ? 100 * achieved / peak_gbps : 0) << "% of stream peak)" << std::endl;
+    std::cout << "db scan is " << (peak_gbps > 0 && achieved >= 0.6 * peak_gbps ? "bandwidth-bound" : "compute-bound") << std::endl;
+    std::cout << (incorrect_result ? "PIR Result is incorrect!" : "PIR result correct!") << std::endl;
+    return incorrect_result;
+}
+
+void print_usage()
+{
+    std::cout << "usage: perf_profile -n <number of objects> -s <object size> [-N <poly degree>] [-b <plain bits>] [-r <queries>] [-m <stream MB per array>]" << std::endl;
+}
@@ -0,0 +1,179 @@
+//比较多查询移动的两种实现: 逐个move_query 与 hoisted move_queries
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+
+#include "bfvparams.h"
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+
+void print_usage();
+bool same_plain(Mclient& client, seal::BatchEncoder& encoder, const PIRQuery& a, const PIRQuery& b);
+int main(int argc, char *argv[])
+{
+    size_t obj_size = 0;
+    size_t num_obj = 0;
+    size_t poly = 8192;
+    size_t p = 40;
+    int repeat = 3;
+    int rotation_window = 1;
+    int option;
+    const char *optstring = "n:s:N:p:r:w:";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            num_obj = std::stoi(optarg);
+            break;
+        case 's':
+            obj_size = std::stoi(optarg);
+            break;
+        case 'N':
+            poly = std::stoi(optarg);
+            break;
+        case 'p':
+            p = std::stoi(optarg);
+            break;
+        case 'r':
+            repeat = std::stoi(optarg);
+            break;
+        case 'w':
+            rotation_window = std::stoi(optarg);
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (!num_obj || !obj_size)
+    {
+        print_usage();
+        return 1;
+    }
+    if(obj_size%2 == 1) {
+        obj_size++;
+    }
+
+    srand(time(NULL));
+    std::chrono::high_resolution_clock::time_point time_start, time_end;
+    FastPIRParams params(num_obj, obj_size, poly, p);
+    Mserver server(params);
+    Mclient client(params, rotation_window);
+    seal::BatchEncoder encoder(*client.getContext());
+    seal::GaloisKeys gal_keys = client.get_galois_keys();
+    RotationPlanner planner(poly / 2, RotationPlanner::available_steps(*client.getContext(), gal_keys));
+
+    //所有step的平均/最大旋转次数: 贪心(get_real_coeff_step)、NAF、不同key集合下的最优分解
+    {
+        int rowSize = poly / 2;
+        double greedy_sum = 0, naf_sum = 0;
+        size_t greedy_max = 0, naf_max = 0;
+        for(int t = -rowSize / 2 + 1; t <= rowSize / 2; ++t)
+        {
+            size_t count = 0;
+            for(int step = t; step != 0; ++count)
+            {
+                step -= server.get_real_coeff_step(step);
+            }
+            greedy_sum += count;
+            greedy_max = std::max(greedy_max, count);
+            size_t naf = RotationPlanner::naf(t, rowSize).size();
+            naf_sum += naf;
+            naf_max = std::max(naf_max, naf);
+        }
+        std::cout << "plan\tkeys\tavg rotations\tmax rotations" << std::endl;
+        std::cout << "greedy\t" << 2 * (int)std::log2(rowSize) << "\t" << greedy_sum / rowSize << "\t" << greedy_max << std::endl;
+        std::cout << "naf\t" << 2 * (int)std::log2(rowSize) << "\t" << naf_sum / rowSize << "\t" << naf_max << std::endl;
+        for(int w = 1; w <= 4; ++w)
+        {
+            RotationPlanner p(rowSize, Mclient::rotation_key_steps(poly, w));
+            std::cout << "window " << w << "\t" << p.steps().size() << "\t" << p.average_rotations() << "\t" << p.max_rotations() << std::endl;
+        }
+        std::cout << "client keys (window " << rotation_window << "): " << planner.steps().size() << " steps" << std::endl << std::endl;
+    }
+
+    std::cout << "params : n = " << num_obj << " size = " << obj_size << " N = " << params.get_poly_modulus_degree()
+              << " query ciphertext = " << server.get_query_ciphertext_count() << std::endl;
+    std::cout << "k\tmove_query(us)\tmove_queries(us)\tkey switch\thoisted key switch\tspeedup" << std::endl;
+    for(int k : {2, 4, 8, 16, 32})
+    {
+        //k个index，第一个作为基准，其余k-1个需要移动
+        std::vector<int> desires(k);
+        for(auto& d : desires)
+        {
+            d = rand() % num_obj;
+        }
+        std::vector<int> indexOffsets(k - 1);
+        std::vector<int> coeffOffsets(k - 1);
+        for(int i = 1; i < k; ++i)
+        {
+            indexOffsets[i - 1] = desires[i] / (poly / 2) - desires[0] / (poly / 2);
+            coeffOffsets[i - 1] = -(desires[i] % (poly / 2) - desires[0] % (poly / 2));
+        }
+        Query query = client.gen_query(desires[0], indexOffsets, coeffOffsets);
+
+        long long naive_time = 0, hoisted_time = 0;
+        size_t naive_switch = 0;
+        ResponseStats hoisted_stats;
+        std::vector<PIRQuery> naive, hoisted;
+        for(int r = 0; r < repeat; ++r)
+        {
+            naive.clear();
+            time_start = std::chrono::high_resolution_clock::now();
+            for(size_t i = 0; i < coeffOffsets.size(); ++i)
+            {
+                PIRQuery temp = query.query;
+                server.move_query(temp, indexOffsets[i], coeffOffsets[i], gal_keys, &planner);
+                naive.push_back(std::move(temp));
+            }
+            time_end = std::chrono::high_resolution_clock::now();
+            naive_time += (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+            hoisted_stats = ResponseStats();
+            time_start = std::chrono::high_resolution_clock::now();
+            hoisted = server.move_queries(query.query, indexOffsets, coeffOffsets, gal_keys, &planner, &hoisted_stats);
+            time_end = std::chrono::high_resolution_clock::now();
+            hoisted_time += (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+        }
+        naive_switch = hoisted_stats.planned_rotations;
+
+        for(size_t i = 0; i < naive.size(); ++i)
+        {
+            if(!same_plain(client, encoder, naive[i], hoisted[i]))
+            {
+                std::cout << "k = " << k << " moved query " << i << " mismatch!" << std::endl;
+                return 1;
+            }
+        }
+        std::cout << k << "\t" << naive_time / repeat << "\t" << hoisted_time / repeat << "\t"
+                  << naive_switch << "\t" << hoisted_stats.move_rotations << "\t"
+                  << (double)naive_time / std::max(hoisted_time, 1LL) << std::endl;
+    }
+    std::cout << "moved queries decrypt identically" << std::endl;
+}
+
+bool same_plain(Mclient& client, seal::BatchEncoder& encoder, const PIRQuery& a, const PIRQuery& b)
+{
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); ++i)
+    {
+        seal::Plaintext pa, pb;
+        std::vector<uint64_t> va, vb;
+        client.getDec()->decrypt(a[i], pa);
+        client.getDec()->decrypt(b[i], pb);
+        encoder.decode(pa, va);
+        encoder.decode(pb, vb);
+        if(va != vb)
+            return false;
+    }
+    return true;
+}
+
+void print_usage()
+{
+    std::cout << "usage: rotation_bench -n <number of objects> -s <object size in bytes> [-N <poly degree>] [-p <plain bits>] [-r <repeat>] [-w <rotation key window>]" << std::endl;
+}
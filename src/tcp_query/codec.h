@@ -4,13 +4,110 @@
 #include "muduo/net/Buffer.h"
 #include "muduo/net/Endian.h"
 #include "muduo/net/TcpConnection.h"
+#include<algorithm>
+#include<cstring>
+#include<functional>
 #include<sstream>
 using namespace muduo;
 using namespace muduo::net;
+
+// frame: | int64 len | int8 type | int64 request id | payload(len - kFrameHeaderLen) |
+// request id由客户端分配，服务端原样带回，同一连接上的多个请求可以乱序返回
+enum MsgType : int8_t
+{
+    kGaloisKey = 1,             //client -> server  payload: galois keys
+    kKeyAck = 2,                //server -> client  payload: empty
+    kQuery = 3,                 //client -> server  payload: queryCount (indexOffset coeffOffset)* (size ciphertext)*
+    kReply = 4,                 //server -> client  payload: (size ciphertext)*
+    kError = 5,                 //server -> client  payload: empty
+    kBusy = 6,                  //server -> client  payload: empty，服务端过载，请求被拒绝或丢弃
+    kRangeQuery = 7,            //client -> server  payload: offset(int64) length(int64) (size ciphertext)*，只取回消息的[offset, offset + length)字节，回复为kReply
+    kParams = 8                 //server -> client  payload: poly degree(int32) plain bits(int32) num obj(int64) obj size(int64) [db version(int64)]，连接建立后首先发送，request id为0
+};
+
+//握手: 服务端把库的参数发给客户端，客户端按这些参数构造Mclient，同一个客户端程序可以连接不同参数的服务端
+struct ServerParams
+{
+    uint32_t poly_degree;
+    uint32_t plain_bits;
+    uint64_t num_obj;
+    uint64_t obj_size;
+    uint64_t db_version = 0;            //库内容变化时改变，客户端缓存据此失效；旧的服务端不发送时为0
+};
+
+inline bool parseServerParams(const std::string& payload, ServerParams& params)
+{
+    const size_t baseSize = 2 * sizeof(int32_t) + 2 * sizeof(int64_t);
+    if(payload.size() != baseSize && payload.size() != baseSize + sizeof(int64_t))
+        return false;
+    Buffer buf;
+    buf.append(payload);
+    params.poly_degree = sockets::networkToHost32(buf.readInt32());
+    params.plain_bits = sockets::networkToHost32(buf.readInt32());
+    params.num_obj = sockets::networkToHost64(buf.readInt64());
+    params.obj_size = sockets::networkToHost64(buf.readInt64());
+    params.db_version = buf.readableBytes() >= sizeof(int64_t) ? sockets::networkToHost64(buf.readInt64()) : 0;
+    return true;
+}
+
+//可选的服务端计时(kReply的最后一项，长度字段为负的trailer长度):
+//旧的客户端把负的长度当作格式错误，丢弃回复并断开连接，所以只有在所有客户端都已更新时服务端才能用-T开启
+// fieldCount(int32) field(int64)*  按下面的顺序，新增的字段只能加在末尾，读取时多余的忽略、缺少的为0
+struct ServerTiming
+{
+    uint64_t queue_us = 0;              //收到请求到开始处理(调度器排队)
+    uint64_t deserialize_us = 0;
+    uint64_t query_ntt_us = 0;
+    uint64_t inner_product_us = 0;      //扫描库: 内积和逆NTT
+    uint64_t rotation_us = 0;
+    uint64_t packing_us = 0;            //包含其中回复对齐的旋转
+    uint64_t serialize_us = 0;
+    uint64_t total_us = 0;              //收到请求到回复交给连接
+    uint64_t multiply_plain = 0;
+    uint64_t rotations = 0;
+
+    static const int32_t kFieldCount = 10;
+
+    void fields(uint64_t* out) const
+    {
+        const uint64_t values[kFieldCount] = {queue_us, deserialize_us, query_ntt_us, inner_product_us, rotation_us, packing_us,
+                                              serialize_us, total_us, multiply_plain, rotations};
+        std::copy(values, values + kFieldCount, out);
+    }
+    void setFields(const uint64_t* values, int32_t count)
+    {
+        uint64_t* targets[kFieldCount] = {&queue_us, &deserialize_us, &query_ntt_us, &inner_product_us, &rotation_us, &packing_us,
+                                          &serialize_us, &total_us, &multiply_plain, &rotations};
+        for(int32_t i = 0; i < kFieldCount; ++i)
+            *targets[i] = i < count ? values[i] : 0;
+    }
+};
+
+const int64_t kFrameHeaderLen = sizeof(int8_t) + sizeof(int64_t);
+
+//muduo的Buffer前面只留了8字节的prepend空间，放不下17字节的header，因此先占住header的位置，payload写完后再填入
+inline void beginFrame(Buffer* buf)
+{
+    char header[sizeof(int64_t) + kFrameHeaderLen] = {0};
+    buf->append(header, sizeof(header));
+}
+
+inline void finishFrame(Buffer* buf, MsgType type, uint64_t requestId)
+{
+    int64_t len = sockets::hostToNetwork64(buf->readableBytes() - sizeof(int64_t));
+    uint64_t id = sockets::hostToNetwork64(requestId);
+    char* header = const_cast<char*>(buf->peek());          //header已在可读区的开头，Buffer只提供const的peek
+    memcpy(header, &len, sizeof(len));
+    header[sizeof(len)] = type;
+    memcpy(header + sizeof(len) + sizeof(int8_t), &id, sizeof(id));
+}
+
 class QueryCodeC
 {
 public:
     typedef std::function<void (const muduo::net::TcpConnectionPtr&,
+                                MsgType type,
+                                uint64_t requestId,
                                 const std::string& query,
                                 muduo::Timestamp)> QueryMessageCallback;
     QueryCodeC(const QueryMessageCallback& cb)
@@ -25,7 +122,7 @@ public:
         {
             int64_t count64 = buf->peekInt64();
             int64_t byteCount = sockets::networkToHost64(count64);
-            if(byteCount < 0)
+            if(byteCount < kFrameHeaderLen)
             {
                 LOG_INFO << "invalid len: " << byteCount;
                 conn->shutdown();
@@ -34,9 +131,11 @@ public:
             else if(byteCount + sizeof(int64_t) <= buf->readableBytes())
             {
                 buf->retrieve(sizeof(int64_t));
-                std::string msg(buf->peek(), byteCount);
-                buf->retrieve(byteCount);
-                m_cb(conn, msg, receiveTime);
+                MsgType type = static_cast<MsgType>(buf->readInt8());
+                uint64_t requestId = sockets::networkToHost64(buf->readInt64());
+                std::string msg(buf->peek(), byteCount - kFrameHeaderLen);
+                buf->retrieve(byteCount - kFrameHeaderLen);
+                m_cb(conn, type, requestId, msg, receiveTime);
             }
             else
             {
@@ -45,17 +144,48 @@ public:
         }
     }
 
-    void send(const TcpConnectionPtr& conn, const std::vector<std::stringstream>& serReply)
+    void send(const TcpConnectionPtr& conn, uint64_t requestId, const std::vector<std::stringstream>& serReply, const ServerTiming* timing = nullptr)
     {
         Buffer buf;
+        beginFrame(&buf);
         for(int i = 0; i < serReply.size(); ++i)            //add size|ciphertext to buffer
         {
             std::string temp = serReply[i].str();
             buf.appendInt32(sockets::hostToNetwork32(temp.size()));
             buf.append(temp.data(), temp.size());
         }
-        int64_t len = buf.readableBytes();
-        buf.prependInt64(sockets::hostToNetwork64(len));
+        if(timing)
+        {
+            uint64_t values[ServerTiming::kFieldCount];
+            timing->fields(values);
+            int32_t trailerLen = sizeof(int32_t) + ServerTiming::kFieldCount * sizeof(int64_t);
+            buf.appendInt32(sockets::hostToNetwork32(-trailerLen));
+            buf.appendInt32(sockets::hostToNetwork32(ServerTiming::kFieldCount));
+            for(int i = 0; i < ServerTiming::kFieldCount; ++i)
+                buf.appendInt64(sockets::hostToNetwork64(values[i]));
+        }
+        finishFrame(&buf, kReply, requestId);
+        conn->send(&buf);
+    }
+
+    void sendParams(const TcpConnectionPtr& conn, const ServerParams& params)
+    {
+        Buffer buf;
+        beginFrame(&buf);
+        buf.appendInt32(sockets::hostToNetwork32(params.poly_degree));
+        buf.appendInt32(sockets::hostToNetwork32(params.plain_bits));
+        buf.appendInt64(sockets::hostToNetwork64(params.num_obj));
+        buf.appendInt64(sockets::hostToNetwork64(params.obj_size));
+        buf.appendInt64(sockets::hostToNetwork64(params.db_version));
+        finishFrame(&buf, kParams, 0);
+        conn->send(&buf);
+    }
+
+    void sendStatus(const TcpConnectionPtr& conn, MsgType type, uint64_t requestId)          //只有header的消息(ack/error/busy)
+    {
+        Buffer buf;
+        beginFrame(&buf);
+        finishFrame(&buf, type, requestId);
         conn->send(&buf);
     }
 private:
@@ -66,21 +196,28 @@ private:
 class ReplyCodec
 {
 public:
-    typedef std::function<void (const std::vector<std::string>&)> ReplyCallBack;
-    
+    typedef std::function<void (MsgType type, uint64_t requestId, const std::vector<std::string>&)> ReplyCallBack;
+    typedef std::function<void (uint64_t requestId, const ServerTiming&)> TimingCallBack;
+
     ReplyCodec(const ReplyCallBack& cb):m_cb(cb)
     {
 
     }
-    
-    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime)
+
+    //回复带有服务端计时时，在回复的回调之前调用
+    void setTimingCallback(const TimingCallBack& cb)
     {
-        // len   sublen1 ciphertext1 sublen2 ciphertext2 ...
+        m_timingcb = cb;
+    }
+
+    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp /*receiveTime*/)
+    {
+        // len type requestId  sublen1 ciphertext1 sublen2 ciphertext2 ...
         while(buf->readableBytes() >= sizeof(uint64_t))
         {
             int64_t count64 = buf->peekInt64();
             int64_t byteCount = sockets::networkToHost64(count64);
-            if(byteCount < 0)
+            if(byteCount < kFrameHeaderLen)
             {
                 LOG_ERROR << "invalid reply count: " << byteCount;
                 conn->shutdown();
@@ -89,26 +226,62 @@ public:
             if(buf->readableBytes() >= sizeof(uint64_t) + byteCount)
             {
                 buf->retrieveInt64();
+                MsgType type = static_cast<MsgType>(buf->readInt8());
+                uint64_t requestId = sockets::networkToHost64(buf->readInt64());
                 std::vector<std::string> replyStream;
-                int64_t offset = 0;
+                if(type == kParams)
+                {
+                    //参数消息不是密文流，整个payload作为一项交给回调
+                    replyStream.push_back(buf->retrieveAsString(byteCount - kFrameHeaderLen));
+                    m_cb(type, requestId, replyStream);
+                    continue;
+                }
+                int64_t offset = kFrameHeaderLen;
                 int replyNum = 0;
+                bool hasTiming = false;
+                ServerTiming timing;
                 while(offset < byteCount)
                 {
                     int32_t streamLen = sockets::networkToHost32(buf->peekInt32());
                     buf->retrieveInt32();
                     offset += sizeof(int32_t);
+                    if(streamLen < 0)
+                    {
+                        //服务端计时trailer
+                        streamLen = -streamLen;
+                        offset += streamLen;
+                        if(offset > byteCount || streamLen < sizeof(int32_t))
+                        {
+                            LOG_ERROR << "invalid timing trailer, len = " << streamLen << " byteCount = " << byteCount;
+                            conn->shutdown();
+                            return;
+                        }
+                        int32_t fieldCount = sockets::networkToHost32(buf->readInt32());
+                        int32_t available = (streamLen - sizeof(int32_t)) / sizeof(int64_t);
+                        fieldCount = std::max(0, std::min(fieldCount, available));
+                        std::vector<uint64_t> values(fieldCount);
+                        for(int32_t i = 0; i < fieldCount; ++i)
+                            values[i] = sockets::networkToHost64(buf->readInt64());
+                        buf->retrieve(streamLen - sizeof(int32_t) - fieldCount * sizeof(int64_t));
+                        timing.setFields(values.data(), fieldCount);
+                        hasTiming = true;
+                        continue;
+                    }
                     offset += streamLen;
                     if(offset > byteCount || buf->readableBytes() < streamLen)
                     {
                         LOG_ERROR << "invalid reply stream count, reply num = " << replyNum + 1 << " byteCount = " << byteCount << " readable bytes = " << buf->readableBytes();
                         conn->shutdown();
-                        break;
+                        return;
                     }
                     std::string temp = std::string(buf->peek(), streamLen);
                     replyStream.push_back(std::move(temp));
                     buf->retrieve(streamLen);
+                    replyNum++;
                 }
-                m_cb(replyStream);
+                if(hasTiming && m_timingcb)
+                    m_timingcb(requestId, timing);
+                m_cb(type, requestId, replyStream);
             }
             else
             {
@@ -117,36 +290,58 @@ public:
         }
     }
 
-    void sendKey(const TcpConnectionPtr& conn, const std::string& gal_key)
+    void sendKey(const TcpConnectionPtr& conn, uint64_t requestId, const std::string& gal_key)
+    {
+        sendPayload(conn, kGaloisKey, requestId, gal_key);
+    }
+
+    //已经编码好的payload(如trace中记录的请求)原样加上header发送
+    void sendPayload(const TcpConnectionPtr& conn, MsgType type, uint64_t requestId, const std::string& payload)
     {
         Buffer buf;
-        buf.append(gal_key);
-        int64_t len = buf.readableBytes();
-        buf.prependInt64(sockets::hostToNetwork64(len));
+        beginFrame(&buf);
+        buf.append(payload);
+        finishFrame(&buf, type, requestId);
         conn->send(&buf);
     }
 
-    void send(const TcpConnectionPtr& conn, const std::vector<int>& indexOffset, const std::vector<int>& coeffOffset, const std::vector<std::string>& queryStream)
+    void send(const TcpConnectionPtr& conn, uint64_t requestId, const std::vector<int>& indexOffset, const std::vector<int>& coeffOffset, const std::vector<std::string>& queryStream)
     {
         Buffer buf;
+        beginFrame(&buf);
         buf.appendInt32(sockets::hostToNetwork32(indexOffset.size() + 1));
         for(int i = 0; i < coeffOffset.size(); ++i)
         {
             buf.appendInt32(sockets::hostToNetwork32(indexOffset[i]));
             buf.appendInt32(sockets::hostToNetwork32(coeffOffset[i]));
         }
-        
+
+        for(int i = 0; i < queryStream.size(); ++i)
+        {
+            buf.appendInt32(sockets::hostToNetwork32(queryStream[i].size()));
+            buf.append(queryStream[i]);
+        }
+        finishFrame(&buf, kQuery, requestId);
+        conn->send(&buf);
+    }
+
+    void sendRange(const TcpConnectionPtr& conn, uint64_t requestId, size_t offset, size_t length, const std::vector<std::string>& queryStream)
+    {
+        Buffer buf;
+        beginFrame(&buf);
+        buf.appendInt64(sockets::hostToNetwork64(offset));
+        buf.appendInt64(sockets::hostToNetwork64(length));
         for(int i = 0; i < queryStream.size(); ++i)
         {
             buf.appendInt32(sockets::hostToNetwork32(queryStream[i].size()));
             buf.append(queryStream[i]);
         }
-        int64_t len = buf.readableBytes();
-        buf.prependInt64(sockets::hostToNetwork64(len));
+        finishFrame(&buf, kRangeQuery, requestId);
         conn->send(&buf);
     }
 private:
     ReplyCallBack m_cb;
+    TimingCallBack m_timingcb;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,70 @@
+#ifndef __MMETRICS_HTTP_H__
+#define __MMETRICS_HTTP_H__
+#include "muduo/base/Logging.h"
+#include "muduo/net/Buffer.h"
+#include "muduo/net/EventLoop.h"
+#include "muduo/net/TcpServer.h"
+#include <functional>
+#include <string>
+using namespace muduo;
+using namespace muduo::net;
+
+//最简单的HTTP监听: 只响应GET /metrics，返回render()的结果(Prometheus文本格式)，每个请求回复后关闭连接。
+//和查询服务共用一个EventLoop，只有被抓取时才调用render
+class MetricsHttpServer
+{
+public:
+    typedef std::function<std::string ()> RenderCallback;
+
+    MetricsHttpServer(EventLoop* loop, const InetAddress& listenAddr, const RenderCallback& render)
+        :m_tcpserver(loop, listenAddr, "metrics_server"), m_render(render)
+    {
+        m_tcpserver.setMessageCallback(std::bind(&MetricsHttpServer::onMessage, this, _1, _2, _3));
+    }
+
+    void start()
+    {
+        m_tcpserver.start();
+    }
+
+private:
+    static const size_t kMaxRequestSize = 8192;
+
+    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp)
+    {
+        std::string request(buf->peek(), buf->readableBytes());
+        size_t end = request.find("\r\n\r\n");
+        if(end == std::string::npos)
+        {
+            if(request.size() > kMaxRequestSize)
+                conn->forceClose();
+            return;                                 //请求头还没收完
+        }
+        buf->retrieveAll();
+        size_t lineEnd = request.find("\r\n");
+        std::string line = request.substr(0, lineEnd);
+        if(line.compare(0, 12, "GET /metrics") == 0 && (line.size() == 12 || line[12] == ' ' || line[12] == '?'))
+        {
+            reply(conn, "200 OK", "text/plain; version=0.0.4", m_render());
+        }
+        else
+        {
+            reply(conn, "404 Not Found", "text/plain", "not found\n");
+        }
+    }
+
+    static void reply(const TcpConnectionPtr& conn, const char* status, const char* type, const std::string& body)
+    {
+        Buffer out;
+        out.append("HTTP/1.1 " + std::string(status) + "\r\nContent-Type: " + type + "\r\nContent-Length: " + std::to_string(body.size())
+                   + "\r\nConnection: close\r\n\r\n");
+        out.append(body);
+        conn->send(&out);
+        conn->shutdown();
+    }
+
+    TcpServer m_tcpserver;
+    RenderCallback m_render;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef __MQUERY_SCHEDULER_H__
+#define __MQUERY_SCHEDULER_H__
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../mfastpirparams.hpp"
+#include "../mcostmodel.hpp"
+
+//按FastPIRParams估计一个请求的代价(单位: 一次multiply_plain)。
+//给出measure_primitives实测的时间时，旋转和逆NTT的权重按实测相对于内积每一项的比例，否则用经验值
+class QueryCostEstimator
+{
+public:
+    static constexpr double kRotationWeight = 30;       //一次旋转(key switch)约等于30次multiply_plain
+    static constexpr double kInttWeight = 4;
+
+    QueryCostEstimator(FastPIRParams params, const PrimitiveTimings* timings = nullptr)
+    {
+        double N = params.get_poly_modulus_degree();
+        m_rotationWeight = timings ? timings->rotate / timings->inner_product_term : kRotationWeight;
+        m_inttWeight = timings ? timings->intt / timings->inner_product_term : kInttWeight;
+        m_nqc = params.get_num_query_ciphertext();
+        m_rowsize = N / 2;
+        m_scancost = scanCost(params.get_num_columns_per_obj() / 2);
+        m_movecost = m_nqc * std::log2(N / 2) / 2 * m_rotationWeight;        //随机偏移平均需要log2(N/2)/2次旋转
+    }
+
+    //queryCount = 1 + coeffOffset的个数，每个额外的index多一次全库扫描和一次查询移动
+    double estimate(int queryCount) const
+    {
+        return queryCount * m_scancost + (queryCount - 1) * (m_movecost + m_rotationWeight);
+    }
+
+    //按字节范围取回时只扫描范围内的列
+    double estimateRange(uint32_t firstColumn, uint32_t lastColumn) const
+    {
+        return scanCost(lastColumn - firstColumn + 1);
+    }
+
+private:
+    double scanCost(double columns) const
+    {
+        return m_nqc * columns + columns * m_inttWeight + (columns - std::ceil(columns / m_rowsize)) * m_rotationWeight;
+    }
+
+    double m_rotationWeight;
+    double m_inttWeight;
+    double m_nqc;
+    double m_rowsize;
+    double m_scancost;
+    double m_movecost;
+};
+
+struct SchedulerConfig
+{
+    int workers = 1;
+    size_t max_queued = 256;                //全局排队上限
+    size_t max_queued_per_client = 32;      //单个客户端排队上限
+    int max_inflight_per_client = 1;        //单个客户端同时执行的请求数
+    double deadline = 5;                    //排队超过deadline(s)的请求直接拒绝，<=0表示不限制
+};
+
+//加权公平队列: 每个请求的finish tag = max(V, 该客户端上一个finish tag) + cost / weight，按最小finish tag调度
+//队列满时优先丢弃排队代价最大的客户端的请求，被拒绝/丢弃的请求调用shed回复busy
+class QueryScheduler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    struct Task
+    {
+        uint32_t client;
+        double cost;
+        std::function<void ()> run;
+        std::function<void ()> shed;
+        Clock::time_point deadline;
+        double start;
+        double finish;
+    };
+
+    QueryScheduler(const SchedulerConfig& config)
+        :m_config(config), m_vtime(0), m_queued(0), m_stop(false)
+    {
+
+    }
+
+    ~QueryScheduler()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        for(int i = 0; i < m_config.workers; ++i)
+        {
+            m_workers.emplace_back(&QueryScheduler::workerLoop, this);
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        for(auto& t : m_workers)
+        {
+            t.join();
+        }
+        m_workers.clear();
+    }
+
+    void setWeight(uint32_t client, double weight)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_clients[client].weight = weight;
+    }
+
+    //提交请求，返回false表示请求被拒绝(此时已经调用过shed)
+    bool submit(uint32_t client, double cost, const std::function<void ()>& run, const std::function<void ()>& shed)
+    {
+        std::vector<Task> victims;
+        bool accepted = true;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ClientQueue& queue = m_clients[client];
+            if(queue.tasks.size() >= m_config.max_queued_per_client)
+            {
+                accepted = false;
+            }
+            else if(m_queued >= m_config.max_queued)
+            {
+                //丢弃排队代价最大的客户端的最后一个请求，除非提交者自己就是最重的
+                auto heaviest = m_clients.end();
+                for(auto it = m_clients.begin(); it != m_clients.end(); ++it)
+                {
+                    if(!it->second.tasks.empty() && (heaviest == m_clients.end() || it->second.queued_cost > heaviest->second.queued_cost))
+                        heaviest = it;
+                }
+                if(heaviest != m_clients.end() && heaviest->first != client && heaviest->second.queued_cost > queue.queued_cost + cost)
+                {
+                    victims.push_back(popBack(heaviest->second));
+                }
+                else
+                {
+                    accepted = false;
+                }
+            }
+            if(accepted)
+            {
+                Task task;
+                task.client = client;
+                task.cost = cost;
+                task.run = run;
+                task.shed = shed;
+                task.deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_config.deadline));
+                task.start = std::max(m_vtime, queue.last_finish);
+                task.finish = task.start + cost / queue.weight;
+                queue.last_finish = task.finish;
+                queue.queued_cost += cost;
+                queue.tasks.push_back(std::move(task));
+                m_queued++;
+            }
+        }
+        for(auto& t : victims)
+        {
+            t.shed();
+        }
+        if(!accepted)
+        {
+            shed();
+            return false;
+        }
+        m_cond.notify_one();
+        return true;
+    }
+
+    //连接断开时丢弃该客户端所有排队中的请求
+    void removeClient(uint32_t client)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_clients.find(client);
+        if(it == m_clients.end())
+            return;
+        m_queued -= it->second.tasks.size();
+        if(it->second.inflight == 0)
+            m_clients.erase(it);
+        else
+        {
+            it->second.tasks.clear();
+            it->second.queued_cost = 0;
+            it->second.removed = true;          //等执行中的请求结束后再删除
+        }
+    }
+
+    size_t queued()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queued;
+    }
+
+private:
+    struct ClientQueue
+    {
+        std::deque<Task> tasks;
+        double weight = 1;
+        double last_finish = 0;
+        double queued_cost = 0;
+        int inflight = 0;
+        bool removed = false;
+    };
+
+    Task popBack(ClientQueue& queue)
+    {
+        Task task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        queue.queued_cost -= task.cost;
+        queue.last_finish = queue.tasks.empty() ? task.start : queue.tasks.back().finish;
+        m_queued--;
+        return task;
+    }
+
+    //在锁内调用: 选出可以执行的finish tag最小的请求，过期的请求放到expired中
+    bool pick(Task& task, std::vector<Task>& expired)
+    {
+        auto now = Clock::now();
+        auto best = m_clients.end();
+        for(auto it = m_clients.begin(); it != m_clients.end(); ++it)
+        {
+            ClientQueue& queue = it->second;
+            while(m_config.deadline > 0 && !queue.tasks.empty() && queue.tasks.front().deadline < now)
+            {
+                queue.queued_cost -= queue.tasks.front().cost;
+                expired.push_back(std::move(queue.tasks.front()));
+                queue.tasks.pop_front();
+                m_queued--;
+            }
+            if(queue.tasks.empty() || queue.inflight >= m_config.max_inflight_per_client)
+                continue;
+            if(best == m_clients.end() || queue.tasks.front().finish < best->second.tasks.front().finish)
+                best = it;
+        }
+        if(best == m_clients.end())
+            return false;
+        task = std::move(best->second.tasks.front());
+        best->second.tasks.pop_front();
+        best->second.queued_cost -= task.cost;
+        best->second.inflight++;
+        m_queued--;
+        m_vtime = task.start;
+        return true;
+    }
+
+    void workerLoop()
+    {
+        while(true)
+        {
+            Task task;
+            std::vector<Task> expired;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while(!m_stop && !pick(task, expired))
+                {
+                    if(!expired.empty())
+                        break;
+                    m_cond.wait(lock);
+                }
+                if(m_stop)
+                    return;
+            }
+            for(auto& t : expired)
+            {
+                t.shed();
+            }
+            if(!task.run)
+                continue;
+            task.run();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_clients.find(task.client);
+                if(it != m_clients.end() && --it->second.inflight == 0 && it->second.removed)
+                    m_clients.erase(it);
+            }
+            m_cond.notify_all();
+        }
+    }
+
+    SchedulerConfig m_config;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::map<uint32_t, ClientQueue> m_clients;
+    std::vector<std::thread> m_workers;
+    double m_vtime;                         //虚拟时间: 最近一次调度的请求的start tag
+    size_t m_queued;
+    bool m_stop;
+};
+
+#endif
@@ -5,18 +5,36 @@
 #include "muduo/net/TcpClient.h"
 #include "codec.h"
 #include "../mclient.hpp"
+#include "../mrecordcache.hpp"
+#include <algorithm>
 #include <iostream>
 #include <chrono>
+#include <map>
+#include <mutex>
 using namespace muduo;
 using namespace muduo::net;
+std::vector<int> generate_query(int query_count, int num_obj);
 class TcpQueryClient
 {
 public:
-    TcpQueryClient(EventLoop* loop, const InetAddress& address, size_t obj_num, size_t obj_size, bool multi)
-        :m_tcpclient(loop, address, "query client"), m_codec(std::bind(&TcpQueryClient::onReplyMessage, this, _1)), m_multiquery(multi)
+    //result为空表示请求失败(type != kReply)
+    typedef std::function<void (uint64_t requestId, MsgType type, const std::vector<unsigned char>& result)> QueryCallback;
+
+    struct RequestTiming                    //一个请求客户端各阶段的耗时，服务端带回计时时合并成端到端的分解
+    {
+        uint64_t gen_us = 0;
+        uint64_t serialize_us = 0;
+        std::chrono::steady_clock::time_point sent;
+        ServerTiming server;
+        bool has_server = false;
+    };
+
+    //库的参数(N、明文位数、消息数量和大小)在连接建立后由服务端的kParams消息给出
+    TcpQueryClient(EventLoop* loop, const InetAddress& address, int query_count, bool multi, int rotation_window = 1)
+        :m_tcpclient(loop, address, "query client"), m_codec(std::bind(&TcpQueryClient::onReplyMessage, this, _1, _2, _3)), m_multiquery(multi), m_nextid(1), m_finished(0),
+         m_querycount(query_count), m_rotationwindow(rotation_window)
     {
-        FastPIRParams params(obj_num, obj_size);
-        m_client.reset(new Mclient(params));
+        m_codec.setTimingCallback(std::bind(&TcpQueryClient::onServerTiming, this, _1, _2));     //codec按值绑定，要在setMessageCallback之前
         m_tcpclient.setConnectionCallback(std::bind(&TcpQueryClient::onConnction, this, _1));
         m_tcpclient.setMessageCallback(std::bind(&ReplyCodec::onMessage, m_codec, _1, _2, _3));
         m_tcpclient.enableRetry();
@@ -41,25 +59,97 @@ public:
         {
             m_connection = conn;
             time_start = std::chrono::high_resolution_clock::now();
-            sendKey();
-            if(m_multiquery)
-            {
-                LOG_INFO << "multi query start";
-                query();
-            }
-            else 
-            {
-                LOG_INFO << "single query start";
-                part_query();
-            }
         }
         else
             m_connection.reset();
         LOG_INFO << "connection " << (conn->connected() ? "UP" : "DOWN");
     }
 
-    void onReplyMessage(const std::vector<std::string>& replyStreams)
+    //收到服务端参数后构造Mclient，上传密钥并开始查询
+    void onParams(const std::string& payload)
+    {
+        ServerParams params;
+        if(!parseServerParams(payload, params) || FastPIRParams::find_param_set(params.poly_degree, params.plain_bits) == nullptr)
+        {
+            LOG_INFO << "unsupported server params";
+            m_connection->forceClose();
+            return;
+        }
+        LOG_INFO << "server params: N = " << params.poly_degree << " plain bits = " << params.plain_bits
+                 << " num_obj = " << params.num_obj << " obj_size = " << params.obj_size;
+        if(m_rangelength > 0 && (m_multiquery || m_rangeoffset + m_rangelength > params.obj_size))
+        {
+            LOG_INFO << "byte range must be inside the object and can't be used with -m";
+            m_connection->forceClose();
+            return;
+        }
+        auto keygen_start = std::chrono::steady_clock::now();
+        m_client.reset(new Mclient(FastPIRParams(params.num_obj, params.obj_size, params.poly_degree, params.plain_bits), m_rotationwindow, m_keycache));
+        LOG_INFO << "client keys ready in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - keygen_start).count() << " ms";
+        if(m_precompute > 0)
+            m_client->start_precompute(m_precompute);
+        if(m_cache)
+            m_cache->set_version(params.db_version);
+        m_index = generate_query(m_querycount, params.num_obj);
+        sendKey();
+        if(m_multiquery)
+        {
+            LOG_INFO << "multi query start";
+            query();
+        }
+        else 
+        {
+            LOG_INFO << "single query start";
+            part_query();
+        }
+    }
+
+    //服务端开启了计时trailer时，在onReplyMessage之前收到
+    void onServerTiming(uint64_t requestId, const ServerTiming& timing)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_pending.find(requestId);
+        if(it != m_pending.end())
+        {
+            it->second.timing.server = timing;
+            it->second.timing.has_server = true;
+        }
+    }
+
+    void onReplyMessage(MsgType type, uint64_t requestId, const std::vector<std::string>& replyStreams)
     {
+        if(type == kParams)
+        {
+            onParams(replyStreams[0]);
+            return;
+        }
+        auto received = std::chrono::steady_clock::now();
+        PendingRequest pending;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_pending.find(requestId);
+            if(it == m_pending.end())
+            {
+                LOG_INFO << "unknown request id = " << requestId << " type = " << (int)type;
+                return;
+            }
+            pending = std::move(it->second);
+            m_pending.erase(it);
+        }
+        if(type == kKeyAck)
+        {
+            LOG_INFO << "galois keys accepted, request id = " << requestId;
+            return;
+        }
+        if(type != kReply)
+        {
+            LOG_INFO << "request failed, request id = " << requestId << " type = " << (int)type;
+            if(pending.cb)
+                pending.cb(requestId, type, std::vector<unsigned char>());
+            return;
+        }
+
+        auto decode_start = std::chrono::steady_clock::now();
         std::vector<seal::Ciphertext> ciphers(replyStreams.size());
         for(int i = 0; i < ciphers.size(); ++i)
         {
@@ -67,81 +157,120 @@ public:
             temp << replyStreams[i];
             if(ciphers[i].load(*(m_client->getContext()), temp) == -1)
             {
-                LOG_INFO << "reply error, reply index = " << i;
+                LOG_INFO << "reply error, request id = " << requestId << " reply index = " << i;
                 m_connection->forceClose(); 
                 return;
             }
         }
-        //auto result = m_client->decode_response(ciphers, m_index[0], m_index.size());
-        if(m_multiquery)
+        std::vector<unsigned char> result;
+        if(pending.length > 0)
         {
-            auto result = m_client->decode_response(ciphers, m_index[0], m_index.size());
-            checkResult(result);
+            result = m_client->decode_range_response(ciphers, pending.index[0], pending.offset, pending.length);
         }
         else
         {
-            static int num = 0;
-            auto result = m_client->decode_response(ciphers, m_index[num++], 1);
-            partCheckResult(result);
+            for(auto& msg : m_client->decode_multi_response(ciphers, std::vector<uint32_t>(pending.index.begin(), pending.index.end())))
+            {
+                result.insert(result.end(), msg.begin(), msg.end());
+            }
         }
-        
+        logBreakdown(requestId, pending.timing, received, decode_start);
+        if(pending.cb)
+            pending.cb(requestId, type, result);
     }
     void sendKey()
     {
         auto key = m_client->get_galois_keys();
         std::stringstream ss;
         key.save(ss);
-        m_codec.sendKey(m_connection, ss.str());
+        uint64_t requestId = addPending(std::vector<int>(), QueryCallback(), RequestTiming());
+        m_codec.sendKey(m_connection, requestId, ss.str());
     }
 
-    void query()
+    //异步查询: index.size() > 1时为多查询，回复按request id匹配，可以同时有多个请求在途
+    uint64_t asyncQuery(const std::vector<int>& index, const QueryCallback& cb)
     {
+        assert(!index.empty());
         int N = m_client->get_poly_degree();
-        //m_index = index;
-        std::vector<int> indexOffsets(m_index.size() - 1);
-        std::vector<int> coeffOffsets(m_index.size() - 1);
-        for(int i = 1; i < m_index.size(); ++i)
+        std::vector<int> indexOffsets(index.size() - 1);
+        std::vector<int> coeffOffsets(index.size() - 1);
+        for(int i = 1; i < index.size(); ++i)
         {
-            indexOffsets[i - 1] = m_index[i] / (N / 2) - m_index[0] / (N / 2);  
-            coeffOffsets[i - 1] = -(m_index[i] %  (N / 2) - m_index[0] % (N / 2));
+            indexOffsets[i - 1] = index[i] / (N / 2) - index[0] / (N / 2);  
+            coeffOffsets[i - 1] = -(index[i] %  (N / 2) - index[0] % (N / 2));
         }
         std::vector<std::string> strQuery;
-        auto query = m_client->gen_query(m_index[0]);
+        RequestTiming timing;
+        if(!serializeQuery(index[0], strQuery, timing))
+            return 0;
+        timing.sent = std::chrono::steady_clock::now();
+        uint64_t requestId = addPending(index, cb, timing);
+        m_codec.send(m_connection, requestId, indexOffsets, coeffOffsets, strQuery);
+        return requestId;
+    }
+
+    //按字节范围查询: 只取回第index条消息的[offset, offset + length)字节
+    uint64_t asyncRangeQuery(int index, size_t offset, size_t length, const QueryCallback& cb)
+    {
+        assert(length > 0 && offset + length <= m_client->get_obj_size());
+        std::vector<std::string> strQuery;
+        RequestTiming timing;
+        if(!serializeQuery(index, strQuery, timing))
+            return 0;
+        timing.sent = std::chrono::steady_clock::now();
+        uint64_t requestId = addPending(std::vector<int>(1, index), cb, timing, offset, length);
+        m_codec.sendRange(m_connection, requestId, offset, length, strQuery);
+        return requestId;
+    }
+
+    bool serializeQuery(int index, std::vector<std::string>& strQuery, RequestTiming& timing)
+    {
+        auto gen_start = std::chrono::steady_clock::now();
+        auto query = m_client->gen_query(index);
+        auto serialize_start = std::chrono::steady_clock::now();
+        timing.gen_us = std::chrono::duration_cast<std::chrono::microseconds>(serialize_start - gen_start).count();
         for(int i = 0; i < query.query.size(); ++i)
         {
             std::stringstream temp;
             if(query.query[i].save(temp) == -1)
             {
-                LOG_INFO << "construct query stream failed, query index = " << m_index[0];
+                LOG_INFO << "construct query stream failed, query index = " << index;
                 m_connection->forceClose();
-                return;
+                return false;
             }
             strQuery.push_back(temp.str());
         }
         assert(m_client->get_num_query_ciphertext() == strQuery.size());
-        m_codec.send(m_connection, indexOffsets, coeffOffsets, strQuery);
+        timing.serialize_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - serialize_start).count();
+        return true;
+    }
+
+    void query()
+    {
+        lookup(m_index, [this](uint64_t, MsgType type, const std::vector<unsigned char>& result)
+        {
+            if(type == kReply)
+                checkResult(result);
+        });
     }
 
     void part_query()
     {
         for(int i = 0; i < m_index.size(); ++i)
         {
-            std::vector<std::string> strQuery;
-            auto query = m_client->gen_query(m_index[i]);
-            for(int j = 0; j < query.query.size(); ++j)
+            auto cb = [this, i](uint64_t, MsgType type, const std::vector<unsigned char>& result)
             {
-                std::stringstream temp;
-                if(query.query[j].save(temp) == -1)
-                {
-                    LOG_INFO << "construct query stream failed, query index = " << m_index[i];
-                    m_connection->forceClose();
+                partCheckResult(i, type == kReply ? result : std::vector<unsigned char>());
+            };
+            if(m_rangelength > 0)
+            {
+                uint64_t requestId = asyncRangeQuery(m_index[i], m_rangeoffset, m_rangelength, cb);
+                if(requestId == 0)
                     return;
-                }
-                strQuery.push_back(temp.str());
+                LOG_INFO << "query " << i << " send, request id = " << requestId;
             }
-            assert(m_client->get_num_query_ciphertext() == strQuery.size());
-            m_codec.send(m_connection, query.indexOffset, query.coeffOffset, strQuery);
-            LOG_INFO << "query " << i << " send";
+            else if(!lookup(std::vector<int>(1, m_index[i]), cb))
+                return;
         }
     }
 
@@ -167,24 +296,29 @@ public:
         time_end = std::chrono::high_resolution_clock::now();
         LOG_INFO << "num_obj = " << m_client->get_num_obj() << " obj_size = " << m_client->get_obj_size() << " query count = " << m_index.size()
                 << " query time = " << (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+        nextRound();
     }
 
-    void partCheckResult(const std::vector<unsigned char>& result)
+    void partCheckResult(int num, const std::vector<unsigned char>& result)          //回复可能乱序，num是该回复对应的查询序号
     {
-        static int num = 0;
-        int obj_size = m_client->get_obj_size();
+        size_t offset = m_rangelength > 0 ? m_rangeoffset : 0;
+        size_t length = m_rangelength > 0 ? m_rangelength : m_client->get_obj_size();
         int index = m_index[num];
-        for(int i = 0; i < obj_size; ++i)
+        m_finished++;
+        if(result.size() < length)
+        {
+            LOG_INFO << "result error! index = " << num << " request failed, query index = " << index;
+            return;
+        }
+        for(int i = 0; i < length; ++i)
         {
-            if(result[i] != (index + i) % 256)
+            if(result[i] != (index + offset + i) % 256)
             {
                 LOG_INFO << "result error! index = " << num << " offset = " << i << " query index = " << index;
-                num++;
                 return;
             }
         }
-        num++;
-        if(num == m_index.size())
+        if(m_finished == m_index.size())
         {
             LOG_INFO << "result correct! query indexs = ";
             for(auto& i : m_index)
@@ -194,14 +328,163 @@ public:
             time_end = std::chrono::high_resolution_clock::now();
             LOG_INFO << "num_obj = " << m_client->get_num_obj() << " obj_size = " << m_client->get_obj_size() << " query count = " << m_index.size()
                 << " query time = " << (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+            nextRound();
         }
     }
 
-    void setIndex(const std::vector<int>& index)
+    //一轮查询全部正确后，换一组随机index再查，直到做完m_rounds轮；index范围小时会重复，用来观察缓存命中
+    void nextRound()
     {
-        m_index = index;
+        if(m_cache)
+        {
+            RecordCache::Stats stats = m_cache->get_stats();
+            LOG_INFO << "record cache: " << m_cache->size() << " records, hits = " << stats.hits << " misses = " << stats.misses
+                     << " prefetched = " << stats.prefetched << " prefetch hits = " << stats.prefetch_hits;
+        }
+        if(--m_rounds <= 0)
+            return;
+        m_index = generate_query(m_querycount, m_client->get_num_obj());
+        m_finished = 0;
+        time_start = std::chrono::high_resolution_clock::now();
+        if(m_multiquery)
+            query();
+        else
+            part_query();
+    }
+
+    //先查本地缓存，未命中的按原来的宽度发一个多查询请求，空出的位置放预取或随机的index，服务端看不出哪些命中了。
+    //全部命中时回调在loop中稍后执行，不等回复，但仍然发一个同样宽度的请求(取回的都当作预取)，否则请求的有无会暴露命中
+    //result与asyncQuery相同，为各index的记录按顺序拼接。没有缓存时就是asyncQuery，失败时返回false
+    bool lookup(const std::vector<int>& index, const QueryCallback& cb)
+    {
+        if(!m_cache)
+            return asyncQuery(index, cb) != 0;
+        auto records = std::make_shared<std::vector<std::vector<unsigned char>>>(index.size());
+        std::vector<uint32_t> misses;
+        for(size_t i = 0; i < index.size(); ++i)
+        {
+            if(!m_cache->get(index[i], (*records)[i]))
+                misses.push_back(index[i]);
+        }
+        auto finish = [records, cb](uint64_t requestId)
+        {
+            std::vector<unsigned char> result;
+            for(auto& record : *records)
+            {
+                result.insert(result.end(), record.begin(), record.end());
+            }
+            if(cb)
+                cb(requestId, kReply, result);
+        };
+        bool allHit = misses.empty();
+        if(allHit)
+            m_tcpclient.getLoop()->queueInLoop(std::bind(finish, 0));
+        std::vector<uint32_t> request = m_cache->fill_request(misses, index.size(), m_client->get_num_obj(), m_prefetch);
+        std::vector<int> requestIndex(request.begin(), request.end());
+        size_t wanted = misses.size();
+        size_t obj_size = m_client->get_obj_size();
+        uint64_t requestId = asyncQuery(requestIndex, [this, index, records, request, wanted, obj_size, allHit, finish, cb](uint64_t requestId, MsgType type, const std::vector<unsigned char>& result)
+        {
+            if(type != kReply || result.size() < request.size() * obj_size)
+            {
+                if(cb && !allHit)
+                    cb(requestId, type, std::vector<unsigned char>());
+                return;
+            }
+            for(size_t k = 0; k < request.size(); ++k)
+            {
+                m_cache->put(request[k], result.data() + k * obj_size, obj_size, k >= wanted);
+            }
+            if(allHit)
+                return;
+            for(size_t i = 0; i < index.size(); ++i)
+            {
+                auto pos = std::find(request.begin(), request.begin() + wanted, (uint32_t)index[i]);
+                if(pos != request.begin() + wanted)
+                {
+                    size_t k = pos - request.begin();
+                    (*records)[i].assign(result.begin() + k * obj_size, result.begin() + (k + 1) * obj_size);
+                }
+            }
+            finish(requestId);
+        });
+        if(requestId != 0)
+            LOG_INFO << "lookup of " << index.size() << " records, " << wanted << " missed, request id = " << requestId;
+        return allHit || requestId != 0;
+    }
+
+    //后台预先加密queries个查询所需的0密文，空闲时补充
+    void setPrecompute(size_t queries)
+    {
+        m_precompute = queries;
+    }
+
+    //密钥缓存文件，参数相同时重启直接载入，不再生成galois key
+    void setKeyCache(const std::string& path)
+    {
+        m_keycache = path;
+    }
+
+    //capacity条记录的本地缓存，ttl后过期；prefetch时多查询请求中命中的位置换成预测的下一个index。按字节范围的查询不经过缓存
+    void setCache(size_t capacity, std::chrono::milliseconds ttl, bool prefetch)
+    {
+        m_cache.reset(new RecordCache(capacity, ttl));
+        m_prefetch = prefetch;
+    }
+
+    void setRounds(int rounds)
+    {
+        m_rounds = rounds;
+    }
+
+    //非多查询模式下按字节范围取回，length = 0表示取回整条消息
+    void setRange(size_t offset, size_t length)
+    {
+        m_rangeoffset = offset;
+        m_rangelength = length;
     }
 private:
+    struct PendingRequest                   //在途请求，收到回复后按request id取出
+    {
+        std::vector<int> index;
+        QueryCallback cb;
+        size_t offset;
+        size_t length;                      //按字节范围查询时非0
+        RequestTiming timing;
+    };
+
+    uint64_t addPending(const std::vector<int>& index, const QueryCallback& cb, const RequestTiming& timing, size_t offset = 0, size_t length = 0)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t requestId = m_nextid++;
+        m_pending[requestId] = PendingRequest{index, cb, offset, length, timing};
+        return requestId;
+    }
+
+    //network = 发出到收到回复 - 服务端从收到到发出，包括上传、下载和内核缓冲
+    void logBreakdown(uint64_t requestId, const RequestTiming& timing, std::chrono::steady_clock::time_point received,
+                      std::chrono::steady_clock::time_point decode_start)
+    {
+        auto now = std::chrono::steady_clock::now();
+        int64_t decode_us = std::chrono::duration_cast<std::chrono::microseconds>(now - decode_start).count();
+        int64_t round_trip_us = std::chrono::duration_cast<std::chrono::microseconds>(received - timing.sent).count();
+        int64_t total_us = timing.gen_us + timing.serialize_us + round_trip_us + decode_us;
+        if(!timing.has_server)
+        {
+            LOG_INFO << "request id = " << requestId << " timing(us): gen_query " << timing.gen_us << " serialize " << timing.serialize_us
+                     << " round trip " << round_trip_us << " decode " << decode_us << " total " << total_us;
+            return;
+        }
+        const ServerTiming& server = timing.server;
+        LOG_INFO << "request id = " << requestId << " timing(us): gen_query " << timing.gen_us << " serialize " << timing.serialize_us
+                 << " network " << round_trip_us - (int64_t)server.total_us
+                 << " server " << server.total_us << " [queue " << server.queue_us << " deserialize " << server.deserialize_us
+                 << " query_ntt " << server.query_ntt_us << " db scan " << server.inner_product_us << " rotation " << server.rotation_us
+                 << " packing " << server.packing_us << " serialize " << server.serialize_us
+                 << " multiply_plain " << server.multiply_plain << " rotations " << server.rotations << "]"
+                 << " decode " << decode_us << " total " << total_us;
+    }
+
     EventLoop* m_loop;
     EventLoopThread m_threadloop; 
     TcpClient m_tcpclient;
@@ -212,11 +495,24 @@ private:
     std::chrono::_V2::system_clock::time_point time_start;
     std::chrono::_V2::system_clock::time_point time_end;
     bool m_multiquery;
+    std::mutex m_mutex;
+    std::map<uint64_t, PendingRequest> m_pending;
+    uint64_t m_nextid;
+    size_t m_finished;
+    size_t m_rangeoffset = 0;
+    size_t m_rangelength = 0;
+    size_t m_precompute = 0;
+    std::string m_keycache;
+    std::unique_ptr<RecordCache> m_cache;
+    bool m_prefetch = false;
+    int m_rounds = 1;
+    int m_querycount;
+    int m_rotationwindow;
 };
 
 void print_usage()
 {
-    std::cout << "usage: -n <number of objects> -s <object size in bytes>  -a <ip address>  -p <port> -t <query count>" << std::endl;
+    std::cout << "usage: -a <ip address>  -p <port> -t <query count> [-m] [-w <rotation key window>] [-r <offset,length>] [-z <precomputed queries>] [-k <key cache file>] [-c <cache records>,<ttl seconds>] [-P] [-n <rounds>]" << std::endl;
 }
 
 std::vector<int> generate_query(int query_count, int num_obj)
@@ -231,14 +527,20 @@ std::vector<int> generate_query(int query_count, int num_obj)
 
 int main(int argc, char** argv)
 {
-    const char *optstring = "n:s:a:p:t:m:";
+    const char *optstring = "a:p:t:mw:r:z:k:c:Pn:";
     int option;
     std::string ip;
     int port;
     int query_count;
-    int num_obj;
-    int obj_size;
     bool multi = false; 
+    int rotation_window = 1;
+    size_t range_offset = 0, range_length = 0;
+    size_t precompute = 0;
+    std::string key_cache;
+    size_t cache_capacity = 0;
+    int cache_ttl = 0;
+    bool prefetch = false;
+    int rounds = 1;
     while ((option = getopt(argc, argv, optstring)) != -1)
     {
         switch (option)
@@ -252,15 +554,50 @@ int main(int argc, char** argv)
         case 't':
             query_count = std::stoi(optarg);
             break;
-        case 'n':
-            num_obj = std::stoi(optarg);
-            break;
-        case 's':
-            obj_size = std::stoi(optarg);
-            break;
         case 'm':
             multi = true;
             break;
+        case 'w':
+            rotation_window = std::stoi(optarg);
+            break;
+        case 'r':
+        {
+            std::string range(optarg);
+            size_t comma = range.find(',');
+            if(comma == std::string::npos)
+            {
+                print_usage();
+                return 1;
+            }
+            range_offset = std::stoul(range.substr(0, comma));
+            range_length = std::stoul(range.substr(comma + 1));
+            break;
+        }
+        case 'z':
+            precompute = std::stoul(optarg);
+            break;
+        case 'k':
+            key_cache = optarg;
+            break;
+        case 'c':
+        {
+            std::string cache(optarg);
+            size_t comma = cache.find(',');
+            if(comma == std::string::npos)
+            {
+                print_usage();
+                return 1;
+            }
+            cache_capacity = std::stoul(cache.substr(0, comma));
+            cache_ttl = std::stoi(cache.substr(comma + 1));
+            break;
+        }
+        case 'P':
+            prefetch = true;
+            break;
+        case 'n':
+            rounds = std::stoi(optarg);
+            break;
         case '?':
             print_usage();
             return 1;
@@ -269,10 +606,14 @@ int main(int argc, char** argv)
 
     EventLoop loop;
     InetAddress serverAddress(ip, port);
-    TcpQueryClient client(&loop, serverAddress, num_obj, obj_size, multi);
+    TcpQueryClient client(&loop, serverAddress, query_count, multi, rotation_window);
+    client.setRange(range_offset, range_length);
+    client.setPrecompute(precompute);
+    client.setKeyCache(key_cache);
+    client.setRounds(rounds);
+    if(cache_ttl > 0)
+        client.setCache(cache_capacity, std::chrono::seconds(cache_ttl), prefetch);
     client.connect();
-    std::vector<int> querys = generate_query(query_count, num_obj);
-    client.setIndex(querys);
     loop.loop();
     
 }
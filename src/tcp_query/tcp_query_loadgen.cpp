@@ -0,0 +1,461 @@
+//tcp_query_server压测工具: 模拟多个客户端(每个客户端有自己的密钥)，支持闭环/开环(固定到达率)、密钥上传风暴、单/多查询混合负载
+#include "muduo/base/Logging.h"
+#include "muduo/net/EventLoop.h"
+#include "muduo/net/EventLoopThread.h"
+#include "muduo/net/TcpClient.h"
+#include "codec.h"
+#include "../mhistogram.hpp"
+#include "../mclient.hpp"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <map>
+#include <atomic>
+using namespace muduo;
+using namespace muduo::net;
+
+typedef std::chrono::steady_clock Clock;
+
+struct LoadConfig
+{
+    std::string ip = "127.0.0.1";
+    int port = 8464;
+    size_t num_obj = 1000;
+    size_t obj_size = 288;
+    size_t poly_degree = POLY_MODULUS_DEGREE;
+    size_t plain_bits = PLAIN_BIT;
+    int clients = 8;
+    int key_sets = 0;                   //不同密钥的数量，0表示每个客户端一套
+    int io_threads = 4;
+    double duration = 10;               //s
+    double warmup = 1;                  //s，这段时间内的请求不计入统计
+    double rate = 0;                    //总到达率(qps)，0表示闭环
+    int depth = 1;                      //闭环时每个客户端的在途请求数
+    int max_outstanding = 64;           //开环时每个客户端的在途上限，超过则丢弃
+    int multi_k = 4;                    //多查询的index个数
+    double multi_fraction = 0;          //多查询占比
+    int storm_rounds = 0;               //>0时只做密钥上传风暴，每个客户端上传的轮数
+    std::string cache_dir;
+    std::string output;
+};
+
+//预先生成的客户端材料: 序列化后的galois key和一个查询，测量时不再生成密钥/加密
+struct ClientMaterial
+{
+    std::string galois_keys;
+    std::vector<std::string> query;
+};
+
+struct LoadStats
+{
+    LatencyHistogram all;
+    LatencyHistogram single;
+    LatencyHistogram multi;
+    LatencyHistogram key_upload;
+    std::atomic<uint64_t> bytes_out{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> busy{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> measuring{false};
+    std::atomic<bool> stopped{false};
+};
+
+class LoadClient
+{
+public:
+    LoadClient(EventLoop* loop, const InetAddress& address, int id, const ClientMaterial* material, LoadStats* stats, const LoadConfig& config)
+        :m_loop(loop), m_tcpclient(loop, address, "load client"), m_codec(std::bind(&LoadClient::onReply, this, _1, _2, _3)),
+         m_id(id), m_material(material), m_stats(stats), m_config(config), m_nextid(1), m_keyid(0), m_keyrounds(0), m_rng(id),
+         m_indexdist(0, config.num_obj - 1), m_uniform(0, 1)
+    {
+        m_tcpclient.setConnectionCallback(std::bind(&LoadClient::onConnection, this, _1));
+        m_tcpclient.setMessageCallback(std::bind(&LoadClient::onMessage, this, _1, _2, _3));
+    }
+
+    void connect()
+    {
+        m_tcpclient.connect();
+    }
+
+    void onConnection(const TcpConnectionPtr& conn)
+    {
+        if(conn->connected())
+        {
+            m_connection = conn;
+            conn->setTcpNoDelay(true);
+            sendKey();
+        }
+        else
+        {
+            m_connection.reset();
+        }
+    }
+
+    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime)
+    {
+        size_t before = buf->readableBytes();
+        m_codec.onMessage(conn, buf, receiveTime);
+        m_stats->bytes_in.fetch_add(before - buf->readableBytes(), std::memory_order_relaxed);
+    }
+
+    void onReply(MsgType type, uint64_t requestId, const std::vector<std::string>& replyStreams)
+    {
+        auto now = Clock::now();
+        if(type == kParams)
+        {
+            //预先生成的材料必须与服务端的参数一致
+            ServerParams params;
+            if(!parseServerParams(replyStreams[0], params) || params.poly_degree != m_config.poly_degree || params.plain_bits != m_config.plain_bits
+               || params.num_obj != m_config.num_obj || params.obj_size != m_config.obj_size)
+            {
+                LOG_ERROR << "client " << m_id << " server params don't match the load config";
+                m_stats->errors++;
+            }
+            return;
+        }
+        if(requestId == m_keyid)
+        {
+            m_stats->key_upload.record(std::chrono::duration_cast<std::chrono::microseconds>(now - m_keystart).count());
+            if(type != kKeyAck)
+                m_stats->errors++;
+            if(m_config.storm_rounds > 0)
+            {
+                if(++m_keyrounds < m_config.storm_rounds && !m_stats->stopped)
+                    sendKey();
+            }
+            else
+            {
+                start();
+            }
+            return;
+        }
+        auto it = m_pending.find(requestId);
+        if(it == m_pending.end())
+        {
+            return;
+        }
+        Pending pending = it->second;
+        m_pending.erase(it);
+        if(type == kBusy)
+        {
+            m_stats->busy++;
+        }
+        else if(type != kReply)
+        {
+            m_stats->errors++;
+        }
+        else if(pending.measured)
+        {
+            uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(now - pending.intended).count();
+            m_stats->all.record(latency);
+            (pending.multi ? m_stats->multi : m_stats->single).record(latency);
+        }
+        if(m_config.rate == 0 && !m_stats->stopped)
+        {
+            issue(Clock::now());                    //闭环: 收到一个回复就发下一个
+        }
+    }
+
+private:
+    struct Pending
+    {
+        Clock::time_point intended;                 //开环下按计划发送时间计算延迟，避免协调遗漏
+        bool multi;
+        bool measured;
+    };
+
+    void sendKey()
+    {
+        m_keyid = m_nextid++;
+        m_keystart = Clock::now();
+        m_codec.sendKey(m_connection, m_keyid, m_material->galois_keys);
+        m_stats->bytes_out.fetch_add(sizeof(int64_t) + kFrameHeaderLen + m_material->galois_keys.size(), std::memory_order_relaxed);
+    }
+
+    void start()
+    {
+        if(m_config.rate == 0)
+        {
+            for(int i = 0; i < m_config.depth; ++i)
+            {
+                issue(Clock::now());
+            }
+        }
+        else
+        {
+            scheduleArrival(Clock::now());
+        }
+    }
+
+    //开环: 每个客户端是速率为rate/clients的泊松过程
+    void scheduleArrival(Clock::time_point last)
+    {
+        std::exponential_distribution<double> interval(m_config.rate / m_config.clients);
+        auto next = last + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval(m_rng)));
+        double delay = std::chrono::duration<double>(next - Clock::now()).count();
+        m_loop->runAfter(delay > 0 ? delay : 0, [this, next]()
+        {
+            if(m_stats->stopped)
+                return;
+            if((int)m_pending.size() >= m_config.max_outstanding)
+                m_stats->dropped++;
+            else
+                issue(next);
+            scheduleArrival(next);
+        });
+    }
+
+    void issue(Clock::time_point intended)
+    {
+        if(!m_connection)
+            return;
+        bool multi = m_config.multi_fraction > 0 && m_uniform(m_rng) < m_config.multi_fraction;
+        int k = multi ? m_config.multi_k : 1;
+        //偏移量只影响服务端的旋转，使用随机的index即可
+        int N = m_config.poly_degree;
+        int base = m_indexdist(m_rng);
+        std::vector<int> indexOffsets(k - 1);
+        std::vector<int> coeffOffsets(k - 1);
+        for(int i = 1; i < k; ++i)
+        {
+            int index = m_indexdist(m_rng);
+            indexOffsets[i - 1] = index / (N / 2) - base / (N / 2);
+            coeffOffsets[i - 1] = -(index % (N / 2) - base % (N / 2));
+        }
+        uint64_t requestId = m_nextid++;
+        m_pending[requestId] = Pending{intended, multi, m_stats->measuring.load()};
+        m_codec.send(m_connection, requestId, indexOffsets, coeffOffsets, m_material->query);
+
+        uint64_t bytes = sizeof(int64_t) + kFrameHeaderLen + sizeof(int32_t) + (k - 1) * 2 * sizeof(int32_t);
+        for(auto& c : m_material->query)
+        {
+            bytes += sizeof(int32_t) + c.size();
+        }
+        m_stats->bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    EventLoop* m_loop;
+    TcpClient m_tcpclient;
+    TcpConnectionPtr m_connection;
+    ReplyCodec m_codec;
+    int m_id;
+    const ClientMaterial* m_material;
+    LoadStats* m_stats;
+    LoadConfig m_config;
+    uint64_t m_nextid;
+    uint64_t m_keyid;
+    int m_keyrounds;
+    Clock::time_point m_keystart;
+    std::map<uint64_t, Pending> m_pending;          //只在所属的loop线程中访问
+    std::mt19937_64 m_rng;
+    std::uniform_int_distribution<int> m_indexdist;
+    std::uniform_real_distribution<double> m_uniform;
+};
+
+bool load_material(const std::string& path, ClientMaterial& material)
+{
+    std::ifstream in(path, std::ios::binary);
+    if(!in)
+        return false;
+    uint64_t len = 0;
+    uint32_t count = 0;
+    in.read((char*)&len, sizeof(len));
+    material.galois_keys.resize(len);
+    in.read(&material.galois_keys[0], len);
+    in.read((char*)&count, sizeof(count));
+    material.query.resize(count);
+    for(auto& c : material.query)
+    {
+        in.read((char*)&len, sizeof(len));
+        c.resize(len);
+        in.read(&c[0], len);
+    }
+    return (bool)in;
+}
+
+void save_material(const std::string& path, const ClientMaterial& material)
+{
+    std::ofstream out(path, std::ios::binary);
+    uint64_t len = material.galois_keys.size();
+    uint32_t count = material.query.size();
+    out.write((const char*)&len, sizeof(len));
+    out.write(material.galois_keys.data(), len);
+    out.write((const char*)&count, sizeof(count));
+    for(auto& c : material.query)
+    {
+        len = c.size();
+        out.write((const char*)&len, sizeof(len));
+        out.write(c.data(), len);
+    }
+}
+
+//密钥生成很慢，多线程并行生成，并按参数缓存到cache_dir
+std::vector<ClientMaterial> prepare_materials(const LoadConfig& config, int count)
+{
+    std::vector<ClientMaterial> materials(count);
+    std::atomic<int> next(0);
+    auto worker = [&]()
+    {
+        for(int i = next++; i < count; i = next++)
+        {
+            std::string path;
+            if(!config.cache_dir.empty())
+            {
+                path = config.cache_dir + "/fastpir_" + std::to_string(config.num_obj) + "_" + std::to_string(config.obj_size)
+                     + "_" + std::to_string(config.poly_degree) + "_" + std::to_string(config.plain_bits) + "_" + std::to_string(i) + ".material";
+                if(load_material(path, materials[i]))
+                    continue;
+            }
+            FastPIRParams params(config.num_obj, config.obj_size, config.poly_degree, config.plain_bits);
+            Mclient client(params);
+            std::stringstream ss;
+            client.get_galois_keys().save(ss);
+            materials[i].galois_keys = ss.str();
+            Query q = client.gen_query(rand() % config.num_obj);
+            for(auto& c : q.query)
+            {
+                std::stringstream temp;
+                c.save(temp);
+                materials[i].query.push_back(temp.str());
+            }
+            if(!path.empty())
+                save_material(path, materials[i]);
+        }
+    };
+    std::vector<std::thread> threads;
+    int thread_count = std::max(1u, std::thread::hardware_concurrency());
+    for(int i = 0; i < thread_count; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    for(auto& t : threads)
+    {
+        t.join();
+    }
+    return materials;
+}
+
+void print_usage()
+{
+    std::cout << "usage: -a <ip address> -p <port> -n <number of objects> -s <object size in bytes> [-N <poly degree>] [-b <plain bits>] -c <clients> -u <key sets>" << std::endl
+              << "       -T <io threads> -d <duration s> -w <warmup s> -r <open-loop rate qps, 0 = closed loop> -D <closed-loop depth>" << std::endl
+              << "       -q <open-loop max outstanding per client> -k <multi query size> -f <multi query fraction>" << std::endl
+              << "       -S <key upload storm rounds> -C <material cache dir> -o <json output file>" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    LoadConfig config;
+    const char *optstring = "a:p:n:s:N:b:c:u:T:d:w:r:D:q:k:f:S:C:o:";
+    int option;
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a': config.ip = optarg; break;
+        case 'p': config.port = std::stoi(optarg); break;
+        case 'n': config.num_obj = std::stoi(optarg); break;
+        case 's': config.obj_size = std::stoi(optarg); break;
+        case 'N': config.poly_degree = std::stoi(optarg); break;
+        case 'b': config.plain_bits = std::stoi(optarg); break;
+        case 'c': config.clients = std::stoi(optarg); break;
+        case 'u': config.key_sets = std::stoi(optarg); break;
+        case 'T': config.io_threads = std::stoi(optarg); break;
+        case 'd': config.duration = std::stod(optarg); break;
+        case 'w': config.warmup = std::stod(optarg); break;
+        case 'r': config.rate = std::stod(optarg); break;
+        case 'D': config.depth = std::stoi(optarg); break;
+        case 'q': config.max_outstanding = std::stoi(optarg); break;
+        case 'k': config.multi_k = std::stoi(optarg); break;
+        case 'f': config.multi_fraction = std::stod(optarg); break;
+        case 'S': config.storm_rounds = std::stoi(optarg); break;
+        case 'C': config.cache_dir = optarg; break;
+        case 'o': config.output = optarg; break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if(config.clients <= 0 || config.io_threads <= 0 || config.multi_k <= 0)
+    {
+        print_usage();
+        return 1;
+    }
+    if(config.key_sets <= 0 || config.key_sets > config.clients)
+        config.key_sets = config.clients;
+
+    LOG_INFO << "preparing " << config.key_sets << " client key sets ...";
+    std::vector<ClientMaterial> materials = prepare_materials(config, config.key_sets);
+    LOG_INFO << "client key sets ready";
+
+    LoadStats stats;
+    if(config.storm_rounds > 0)
+        stats.measuring = true;                     //风暴模式下所有上传都计入统计
+    std::vector<std::unique_ptr<EventLoopThread>> threads;
+    std::vector<EventLoop*> loops;
+    for(int i = 0; i < config.io_threads; ++i)
+    {
+        threads.emplace_back(new EventLoopThread);
+        loops.push_back(threads.back()->startLoop());
+    }
+    InetAddress serverAddress(config.ip, config.port);
+    std::vector<std::unique_ptr<LoadClient>> clients;
+    for(int i = 0; i < config.clients; ++i)
+    {
+        clients.emplace_back(new LoadClient(loops[i % loops.size()], serverAddress, i, &materials[i % materials.size()], &stats, config));
+    }
+
+    EventLoop loop;
+    Clock::time_point measure_start;
+    Clock::time_point measure_end;
+    auto begin = Clock::now();
+    for(auto& c : clients)
+    {
+        c->connect();
+    }
+    loop.runAfter(config.storm_rounds > 0 ? 0 : config.warmup, [&]()
+    {
+        measure_start = Clock::now();
+        stats.measuring = true;
+    });
+    loop.runAfter((config.storm_rounds > 0 ? 0 : config.warmup) + config.duration, [&]()
+    {
+        measure_end = Clock::now();
+        stats.measuring = false;
+        stats.stopped = true;
+        loop.quit();
+    });
+    loop.loop();
+
+    double seconds = std::chrono::duration<double>(measure_end - measure_start).count();
+    std::stringstream json;
+    json << "{" << std::endl
+         << "  \"mode\": \"" << (config.storm_rounds > 0 ? "key_storm" : (config.rate == 0 ? "closed_loop" : "open_loop")) << "\"," << std::endl
+         << "  \"num_obj\": " << config.num_obj << ", \"obj_size\": " << config.obj_size << "," << std::endl
+         << "  \"clients\": " << config.clients << ", \"key_sets\": " << config.key_sets << "," << std::endl
+         << "  \"target_rate\": " << config.rate << ", \"depth\": " << config.depth << ", \"multi_k\": " << config.multi_k
+         << ", \"multi_fraction\": " << config.multi_fraction << "," << std::endl
+         << "  \"duration_s\": " << seconds << ", \"wall_s\": " << std::chrono::duration<double>(Clock::now() - begin).count() << "," << std::endl
+         << "  \"requests\": " << stats.all.count() << ", \"errors\": " << stats.errors << ", \"busy\": " << stats.busy << ", \"dropped\": " << stats.dropped << "," << std::endl
+         << "  \"qps\": " << (seconds > 0 ? stats.all.count() / seconds : 0) << "," << std::endl
+         << "  \"latency_us\": " << stats.all.to_json() << "," << std::endl
+         << "  \"single_latency_us\": " << stats.single.to_json() << "," << std::endl
+         << "  \"multi_latency_us\": " << stats.multi.to_json() << "," << std::endl
+         << "  \"key_upload_us\": " << stats.key_upload.to_json() << "," << std::endl
+         << "  \"bytes_out\": " << stats.bytes_out << ", \"bytes_in\": " << stats.bytes_in << std::endl
+         << "}" << std::endl;
+    if(config.output.empty())
+    {
+        std::cout << json.str() << std::flush;          //_exit不会刷新stdio的缓冲
+    }
+    else
+    {
+        std::ofstream out(config.output);
+        out << json.str();
+    }
+    //客户端的连接由各自的loop线程持有，直接退出
+    _exit(0);
+}
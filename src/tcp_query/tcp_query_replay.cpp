@@ -0,0 +1,435 @@
+//回放tcp_query_server -R记录的trace: 按原来的到达时间(可按-x加速/减速)把key和查询发给本机的tcp_query_server，
+//或者(-l)直接交给进程内的Mserver，统计延迟分布。同一个trace在两个版本上回放即可比较性能
+#include "muduo/base/Logging.h"
+#include "muduo/net/EventLoop.h"
+#include "muduo/net/TcpClient.h"
+#include "codec.h"
+#include "../mhistogram.hpp"
+#include "trace.h"
+#include "../mserver.hpp"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <map>
+#include <atomic>
+using namespace muduo;
+using namespace muduo::net;
+
+typedef std::chrono::steady_clock Clock;
+
+//延迟从计划的发出时间算起(开环)，服务端跟不上时排队的时间也计入
+struct ReplayStats
+{
+    LatencyHistogram all;
+    LatencyHistogram single;
+    LatencyHistogram multi;
+    LatencyHistogram range;
+    LatencyHistogram key_upload;
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> busy{0};
+
+    void record(const TraceRecord& record, int32_t queryCount, uint64_t us)
+    {
+        if(record.type == kGaloisKey)
+        {
+            key_upload.record(us);
+            return;
+        }
+        all.record(us);
+        if(record.type == kRangeQuery)
+            range.record(us);
+        else if(queryCount > 1)
+            multi.record(us);
+        else
+            single.record(us);
+    }
+};
+
+int32_t query_count(const TraceRecord& record)
+{
+    if(record.type != kQuery || record.payload.size() < sizeof(int32_t))
+        return 0;
+    Buffer buf;
+    buf.append(record.payload.data(), sizeof(int32_t));
+    return sockets::networkToHost32(buf.peekInt32());
+}
+
+Clock::time_point scheduled_time(Clock::time_point start, const TraceRecord& record, double speed)
+{
+    return start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(record.arrival_us / 1e6 / speed));
+}
+
+//与tcp_query_server相同的解析: size1 cipher1 size2 cipher2 ...
+bool parse_ciphertexts(Buffer* buf, Mserver& server, PIRQuery& query)
+{
+    std::stringstream ss;
+    query.resize(server.get_query_ciphertext_count());
+    for(int i = 0; i < server.get_query_ciphertext_count(); i++)
+    {
+        if(buf->readableBytes() < sizeof(int32_t))
+            return false;
+        int serSize = sockets::networkToHost32(buf->peekInt32());
+        buf->retrieveInt32();
+        ss << buf->retrieveAsString(serSize);
+        if(query[i].load(server.getContext(), ss) == -1)
+            return false;
+    }
+    return true;
+}
+
+bool run_query(Mserver& server, const TraceRecord& record)
+{
+    Buffer buf;
+    buf.append(record.payload);
+    PIRQuery query;
+    if(record.type == kRangeQuery)
+    {
+        if(buf.readableBytes() < 2 * sizeof(int64_t))
+            return false;
+        size_t offset = sockets::networkToHost64(buf.readInt64());
+        size_t length = sockets::networkToHost64(buf.readInt64());
+        if(length == 0 || offset >= server.get_obj_size() || length > server.get_obj_size() - offset || !parse_ciphertexts(&buf, server, query))
+            return false;
+        server.get_range_response(record.client_id, query, offset, length);
+        return true;
+    }
+    int32_t count = query_count(record);
+    if(count <= 0 || buf.readableBytes() < sizeof(int32_t) + (count - 1) * 2 * sizeof(int32_t))
+        return false;
+    buf.retrieveInt32();
+    Query q;
+    q.indexOffset.resize(count - 1);
+    q.coeffOffset.resize(count - 1);
+    for(int i = 0; i < count - 1; ++i)
+    {
+        q.indexOffset[i] = sockets::networkToHost32(buf.readInt32());
+        q.coeffOffset[i] = sockets::networkToHost32(buf.readInt32());
+    }
+    if(!parse_ciphertexts(&buf, server, q.query))
+        return false;
+    server.get_multi_response(record.client_id, q);
+    return true;
+}
+
+//进程内回放: 主线程按时间分发，key直接在主线程设置(保证同一客户端之后的查询能用到)，查询交给workers个线程
+void replay_local(const ServerParams& params, const std::vector<TraceRecord>& records, double speed, int workers, ReplayStats& stats)
+{
+    Mserver server(FastPIRParams(params.num_obj, params.obj_size, params.poly_degree, params.plain_bits));
+    //与tcp_query_server的generate_db相同
+    std::vector<std::vector<unsigned char>> db(params.num_obj, std::vector<unsigned char>(params.obj_size));
+    for(size_t i = 0; i < params.num_obj; ++i)
+    {
+        for(size_t j = 0; j < params.obj_size; ++j)
+        {
+            db[i][j] = (unsigned char)((i + j) % 256);
+        }
+    }
+    server.set_db(db);
+    server.preprocess_db();
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::pair<const TraceRecord*, Clock::time_point>> queue;
+    bool done = false;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < workers; ++i)
+    {
+        threads.emplace_back([&]()
+        {
+            while(true)
+            {
+                std::pair<const TraceRecord*, Clock::time_point> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [&]() { return done || !queue.empty(); });
+                    if(queue.empty())
+                        return;
+                    task = queue.front();
+                    queue.pop_front();
+                }
+                bool ok;
+                try
+                {
+                    ok = run_query(server, *task.first);
+                }
+                catch(const std::exception&)                //没有key(trace不完整)或密文不合法
+                {
+                    ok = false;
+                }
+                if(!ok)
+                {
+                    stats.errors++;
+                    continue;
+                }
+                stats.record(*task.first, query_count(*task.first), std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - task.second).count());
+            }
+        });
+    }
+
+    auto start = Clock::now();
+    for(auto& record : records)
+    {
+        Clock::time_point intended = scheduled_time(start, record, speed);
+        std::this_thread::sleep_until(intended);
+        if(record.type == kGaloisKey)
+        {
+            std::stringstream ss(record.payload);
+            seal::GaloisKeys gk;
+            if(gk.load(server.getContext(), ss) == -1)
+            {
+                stats.errors++;
+                continue;
+            }
+            server.set_client_galois_keys(record.client_id, gk);
+            stats.record(record, 0, std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - intended).count());
+            continue;
+        }
+        if(server.get_key(record.client_id) == nullptr)
+        {
+            stats.errors++;
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.emplace_back(&record, intended);
+        cond.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cond.notify_all();
+    for(auto& t : threads)
+    {
+        t.join();
+    }
+}
+
+//trace中的一个客户端，对应一个连接，按原来的request id发送
+class ReplayClient
+{
+public:
+    ReplayClient(EventLoop* loop, const InetAddress& address, const ServerParams& params, ReplayStats* stats, std::function<void ()> onReady, std::function<void ()> onDone)
+        :m_tcpclient(loop, address, "replay client"), m_codec(std::bind(&ReplayClient::onReply, this, _1, _2, _3)),
+         m_params(params), m_stats(stats), m_onready(onReady), m_ondone(onDone)
+    {
+        m_tcpclient.setConnectionCallback(std::bind(&ReplayClient::onConnection, this, _1));
+        m_tcpclient.setMessageCallback(std::bind(&ReplyCodec::onMessage, m_codec, _1, _2, _3));
+    }
+
+    void connect()
+    {
+        m_tcpclient.connect();
+    }
+
+    void onConnection(const TcpConnectionPtr& conn)
+    {
+        if(conn->connected())
+        {
+            conn->setTcpNoDelay(true);
+            m_connection = conn;
+        }
+        else
+        {
+            m_connection.reset();
+            m_stats->errors += m_pending.size();
+            for(size_t i = 0; i < m_pending.size(); ++i)
+                m_ondone();
+            m_pending.clear();
+        }
+    }
+
+    //发出一条记录，没有连接时算作错误
+    void send(const TraceRecord* record, Clock::time_point intended)
+    {
+        if(!m_connection)
+        {
+            m_stats->errors++;
+            m_ondone();
+            return;
+        }
+        m_pending[record->request_id] = std::make_pair(record, intended);
+        m_codec.sendPayload(m_connection, record->type, record->request_id, record->payload);
+    }
+
+    void onReply(MsgType type, uint64_t requestId, const std::vector<std::string>& replyStreams)
+    {
+        auto now = Clock::now();
+        if(type == kParams)
+        {
+            ServerParams params;
+            if(!parseServerParams(replyStreams[0], params) || params.poly_degree != m_params.poly_degree || params.plain_bits != m_params.plain_bits
+               || params.num_obj != m_params.num_obj || params.obj_size != m_params.obj_size)
+            {
+                LOG_ERROR << "server params don't match the trace";
+                m_stats->errors++;
+            }
+            m_onready();
+            return;
+        }
+        auto it = m_pending.find(requestId);
+        if(it == m_pending.end())
+            return;
+        const TraceRecord* record = it->second.first;
+        Clock::time_point intended = it->second.second;
+        m_pending.erase(it);
+        if(type == kBusy)
+            m_stats->busy++;
+        else if(type != kReply && type != kKeyAck)
+            m_stats->errors++;
+        else
+            m_stats->record(*record, query_count(*record), std::chrono::duration_cast<std::chrono::microseconds>(now - intended).count());
+        m_ondone();
+    }
+
+private:
+    TcpClient m_tcpclient;
+    TcpConnectionPtr m_connection;
+    ReplyCodec m_codec;
+    ServerParams m_params;
+    ReplayStats* m_stats;
+    std::function<void ()> m_onready;
+    std::function<void ()> m_ondone;
+    std::map<uint64_t, std::pair<const TraceRecord*, Clock::time_point>> m_pending;          //只在loop线程中访问
+};
+
+//所有连接都收到kParams后开始按时间发送，全部回复(或timeout秒后)结束
+void replay_tcp(const std::string& ip, int port, const ServerParams& params, const std::vector<TraceRecord>& records, double speed, double timeout, ReplayStats& stats)
+{
+    EventLoop loop;
+    InetAddress serverAddress(ip, port);
+    size_t ready = 0;
+    size_t remaining = records.size();
+    std::map<uint32_t, std::unique_ptr<ReplayClient>> clients;
+    auto onDone = [&]()
+    {
+        if(--remaining == 0)
+            loop.quit();
+    };
+    auto onReady = [&]()
+    {
+        if(++ready != clients.size())
+            return;
+        auto start = Clock::now();
+        for(auto& record : records)
+        {
+            Clock::time_point intended = scheduled_time(start, record, speed);
+            ReplayClient* client = clients[record.client_id].get();
+            const TraceRecord* r = &record;
+            double delay = std::chrono::duration<double>(intended - Clock::now()).count();
+            loop.runAfter(delay > 0 ? delay : 0, [client, r, intended]() { client->send(r, intended); });
+        }
+        loop.runAfter(records.back().arrival_us / 1e6 / speed + timeout, [&]()
+        {
+            LOG_ERROR << remaining << " requests without reply after timeout";
+            stats.errors += remaining;
+            loop.quit();
+        });
+    };
+    for(auto& record : records)
+    {
+        if(!clients.count(record.client_id))
+            clients[record.client_id].reset(new ReplayClient(&loop, serverAddress, params, &stats, onReady, onDone));
+    }
+    for(auto& c : clients)
+    {
+        c.second->connect();
+    }
+    loop.loop();
+}
+
+void print_usage()
+{
+    std::cout << "usage: -f <trace file> [-a <ip address>] [-p <port>] [-l] (replay against an in-process Mserver) [-w <local worker threads>]" << std::endl
+              << "       [-x <speed factor, 2 = twice as fast>] [-t <timeout s after the last request>] [-o <json output file>]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string path;
+    std::string ip = "127.0.0.1";
+    int port = 8464;
+    bool local = false;
+    int workers = 1;
+    double speed = 1;
+    double timeout = 60;
+    std::string output;
+    const char *optstring = "f:a:p:lw:x:t:o:";
+    int option;
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'f': path = optarg; break;
+        case 'a': ip = optarg; break;
+        case 'p': port = std::stoi(optarg); break;
+        case 'l': local = true; break;
+        case 'w': workers = std::stoi(optarg); break;
+        case 'x': speed = std::stod(optarg); break;
+        case 't': timeout = std::stod(optarg); break;
+        case 'o': output = optarg; break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if(path.empty() || speed <= 0 || workers <= 0)
+    {
+        print_usage();
+        return 1;
+    }
+    TraceReader reader;
+    ServerParams params;
+    if(!reader.open(path, params) || FastPIRParams::find_param_set(params.poly_degree, params.plain_bits) == nullptr)
+    {
+        std::cout << "invalid trace file " << path << std::endl;
+        return 1;
+    }
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    while(reader.next(record))
+    {
+        records.push_back(std::move(record));
+    }
+    if(records.empty())
+    {
+        std::cout << "empty trace" << std::endl;
+        return 1;
+    }
+    LOG_INFO << "trace: " << records.size() << " records over " << records.back().arrival_us / 1e6 << " s, N = " << params.poly_degree
+             << " plain bits = " << params.plain_bits << " num_obj = " << params.num_obj << " obj_size = " << params.obj_size;
+
+    ReplayStats stats;
+    auto begin = Clock::now();
+    if(local)
+        replay_local(params, records, speed, workers, stats);
+    else
+        replay_tcp(ip, port, params, records, speed, timeout, stats);
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    std::stringstream json;
+    json << "{" << std::endl
+         << "  \"mode\": \"" << (local ? "local" : "tcp") << "\", \"trace\": \"" << path << "\", \"speed\": " << speed << "," << std::endl
+         << "  \"num_obj\": " << params.num_obj << ", \"obj_size\": " << params.obj_size << "," << std::endl
+         << "  \"records\": " << records.size() << ", \"trace_s\": " << records.back().arrival_us / 1e6 << ", \"wall_s\": " << seconds << "," << std::endl
+         << "  \"requests\": " << stats.all.count() << ", \"errors\": " << stats.errors << ", \"busy\": " << stats.busy << "," << std::endl
+         << "  \"latency_us\": " << stats.all.to_json() << "," << std::endl
+         << "  \"single_latency_us\": " << stats.single.to_json() << "," << std::endl
+         << "  \"multi_latency_us\": " << stats.multi.to_json() << "," << std::endl
+         << "  \"range_latency_us\": " << stats.range.to_json() << "," << std::endl
+         << "  \"key_upload_us\": " << stats.key_upload.to_json() << std::endl
+         << "}" << std::endl;
+    if(output.empty())
+    {
+        std::cout << json.str() << std::flush;
+    }
+    else
+    {
+        std::ofstream out(output);
+        out << json.str();
+    }
+    //tcp模式下连接由已经退出的loop持有，直接退出
+    _exit(0);
+}
@@ -2,18 +2,23 @@
 #include "muduo/net/EventLoop.h"
 #include "muduo/base/Logging.h"
 #include "codec.h"
+#include "query_scheduler.h"
+#include "metrics_http.h"
+#include "trace.h"
 #include<atomic>
 #include<mutex>
 #include "../mserver.hpp"
 using namespace muduo;
 using namespace muduo::net;
+using std::placeholders::_4;
+using std::placeholders::_5;
 class TcpQueryServer
 {
 public:
-    TcpQueryServer(EventLoop* loop, const muduo::net::InetAddress& listenAddr, size_t obj_num, size_t obj_size, bool multi_query = true)
-        :m_tcpserver(loop, listenAddr, "query_server"), m_clientid(0), m_multiquery(multi_query), m_codec(std::bind(&TcpQueryServer::onQueryMessage, this, _1, _2, _3))
+    TcpQueryServer(EventLoop* loop, const muduo::net::InetAddress& listenAddr, const FastPIRParams& params, const SchedulerConfig& config, const PrimitiveTimings* timings = nullptr, bool multi_query = true)
+        :m_codec(std::bind(&TcpQueryServer::onQueryMessage, this, _1, _2, _3, _4, _5)), m_tcpserver(loop, listenAddr, "query_server"), m_clientid(0), m_multiquery(multi_query),
+         m_estimator(params, timings), m_scheduler(config)
     {
-        FastPIRParams params(obj_num, obj_size, 8192, 40);
         m_server.reset(new Mserver(params));
         m_tcpserver.setConnectionCallback(std::bind(&TcpQueryServer::onConnection, this, _1));
         m_tcpserver.setMessageCallback(std::bind(&QueryCodeC::onMessage, m_codec, _1, _2, _3));
@@ -25,17 +30,25 @@ public:
             std::lock_guard<std::mutex> lock(m_mutex);
             conn->setContext(m_clientid);
             LOG_INFO << "query client " << conn->peerAddress().toIpPort() << " is connected, id = " << m_clientid++;
+            ServerParams params{m_server->get_poly_degree(), m_server->get_plain_data_bits(), m_server->get_num_obj(), m_server->get_obj_size()};
+            params.db_version = m_dbversion;
+            m_codec.sendParams(conn, params);
         }
         else
         {
-            LOG_INFO << "query client " << conn->peerAddress().toIpPort() << " is disconnected, id = " << boost::any_cast<uint32_t>(conn->getContext());
+            uint32_t clientId = boost::any_cast<uint32_t>(conn->getContext());
+            LOG_INFO << "query client " << conn->peerAddress().toIpPort() << " is disconnected, id = " << clientId;
+            m_scheduler.removeClient(clientId);
+            m_server->remove_client_galois_keys(clientId);
         }
     }
-    void onQueryMessage(const TcpConnectionPtr& conn, const std::string& query, Timestamp receiveTime)
+    void onQueryMessage(const TcpConnectionPtr& conn, MsgType type, uint64_t requestId, const std::string& query, Timestamp receiveTime)
     {
-        //1. 发送key   2. 发送查询(查询+偏移)
-        
-        if(m_server->get_key(boost::any_cast<uint32_t>(conn->getContext())) == nullptr)          //需要key
+        //1. 发送key   2. 发送查询(查询+偏移)  每个请求都带有request id，回复时原样带回
+        uint32_t clientId = boost::any_cast<uint32_t>(conn->getContext());
+        if(m_trace.isOpen() && (type == kGaloisKey || type == kQuery || type == kRangeQuery))
+            m_trace.record(clientId, type, requestId, query, receiveTime);
+        if(type == kGaloisKey)
         {
             std::stringstream ss;
             ss << query;
@@ -43,71 +56,289 @@ public:
             if(gk.load(m_server->getContext(), ss) == -1)
             {
                 LOG_INFO << "client msg error, address = " << conn->peerAddress().toIpPort(); 
+                m_server->get_metrics().errors++;
                 conn->forceClose();
+                return;
             }
-            m_server->set_client_galois_keys(boost::any_cast<uint32_t>(conn->getContext()), gk);
+            m_server->set_client_galois_keys(clientId, gk);
+            m_codec.sendStatus(conn, kKeyAck, requestId);
         }
-        else
+        else if(type == kQuery)
         {       //发查询的情况 因为一个查询可能很大，那么tcp一次接收肯定接收不了，需要设计一个简单的decoder，这里处理的是decoder完之后的消息
-            //multi_query / query
-            std::shared_ptr<Buffer> buf;
-            buf.reset(new Buffer);
-            buf->append(query);
-
-            int32_t queryCount = buf->peekInt32(); 
-            buf->retrieveInt32();
+            //key和planner在提交时取出并交给任务，排队期间客户端断开(key被删除)也不影响已提交的任务
+            std::shared_ptr<const seal::GaloisKeys> keys = m_server->get_key(clientId);
+            std::shared_ptr<const RotationPlanner> planner = m_server->get_planner(clientId);
+            if(keys == nullptr)
+            {
+                LOG_INFO << "client " << clientId << " query before key upload, request id = " << requestId;
+                m_server->get_metrics().errors++;
+                m_codec.sendStatus(conn, kError, requestId);
+                return;
+            }
+            m_server->get_metrics().queries++;
+            m_server->get_metrics().bytes_received += query.size();
+            //按请求的代价交给调度器，在工作线程中计算，过载时回复busy
+            //偏移的个数来自客户端，先确认payload放得下再交给工作线程
+            int32_t queryCount = parseQueryCount(query);
+            if(queryCount <= 0 || query.size() < sizeof(int32_t) + (size_t)(queryCount - 1) * 2 * sizeof(int32_t))
+            {
+                LOG_INFO << "client msg error, address = " << conn->peerAddress().toIpPort() << " id = " << clientId;
+                m_server->get_metrics().errors++;
+                conn->forceClose();
+                return;
+            }
+            std::shared_ptr<std::string> payload = std::make_shared<std::string>(query);
+            m_scheduler.submit(clientId, m_estimator.estimate(queryCount),
+                [this, conn, clientId, requestId, payload, receiveTime, keys, planner]() { handleQuery(conn, clientId, requestId, *payload, receiveTime, *keys, *planner); },
+                [this, conn, clientId, requestId]()
+                {
+                    LOG_INFO << "client " << clientId << " request id = " << requestId << " rejected, server busy";
+                    m_server->get_metrics().rejected++;
+                    m_codec.sendStatus(conn, kBusy, requestId);
+                });
+        }
+        else if(type == kRangeQuery)
+        {
+            //key和planner在提交时取出并交给任务，排队期间客户端断开(key被删除)也不影响已提交的任务
+            std::shared_ptr<const seal::GaloisKeys> keys = m_server->get_key(clientId);
+            std::shared_ptr<const RotationPlanner> planner = m_server->get_planner(clientId);
+            if(keys == nullptr)
+            {
+                LOG_INFO << "client " << clientId << " query before key upload, request id = " << requestId;
+                m_server->get_metrics().errors++;
+                m_codec.sendStatus(conn, kError, requestId);
+                return;
+            }
+            m_server->get_metrics().range_queries++;
+            m_server->get_metrics().bytes_received += query.size();
+            //范围是公开的，代价只与范围内的列数有关
+            size_t offset, length;
+            if(!parseRange(query, offset, length))
+            {
+                LOG_INFO << "client msg error, address = " << conn->peerAddress().toIpPort() << " id = " << clientId;
+                m_server->get_metrics().errors++;
+                conn->forceClose();
+                return;
+            }
+            auto columns = FastPIRParams::column_range(m_server->get_obj_size(), offset, length, m_server->get_plain_data_bits());
+            std::shared_ptr<std::string> payload = std::make_shared<std::string>(query);
+            m_scheduler.submit(clientId, m_estimator.estimateRange(columns.first, columns.second),
+                [this, conn, clientId, requestId, payload, receiveTime, keys]() { handleRangeQuery(conn, clientId, requestId, *payload, receiveTime, *keys); },
+                [this, conn, clientId, requestId]()
+                {
+                    LOG_INFO << "client " << clientId << " request id = " << requestId << " rejected, server busy";
+                    m_server->get_metrics().rejected++;
+                    m_codec.sendStatus(conn, kBusy, requestId);
+                });
+        }
+        else
+        {
+            LOG_INFO << "unknown msg type " << (int)type << ", address = " << conn->peerAddress().toIpPort();
+            m_server->get_metrics().errors++;
+            m_codec.sendStatus(conn, kError, requestId);
+        }
+    }
 
-            queryCount = sockets::networkToHost32(queryCount);
-            LOG_INFO << "client " << boost::any_cast<uint32_t>(conn->getContext()) << " query count = " << queryCount;  
-            assert(queryCount > 0);
+    //在调度器的工作线程中执行: 解析查询、生成回复并发送
+    void handleQuery(const TcpConnectionPtr& conn, uint32_t clientId, uint64_t requestId, const std::string& payload, Timestamp receiveTime,
+                     const seal::GaloisKeys& keys, const RotationPlanner& planner)
+    {
+        if(!conn->connected())
+            return;
+        RequestTrace trace;
+        TraceScope scope(&trace);
+        trace.queue_ns = timeDifference(Timestamp::now(), receiveTime) * 1e9;
+        std::shared_ptr<Buffer> buf;
+        buf.reset(new Buffer);
+        buf->append(payload);
 
-            std::vector<int> indexOffset(queryCount - 1);
-            std::vector<int> coeffOffset(queryCount - 1);
+        try
+        {
+            //payload的长度已在IO线程中按queryCount检查过
+            int32_t queryCount = sockets::networkToHost32(buf->readInt32());
+            LOG_INFO << "client " << clientId << " request id = " << requestId << " query count = " << queryCount;
+            Query q;
+            q.indexOffset.resize(queryCount - 1);
+            q.coeffOffset.resize(queryCount - 1);
             for(int i = 0; i < queryCount - 1; ++i)
             {
-                indexOffset[i] = sockets::networkToHost32(buf->peekInt32());
-                buf->retrieveInt32();
-                coeffOffset[i] = sockets::networkToHost32(buf->peekInt32());
-                buf->retrieveInt32();
+                q.indexOffset[i] = sockets::networkToHost32(buf->readInt32());
+                q.coeffOffset[i] = sockets::networkToHost32(buf->readInt32());
             }
-            std::stringstream ss;
-            // size1 cipherSerlerize1 size2 cipherSerlerize2 ... 
-            PIRQuery query(m_server->get_query_ciphertext_count());
-            for(int i = 0; i < m_server->get_query_ciphertext_count(); i++)
+            if(!parseCiphertexts(buf.get(), q.query))
             {
-                int serSize = buf->peekInt32();
-                buf->retrieveInt32();
-                ss << buf->retrieveAsString(sockets::networkToHost32(serSize));
-                seal::Ciphertext cipher;
-                if(cipher.load(m_server->getContext(), ss) == -1)
-                {
-                    LOG_INFO << "client msg error, address = " << conn->peerAddress().toIpPort() << " id = " << boost::any_cast<uint32_t>(conn->getContext()); 
-                    conn->forceClose();
-                }
-                query[i] = cipher;
+                LOG_INFO << "client msg error, address = " << conn->peerAddress().toIpPort() << " id = " << clientId; 
+                m_server->get_metrics().errors++;
+                conn->forceClose();
+                return;
             }
-            Query q;
-            q.query = query;
-            q.indexOffset = indexOffset;
-            q.coeffOffset = coeffOffset;
-            PIRReply reply = m_server->get_multi_response(boost::any_cast<uint32_t>(conn->getContext()), q);            //generate reply
-            std::vector<std::stringstream> replyStream(reply.size());
+            ResponseStats stats;
+            PIRReply reply = m_server->get_multi_response(q, keys, planner, &stats);            //generate reply，偏移越界时抛出
+            LOG_INFO << "client " << clientId << " request id = " << requestId << " rotations = " << stats.total()
+                     << " (move " << stats.move_rotations << "/" << stats.planned_rotations << " concat " << stats.concat_rotations << " sum " << stats.sum_rotations << ")";
+            sendReply(conn, clientId, requestId, reply, receiveTime);
+        }
+        catch(const std::exception& e)
+        {
+            replyError(conn, clientId, requestId, e);
+        }
+    }
+
+    //SEAL或planner抛出的异常不能离开工作线程(否则std::terminate)，回复kError
+    void replyError(const TcpConnectionPtr& conn, uint32_t clientId, uint64_t requestId, const std::exception& e)
+    {
+        LOG_INFO << "client " << clientId << " request id = " << requestId << " failed: " << e.what();
+        m_server->get_metrics().errors++;
+        m_codec.sendStatus(conn, kError, requestId);
+    }
+
+    void handleRangeQuery(const TcpConnectionPtr& conn, uint32_t clientId, uint64_t requestId, const std::string& payload, Timestamp receiveTime,
+                          const seal::GaloisKeys& keys)
+    {
+        if(!conn->connected())
+            return;
+        RequestTrace trace;
+        TraceScope scope(&trace);
+        trace.queue_ns = timeDifference(Timestamp::now(), receiveTime) * 1e9;
+        size_t offset, length;
+        parseRange(payload, offset, length);
+        Buffer buf;
+        buf.append(payload.data() + 2 * sizeof(int64_t), payload.size() - 2 * sizeof(int64_t));
+        PIRQuery query;
+        if(!parseCiphertexts(&buf, query))
+        {
+            LOG_INFO << "client msg error, address = " << conn->peerAddress().toIpPort() << " id = " << clientId;
+            m_server->get_metrics().errors++;
+            conn->forceClose();
+            return;
+        }
+        LOG_INFO << "client " << clientId << " request id = " << requestId << " range = [" << offset << ", " << offset + length << ")";
+        try
+        {
+            PIRReply reply = m_server->get_range_response(query, keys, offset, length);
+            sendReply(conn, clientId, requestId, reply, receiveTime);
+        }
+        catch(const std::exception& e)
+        {
+            replyError(conn, clientId, requestId, e);
+        }
+    }
+
+    // size1 cipherSerlerize1 size2 cipherSerlerize2 ... 
+    bool parseCiphertexts(Buffer* buf, PIRQuery& query)
+    {
+        StageTimer timer(m_server->get_metrics(), kStageDeserialize);
+        std::stringstream ss;
+        query.resize(m_server->get_query_ciphertext_count());
+        for(int i = 0; i < m_server->get_query_ciphertext_count(); i++)
+        {
+            if(buf->readableBytes() < sizeof(int32_t))
+                return false;
+            int32_t serSize = sockets::networkToHost32(buf->peekInt32());
+            buf->retrieveInt32();
+            if(serSize < 0 || (size_t)serSize > buf->readableBytes())
+                return false;
+            ss << buf->retrieveAsString(serSize);
+            try
+            {
+                if(query[i].load(m_server->getContext(), ss) == -1)
+                    return false;
+            }
+            catch(const std::exception&)            //SEAL对不合法的密文抛出异常
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //开启了计时trailer时，把当前请求的各阶段耗时随回复一起发回
+    void sendReply(const TcpConnectionPtr& conn, uint32_t clientId, uint64_t requestId, const PIRReply& reply, Timestamp receiveTime)
+    {
+        ServerMetrics& metrics = m_server->get_metrics();
+        std::vector<std::stringstream> replyStream(reply.size());
+        {
+            StageTimer timer(metrics, kStageSerialize);
             for(int i = 0; i < reply.size(); ++i)
             {
                 if(reply[i].save(replyStream[i]) == -1)
                 {
-                    LOG_INFO << "reply error, address = " << conn->peerAddress().toIpPort() << "id = " << boost::any_cast<uint32_t>(conn->getContext()); 
+                    LOG_INFO << "reply error, address = " << conn->peerAddress().toIpPort() << "id = " << clientId; 
+                    metrics.errors++;
                     conn->forceClose();
+                    return;
                 }
+                metrics.bytes_sent += replyStream[i].tellp();
             }
-            m_codec.send(conn, replyStream);
         }
+        RequestTrace* trace = current_trace();
+        ServerTiming timing;
+        if(m_timingtrailer && trace)
+        {
+            timing.queue_us = trace->queue_ns / 1000;
+            timing.deserialize_us = trace->stage_ns[kStageDeserialize] / 1000;
+            timing.query_ntt_us = trace->stage_ns[kStageQueryNtt] / 1000;
+            timing.inner_product_us = trace->stage_ns[kStageInnerProduct] / 1000;
+            timing.rotation_us = trace->stage_ns[kStageRotation] / 1000;
+            timing.packing_us = trace->stage_ns[kStagePacking] / 1000;
+            timing.serialize_us = trace->stage_ns[kStageSerialize] / 1000;
+            timing.total_us = timeDifference(Timestamp::now(), receiveTime) * 1e6;
+            timing.multiply_plain = trace->multiply_plain;
+            timing.rotations = trace->rotations;
+        }
+        StageTimer timer(metrics, kStageSend);
+        m_codec.send(conn, requestId, replyStream, m_timingtrailer && trace ? &timing : nullptr);
+    }
+
+    void setTimingTrailer(bool enable)
+    {
+        m_timingtrailer = enable;
+    }
+
+    //记录之后收到的key和查询(含到达时间)，供tcp_query_replay回放
+    bool openTrace(const std::string& path)
+    {
+        ServerParams params{m_server->get_poly_degree(), m_server->get_plain_data_bits(), m_server->get_num_obj(), m_server->get_obj_size()};
+        return m_trace.open(path, params);
+    }
+
+    //范围越界时返回false
+    bool parseRange(const std::string& payload, size_t& offset, size_t& length)
+    {
+        if(payload.size() < 2 * sizeof(int64_t))
+            return false;
+        Buffer buf;
+        buf.append(payload.data(), 2 * sizeof(int64_t));
+        offset = sockets::networkToHost64(buf.readInt64());
+        length = sockets::networkToHost64(buf.readInt64());
+        return length > 0 && offset < m_server->get_obj_size() && length <= m_server->get_obj_size() - offset;
     }
+
+    static int32_t parseQueryCount(const std::string& query)
+    {
+        if(query.size() < sizeof(int32_t))
+            return -1;
+        Buffer buf;
+        buf.append(query.data(), sizeof(int32_t));
+        return sockets::networkToHost32(buf.peekInt32());
+    }
+
+    //Prometheus文本格式，只在/metrics被抓取时调用
+    std::string metricsText()
+    {
+        std::string text = m_server->get_metrics().to_prometheus(seal::MemoryManager::GetPool().alloc_byte_count());
+        text += "# HELP fastpir_queued_requests Requests waiting in the scheduler.\n# TYPE fastpir_queued_requests gauge\nfastpir_queued_requests "
+                + std::to_string(m_scheduler.queued()) + "\n";
+        return text;
+    }
+
     void start()
     {
         LOG_INFO << "prepare db ...";
         m_server->set_db(generate_db());
         m_server->preprocess_db();
+        m_dbversion = Timestamp::now().microSecondsSinceEpoch();         //每次载入库换一个版本，客户端缓存的旧记录随之失效
+        m_scheduler.start();
         LOG_INFO << "server started ";
         m_tcpserver.start();
     }
@@ -141,14 +372,120 @@ private:
     uint32_t m_clientid;           //自增，client_id
     std::mutex m_mutex;
     bool m_multiquery;
+    bool m_timingtrailer = false;  //回复是否带服务端计时
+    uint64_t m_dbversion = 0;
+    TraceWriter m_trace;
+    QueryCostEstimator m_estimator;
+    QueryScheduler m_scheduler;
 };
 
+void print_usage()
+{
+    std::cout << "usage: -p <port> -n <number of objects> -s <object size in bytes> [-N <poly degree>] [-b <plain bits>] -w <worker threads>" << std::endl
+              << "       -q <max queued requests> -c <max queued requests per client> -i <max running requests per client> -t <queue deadline s>" << std::endl
+              << "       [-C] (measure primitive timings at startup to weight request costs) [-m <metrics http port>] [-T] (attach per-request server timing to replies; requires clients that understand the trailer, older ones drop the connection)" << std::endl
+              << "       [-R <trace file>] (record keys and queries for tcp_query_replay)" << std::endl;
+}
+
 int main(int argc, char** argv)
 {
     int port = 8464;
+    size_t num_obj = 1000;
+    size_t obj_size = 288;
+    size_t poly_degree = POLY_MODULUS_DEGREE;
+    size_t plain_bits = PLAIN_BIT;
+    SchedulerConfig config;
+    bool calibrate = false;
+    int metrics_port = 0;
+    bool timing_trailer = false;
+    std::string trace_path;
+    const char *optstring = "p:n:s:N:b:w:q:c:i:t:Cm:TR:";
+    int option;
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'p':
+            port = std::stoi(optarg);
+            break;
+        case 'n':
+            num_obj = std::stoi(optarg);
+            break;
+        case 's':
+            obj_size = std::stoi(optarg);
+            break;
+        case 'N':
+            poly_degree = std::stoi(optarg);
+            break;
+        case 'b':
+            plain_bits = std::stoi(optarg);
+            break;
+        case 'w':
+            config.workers = std::stoi(optarg);
+            break;
+        case 'q':
+            config.max_queued = std::stoi(optarg);
+            break;
+        case 'c':
+            config.max_queued_per_client = std::stoi(optarg);
+            break;
+        case 'i':
+            config.max_inflight_per_client = std::stoi(optarg);
+            break;
+        case 't':
+            config.deadline = std::stod(optarg);
+            break;
+        case 'C':
+            calibrate = true;
+            break;
+        case 'm':
+            metrics_port = std::stoi(optarg);
+            break;
+        case 'T':
+            timing_trailer = true;
+            break;
+        case 'R':
+            trace_path = optarg;
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
     EventLoop loop;
     InetAddress addr(port);
-    TcpQueryServer server(&loop, addr, 1000, 288);
+    if(FastPIRParams::find_param_set(poly_degree, plain_bits) == nullptr)
+    {
+        std::cout << "unsupported parameters, available (N, plain bits):";
+        for(auto& set : FastPIRParams::param_sets())
+        {
+            std::cout << " (" << set.poly_degree << ", " << set.plain_bits << ")";
+        }
+        std::cout << std::endl;
+        return 1;
+    }
+    FastPIRParams params(num_obj, obj_size, poly_degree, plain_bits);
+    //启动时实测基本运算的时间，调度器按实测比例估计请求的代价
+    PrimitiveTimings timings;
+    if(calibrate)
+    {
+        timings = measure_primitives(params);
+        LOG_INFO << "calibrated: inner product term " << timings.inner_product_term << " us, rotate " << timings.rotate << " us, intt " << timings.intt << " us";
+    }
+    TcpQueryServer server(&loop, addr, params, config, calibrate ? &timings : nullptr);
+    server.setTimingTrailer(timing_trailer);
+    if(!trace_path.empty() && !server.openTrace(trace_path))
+    {
+        std::cout << "can't open trace file " << trace_path << std::endl;
+        return 1;
+    }
     server.start();
+    //-m时在同一个loop上提供/metrics
+    std::unique_ptr<MetricsHttpServer> metrics;
+    if(metrics_port > 0)
+    {
+        metrics.reset(new MetricsHttpServer(&loop, InetAddress(metrics_port), std::bind(&TcpQueryServer::metricsText, &server)));
+        metrics->start();
+    }
     loop.loop();
-}
\ No newline at end of file
+}
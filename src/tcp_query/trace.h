@@ -0,0 +1,212 @@
+#ifndef __MTRACE_H__
+#define __MTRACE_H__
+#include "codec.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// 请求trace文件，所有整数为网络字节序:
+// | magic "FPIRTRC1" | poly degree(int32) plain bits(int32) num obj(int64) obj size(int64) |
+// record*: | arrival(int64 us，相对于第一条) | client id(int32) | type(int8) | request id(int64) | len(int64) | payload |
+// payload是原始的消息(galois key或查询)，回放时按原样发给服务端或交给进程内的Mserver
+const char kTraceMagic[8] = {'F', 'P', 'I', 'R', 'T', 'R', 'C', '1'};
+
+struct TraceRecord
+{
+    uint64_t arrival_us;
+    uint32_t client_id;
+    MsgType type;
+    uint64_t request_id;
+    std::string payload;
+};
+
+//服务端在loop线程中调用record，只把记录放进队列，由单独的写线程写文件，loop线程不会被磁盘阻塞。
+//多个loop线程也可以共用一个writer，析构时写完队列中剩下的记录。
+//队列中的payload超过kMaxQueuedBytes(磁盘跟不上)时丢弃新的记录并计数，丢了key的客户端回放时查询会失败
+class TraceWriter
+{
+public:
+    static const size_t kMaxQueuedBytes = 256 << 20;
+
+    ~TraceWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        if(m_thread.joinable())
+            m_thread.join();
+        if(m_dropped > 0)
+            LOG_WARN << "trace dropped " << m_dropped << " records, writer couldn't keep up";
+    }
+
+    bool open(const std::string& path, const ServerParams& params)
+    {
+        m_out.open(path, std::ios::binary | std::ios::trunc);
+        if(!m_out)
+            return false;
+        m_out.write(kTraceMagic, sizeof(kTraceMagic));
+        write32(params.poly_degree);
+        write32(params.plain_bits);
+        write64(params.num_obj);
+        write64(params.obj_size);
+        m_out.flush();
+        if(!m_out)
+            return false;
+        m_thread = std::thread(&TraceWriter::writeLoop, this);
+        return true;
+    }
+
+    void record(uint32_t clientId, MsgType type, uint64_t requestId, const std::string& payload, Timestamp receiveTime)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_stop)
+                return;
+            if(m_queuedbytes + payload.size() > kMaxQueuedBytes)
+            {
+                if(m_dropped++ == 0)
+                    LOG_WARN << "trace queue full, dropping records";
+                return;
+            }
+            int64_t now = receiveTime.microSecondsSinceEpoch();
+            if(m_first < 0)
+                m_first = now;
+            m_queue.push_back(TraceRecord{static_cast<uint64_t>(now > m_first ? now - m_first : 0), clientId, type, requestId, payload});
+            m_queuedbytes += payload.size();
+        }
+        m_cond.notify_one();
+    }
+
+    //因为队列满而丢弃的记录数
+    uint64_t dropped()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropped;
+    }
+
+    bool isOpen() const
+    {
+        return m_thread.joinable();
+    }
+
+private:
+    //一次取走队列中所有的记录，写完再flush；写失败后丢弃之后的记录
+    void writeLoop()
+    {
+        std::deque<TraceRecord> batch;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this]{return m_stop || !m_queue.empty();});
+                if(m_queue.empty())
+                    break;
+                batch.swap(m_queue);
+                m_queuedbytes = 0;
+            }
+            for(auto& r : batch)
+            {
+                if(!m_out)
+                    break;
+                write64(r.arrival_us);
+                write32(r.client_id);
+                m_out.put(r.type);
+                write64(r.request_id);
+                write64(r.payload.size());
+                m_out.write(r.payload.data(), r.payload.size());
+            }
+            batch.clear();
+            m_out.flush();
+        }
+    }
+
+    void write32(uint32_t value)
+    {
+        uint32_t v = sockets::hostToNetwork32(value);
+        m_out.write((const char*)&v, sizeof(v));
+    }
+    void write64(uint64_t value)
+    {
+        uint64_t v = sockets::hostToNetwork64(value);
+        m_out.write((const char*)&v, sizeof(v));
+    }
+
+    std::ofstream m_out;                    //只在写线程中使用(open之后)
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<TraceRecord> m_queue;
+    std::thread m_thread;
+    size_t m_queuedbytes = 0;               //m_queue中payload的总长度
+    uint64_t m_dropped = 0;
+    int64_t m_first = -1;
+    bool m_stop = false;
+};
+
+class TraceReader
+{
+public:
+    bool open(const std::string& path, ServerParams& params)
+    {
+        m_in.open(path, std::ios::binary);
+        char magic[sizeof(kTraceMagic)];
+        if(!m_in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kTraceMagic))
+            return false;
+        params.poly_degree = read32();
+        params.plain_bits = read32();
+        params.num_obj = read64();
+        params.obj_size = read64();
+        m_size = 0;
+        if(m_in)
+        {
+            std::streampos pos = m_in.tellg();
+            m_in.seekg(0, std::ios::end);
+            m_size = m_in.tellg();
+            m_in.seekg(pos);
+        }
+        return (bool)m_in;
+    }
+
+    //文件结束或最后一条不完整(服务端被杀掉)时返回false
+    bool next(TraceRecord& record)
+    {
+        record.arrival_us = read64();
+        record.client_id = read32();
+        record.type = static_cast<MsgType>(m_in.get());
+        record.request_id = read64();
+        uint64_t len = read64();
+        if(!m_in)
+            return false;
+        //长度来自文件，超过剩下的字节数时是损坏或不完整的记录，不能按它分配
+        uint64_t pos = m_in.tellg();
+        if(len > m_size - std::min(pos, m_size))
+            return false;
+        record.payload.resize(len);
+        m_in.read(&record.payload[0], len);
+        return (bool)m_in;
+    }
+
+private:
+    uint32_t read32()
+    {
+        uint32_t v = 0;
+        m_in.read((char*)&v, sizeof(v));
+        return sockets::networkToHost32(v);
+    }
+    uint64_t read64()
+    {
+        uint64_t v = 0;
+        m_in.read((char*)&v, sizeof(v));
+        return sockets::networkToHost64(v);
+    }
+
+    std::ifstream m_in;
+    uint64_t m_size = 0;                    //文件长度
+};
+
+#endif
@@ -0,0 +1,155 @@
+//测试变长记录PIR: 记录长度大多在-s附近，少数为不超过-S的大记录，按size class分库后与统一补齐到最大长度比较
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+
+#include "bfvparams.h"
+#include "mfastpirparams.hpp"
+#include "mclient.hpp"
+#include "mserver.hpp"
+#include "mvarlenpir.hpp"
+
+void print_usage();
+int main(int argc, char *argv[])
+{
+    size_t num_obj = 0;
+    size_t typical_size = 200;
+    size_t max_size = 4096;
+    double outlier_rate = 0.001;
+    size_t max_chunk_size = 0;
+    int threads = 1;
+    size_t lookups = 4;
+    size_t poly_degree = POLY_MODULUS_DEGREE;
+    size_t plain_bits = PLAIN_BIT;
+    int option;
+    const char *optstring = "n:s:S:o:c:t:k:N:b:";
+    while ((option = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            num_obj = std::stoi(optarg);
+            break;
+        case 's':
+            typical_size = std::stoi(optarg);
+            break;
+        case 'S':
+            max_size = std::stoi(optarg);
+            break;
+        case 'o':
+            outlier_rate = std::stod(optarg);
+            break;
+        case 'c':
+            max_chunk_size = std::stoi(optarg);
+            break;
+        case 't':
+            threads = std::stoi(optarg);
+            break;
+        case 'k':
+            lookups = std::stoi(optarg);
+            break;
+        case 'N':
+            poly_degree = std::stoi(optarg);
+            break;
+        case 'b':
+            plain_bits = std::stoi(optarg);
+            break;
+        case '?':
+            print_usage();
+            return 1;
+        }
+    }
+    if (!num_obj || !typical_size || max_size < typical_size)
+    {
+        print_usage();
+        return 1;
+    }
+    if (FastPIRParams::find_param_set(poly_degree, plain_bits) == nullptr)
+    {
+        std::cout << "unsupported BFV parameters: N = " << poly_degree << " plain bits = " << plain_bits << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 rng(std::random_device{}());
+    std::chrono::high_resolution_clock::time_point time_start, time_end;
+    std::vector<std::vector<unsigned char>> db(num_obj);
+    std::vector<size_t> sizes(num_obj);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    size_t largest = rng() % num_obj;               //保证至少有一条最大的记录
+    for (size_t i = 0; i < num_obj; i++)
+    {
+        if (i == largest)
+            sizes[i] = max_size;
+        else if (uniform(rng) < outlier_rate)
+            sizes[i] = typical_size + rng() % (max_size - typical_size + 1);
+        else
+            sizes[i] = typical_size / 2 + rng() % (typical_size / 2 + 1);
+        db[i].resize(sizes[i]);
+        for (auto& c : db[i])
+        {
+            c = rng() % 0xFF;
+        }
+    }
+
+    time_start = std::chrono::high_resolution_clock::now();
+    auto layout = std::make_shared<const VarLenLayout>(sizes, max_chunk_size, poly_degree, plain_bits);
+    time_end = std::chrono::high_resolution_clock::now();
+    auto plan_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+    std::cout << "classes: " << layout->get_num_classes() << " rounds: " << layout->get_rounds() << std::endl;
+    for (size_t c = 0; c < layout->get_num_classes(); c++)
+    {
+        std::cout << "  class " << c << ": size " << layout->get_class_size(c) << " objects " << layout->get_class_num_obj(c) << std::endl;
+    }
+    std::cout << "scan cost: " << layout->scan_cost() << " (padded to " << max_size << " bytes: "
+              << VarLenLayout::class_cost(num_obj, max_size, poly_degree, plain_bits) << ")" << std::endl;
+
+    VarLenPIRServer server(layout, threads);
+    VarLenPIRClient client(layout);
+    time_start = std::chrono::high_resolution_clock::now();
+    server.set_db(db);
+    time_end = std::chrono::high_resolution_clock::now();
+    auto db_preprocess_time = (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+    server.set_client_galois_keys(0, client.get_galois_keys());
+
+    bool incorrect_result = false;
+    long long query_time = 0, response_time = 0, decode_time = 0;
+    for (size_t k = 0; k < lookups; k++)
+    {
+        //第一次查最大的记录，其余随机
+        uint32_t record = k == 0 ? largest : rng() % num_obj;
+        time_start = std::chrono::high_resolution_clock::now();
+        std::vector<PIRQuery> querys = client.gen_query(record);
+        time_end = std::chrono::high_resolution_clock::now();
+        query_time += (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        time_start = std::chrono::high_resolution_clock::now();
+        std::vector<PIRReply> replys = server.get_response(0, querys);
+        time_end = std::chrono::high_resolution_clock::now();
+        response_time += (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        time_start = std::chrono::high_resolution_clock::now();
+        std::vector<unsigned char> result = client.decode_response(replys);
+        time_end = std::chrono::high_resolution_clock::now();
+        decode_time += (std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start)).count();
+
+        if (result != db[record])
+        {
+            incorrect_result = true;
+            std::cout << "error index = " << record << " size = " << sizes[record] << std::endl;
+        }
+    }
+    std::cout << (incorrect_result ? "PIR Result is incorrect!" : "PIR result correct!") << std::endl << std::endl;
+    std::cout << "Class planning time (us): " << plan_time << std::endl;
+    std::cout << "DB preprocessing time (us): " << db_preprocess_time << std::endl;
+    std::cout << "Query generation time (us): " << query_time / lookups << std::endl;
+    std::cout << "Response generation time (us): " << response_time / lookups << std::endl;
+    std::cout << "Response decode time (us): " << decode_time / lookups << std::endl;
+    return incorrect_result;
+}
+
+void print_usage()
+{
+    std::cout << "usage: varlen_query_test -n <number of records> [-s <typical size>] [-S <max size>] [-o <outlier rate>]"
+              << " [-c <max chunk size>] [-t <threads>] [-k <lookups>] [-N <poly degree>] [-b <plain bits>]" << std::endl;
+}